@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+namespace dispatch_queue {
+
+namespace detail {
+
+/**
+ * Allocator that respects the alignment of over-aligned types, such as the cache line aligned counters of workers.
+ *
+ * C++14 `new` only guarantees the alignment of `std::max_align_t`, so blocks are over-allocated and aligned by hand,
+ * storing the original allocation right before the aligned block.
+ */
+template<typename T>
+struct aligned_allocator {
+	using value_type = T;
+
+	aligned_allocator() = default;
+	template<typename U>
+	aligned_allocator(const aligned_allocator<U>&) {}
+
+	T *allocate(size_t count) {
+		size_t header_size = sizeof(void *) + alignof(T) - 1;
+		char *allocation = static_cast<char *>(::operator new(sizeof(T) * count + header_size));
+		uintptr_t address = reinterpret_cast<uintptr_t>(allocation + sizeof(void *));
+		address = (address + alignof(T) - 1) & ~(uintptr_t) (alignof(T) - 1);
+		reinterpret_cast<void **>(address)[-1] = allocation;
+		return reinterpret_cast<T *>(address);
+	}
+
+	void deallocate(T *objects, size_t) {
+		::operator delete(reinterpret_cast<void **>(objects)[-1]);
+	}
+
+	template<typename U>
+	bool operator==(const aligned_allocator<U>&) const {
+		return true;
+	}
+	template<typename U>
+	bool operator!=(const aligned_allocator<U>&) const {
+		return false;
+	}
+};
+
+} // end namespace detail
+
+} // end namespace dispatch_queue
@@ -0,0 +1,178 @@
+#pragma once
+
+#ifdef __has_include
+	#if __has_include(<version>)
+		#include <version>
+	#endif
+#endif
+
+#ifdef __cpp_lib_coroutine
+
+#include <coroutine>
+#include <exception>
+#include <memory>
+#include <type_traits>
+#include <utility>
+
+namespace dispatch_queue {
+
+/**
+ * Coroutine type that produces a sequence of values with `co_yield`, consumed with `co_await next()`.
+ *
+ * The generator is lazy: the coroutine only runs when the consumer awaits `next`, until it yields the next value.
+ * Yielded values are not copied: the consumer receives a pointer to the yielded object, valid until the next call to `next`.
+ * The producer may `co_await` between yields, for example `co_await dispatch_queue.dispatch()` to run in a background thread.
+ * The consumer then continues in the thread where the producer yielded.
+ *
+ * @code
+ * dispatch_queue::async_generator<row> query_rows(dispatch_queue::dispatch_queue& q, query_t query) {
+ *     co_await q.dispatch();
+ *     while (row r = fetch_row(query)) {
+ *         co_yield r;
+ *     }
+ * }
+ *
+ * auto rows = query_rows(dispatch_queue, query);
+ * while (row *r = co_await rows.next()) {
+ *     process_row(*r);
+ * }
+ * @endcode
+ */
+template<typename T>
+class async_generator {
+public:
+	using value_type = std::remove_reference_t<T>;
+
+	class promise_type {
+	public:
+		async_generator get_return_object() {
+			return async_generator(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+
+		std::suspend_always initial_suspend() const noexcept { return {}; }
+
+		/// Hands control back to the consumer awaiting `next`
+		struct yield_awaiter {
+			bool await_ready() const noexcept { return false; }
+			std::coroutine_handle<> await_suspend(std::coroutine_handle<promise_type> producer) const noexcept {
+				return producer.promise().consumer;
+			}
+			void await_resume() const noexcept {}
+		};
+
+		yield_awaiter final_suspend() const noexcept {
+			return {};
+		}
+
+		yield_awaiter yield_value(value_type& value) noexcept {
+			current_value = std::addressof(value);
+			return {};
+		}
+
+		// Temporaries live until the end of the `co_yield` expression, which spans the suspension
+		yield_awaiter yield_value(value_type&& value) noexcept {
+			current_value = std::addressof(value);
+			return {};
+		}
+
+		void return_void() {
+			current_value = nullptr;
+		}
+
+		void unhandled_exception() {
+			current_value = nullptr;
+			exception = std::current_exception();
+		}
+
+	private:
+		value_type *current_value = nullptr;
+		std::exception_ptr exception;
+		std::coroutine_handle<> consumer;
+
+		friend class async_generator;
+	};
+
+	class next_awaiter {
+	public:
+		explicit next_awaiter(std::coroutine_handle<promise_type> producer) : producer(producer) {}
+
+		bool await_ready() const noexcept {
+			return !producer || producer.done();
+		}
+
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> consumer) const noexcept {
+			producer.promise().consumer = consumer;
+			return producer;
+		}
+
+		/// @returns Pointer to the yielded value, or `nullptr` when the generator finished.
+		value_type *await_resume() const {
+			if (!producer) {
+				return nullptr;
+			}
+			promise_type& promise = producer.promise();
+#ifdef __cpp_exceptions
+			if (promise.exception) {
+				std::rethrow_exception(std::exchange(promise.exception, nullptr));
+			}
+#endif
+			return promise.current_value;
+		}
+
+	private:
+		std::coroutine_handle<promise_type> producer;
+	};
+
+	async_generator() = default;
+	async_generator(async_generator&& other) noexcept : coroutine(std::exchange(other.coroutine, nullptr)) {}
+	async_generator& operator=(async_generator&& other) noexcept {
+		if (this != &other) {
+			destroy();
+			coroutine = std::exchange(other.coroutine, nullptr);
+		}
+		return *this;
+	}
+	async_generator(const async_generator&) = delete;
+	async_generator& operator=(const async_generator&) = delete;
+
+	/**
+	 * Destroys the coroutine if it is not finished, destroying its local variables.
+	 * Must not be called while the consumer is awaiting `next`.
+	 */
+	~async_generator() {
+		destroy();
+	}
+
+	/**
+	 * Returns an awaiter that resumes the producer until it yields the next value.
+	 * The awaiter resumes with a pointer to the yielded value, valid until the next call to `next`,
+	 * or `nullptr` once the generator finished.
+	 * If the producer throws an exception, it is rethrown by the awaiter.
+	 */
+	next_awaiter next() {
+		return next_awaiter(coroutine);
+	}
+
+	/**
+	 * Returns whether the generator finished producing values.
+	 */
+	bool done() const {
+		return !coroutine || coroutine.done();
+	}
+
+private:
+	std::coroutine_handle<promise_type> coroutine;
+
+	explicit async_generator(std::coroutine_handle<promise_type> coroutine) : coroutine(coroutine) {}
+
+	void destroy() {
+		if (coroutine) {
+			coroutine.destroy();
+			coroutine = nullptr;
+		}
+	}
+};
+
+} // end namespace dispatch_queue
+
+#endif
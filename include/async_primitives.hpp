@@ -0,0 +1,384 @@
+#pragma once
+
+#ifdef __has_include
+	#if __has_include(<version>)
+		#include <version>
+	#endif
+#endif
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <utility>
+
+#ifdef __cpp_lib_coroutine
+#include <coroutine>
+#endif
+
+namespace dispatch_queue {
+
+namespace detail {
+
+/**
+ * Suspended coroutine waiting on an async primitive.
+ * Waiters live inside the awaiter, in the coroutine frame, so waiting never allocates.
+ */
+struct async_waiter {
+	async_waiter *next = nullptr;
+	void (*resume_fn)(async_waiter *) = nullptr;
+
+	/// Resume the coroutine. The waiter may be destroyed as soon as this is called.
+	void resume() {
+		resume_fn(this);
+	}
+};
+
+#ifdef __cpp_lib_coroutine
+/**
+ * Scheduler that resumes waiters inline, in the thread that releases them.
+ */
+struct inline_scheduler {
+	void await_suspend(std::coroutine_handle<> cont) const {
+		cont.resume();
+	}
+};
+
+/**
+ * Waiter that resumes its coroutine through `Scheduler::await_suspend`,
+ * like the awaiters returned by `dispatch_queue::dispatch()` and `dispatch_queue::dispatch_main()`.
+ * `Waiter` may extend `async_waiter` with state used by the primitive.
+ */
+template<typename Scheduler, typename Waiter = async_waiter>
+struct scheduled_waiter : Waiter {
+	Scheduler scheduler;
+	std::coroutine_handle<> handle;
+
+	explicit scheduled_waiter(Scheduler scheduler)
+		: scheduler(std::move(scheduler))
+	{
+		this->resume_fn = [](async_waiter *waiter) {
+			// Copy the scheduler first: the coroutine may resume and destroy this waiter before `await_suspend` returns
+			scheduled_waiter *self = static_cast<scheduled_waiter *>(waiter);
+			Scheduler scheduler = self->scheduler;
+			scheduler.await_suspend(self->handle);
+		};
+	}
+};
+#endif
+
+} // end namespace detail
+
+/**
+ * Counting semaphore for coroutines: `co_await acquire()` suspends the coroutine instead of blocking the thread.
+ *
+ * Acquiring and releasing are lock-free while there are no waiters.
+ * Waiters are resumed in FIFO order.
+ *
+ * By default, waiters resume inline in the thread that calls `release`.
+ * Pass a scheduler like `dispatch_queue.dispatch()` or `dispatch_queue.dispatch_main()` to resume them
+ * in the dispatch queue's background threads or main loop instead.
+ * Acquiring without waiting never reschedules the coroutine.
+ *
+ * @code
+ * dispatch_queue::async_semaphore connections(8);
+ * co_await connections.acquire(dispatch_queue.dispatch());
+ * // ...
+ * connections.release();
+ * @endcode
+ */
+class async_semaphore {
+public:
+#ifdef __cpp_lib_coroutine
+	template<typename Scheduler>
+	struct acquire_awaiter : detail::scheduled_waiter<Scheduler> {
+		async_semaphore& semaphore;
+
+		acquire_awaiter(async_semaphore& semaphore, Scheduler scheduler)
+			: detail::scheduled_waiter<Scheduler>(std::move(scheduler))
+			, semaphore(semaphore)
+		{
+		}
+
+		bool await_ready() const {
+			return semaphore.try_acquire();
+		}
+		bool await_suspend(std::coroutine_handle<> cont) {
+			this->handle = cont;
+			return semaphore.acquire_or_enqueue(this);
+		}
+		void await_resume() const {}
+	};
+#endif
+
+	/**
+	 * @param initial_count Number of available units.
+	 */
+	explicit async_semaphore(ptrdiff_t initial_count);
+
+	async_semaphore(const async_semaphore&) = delete;
+	async_semaphore& operator=(const async_semaphore&) = delete;
+
+	/**
+	 * Acquire a unit if one is available, without waiting.
+	 * @returns Whether a unit was acquired.
+	 */
+	bool try_acquire();
+
+#ifdef __cpp_lib_coroutine
+	/**
+	 * Returns an awaiter that acquires a unit, suspending the coroutine until one is available.
+	 * @param scheduler Awaiter used to resume the coroutine after waiting, defaults to resuming inline.
+	 */
+	template<typename Scheduler = detail::inline_scheduler>
+	acquire_awaiter<Scheduler> acquire(Scheduler scheduler = {}) {
+		return acquire_awaiter<Scheduler>(*this, std::move(scheduler));
+	}
+#endif
+
+	/**
+	 * Release `count` units, resuming waiters if there are any.
+	 */
+	void release(ptrdiff_t count = 1);
+
+	/**
+	 * Returns the number of available units.
+	 */
+	ptrdiff_t available() const;
+
+private:
+	/// Available units, or the negated number of coroutines waiting or about to wait
+	std::atomic<ptrdiff_t> count;
+	std::mutex mutex;
+	detail::async_waiter *waiters_head = nullptr;
+	detail::async_waiter *waiters_tail = nullptr;
+	/// Releases that happened before their waiter was enqueued
+	ptrdiff_t pending_wakeups = 0;
+
+	/// @returns Whether the coroutine must suspend.
+	bool acquire_or_enqueue(detail::async_waiter *waiter);
+};
+
+/**
+ * Mutex for coroutines: `co_await lock()` suspends the coroutine instead of blocking the thread.
+ *
+ * Locking and unlocking are lock-free while uncontended, and waiters acquire the mutex in FIFO order.
+ * Ownership is not tied to threads, so coroutines may resume in another thread while holding the mutex.
+ * Schedulers work the same as in `async_semaphore`.
+ *
+ * @code
+ * dispatch_queue::async_mutex mutex;
+ * auto lock = co_await mutex.scoped_lock(dispatch_queue.dispatch());
+ * @endcode
+ */
+class async_mutex {
+public:
+	/**
+	 * Owns a locked `async_mutex`, unlocking it on destruction.
+	 */
+	class lock_guard {
+	public:
+		explicit lock_guard(async_mutex& mutex) : mutex(&mutex) {}
+		lock_guard(lock_guard&& other) : mutex(other.mutex) {
+			other.mutex = nullptr;
+		}
+		lock_guard& operator=(lock_guard&& other) {
+			if (mutex) {
+				mutex->unlock();
+			}
+			mutex = other.mutex;
+			other.mutex = nullptr;
+			return *this;
+		}
+		~lock_guard() {
+			if (mutex) {
+				mutex->unlock();
+			}
+		}
+
+	private:
+		async_mutex *mutex;
+	};
+
+#ifdef __cpp_lib_coroutine
+	template<typename Scheduler>
+	struct scoped_lock_awaiter : async_semaphore::acquire_awaiter<Scheduler> {
+		async_mutex& mutex;
+
+		scoped_lock_awaiter(async_mutex& mutex, Scheduler scheduler)
+			: async_semaphore::acquire_awaiter<Scheduler>(mutex.semaphore, std::move(scheduler))
+			, mutex(mutex)
+		{
+		}
+
+		lock_guard await_resume() const {
+			return lock_guard(mutex);
+		}
+	};
+#endif
+
+	async_mutex();
+
+	/**
+	 * Lock the mutex if it is not locked, without waiting.
+	 * @returns Whether the mutex was locked.
+	 */
+	bool try_lock();
+
+#ifdef __cpp_lib_coroutine
+	/**
+	 * Returns an awaiter that locks the mutex, suspending the coroutine while it is locked elsewhere.
+	 * Call `unlock` afterwards.
+	 * @param scheduler Awaiter used to resume the coroutine after waiting, defaults to resuming inline.
+	 */
+	template<typename Scheduler = detail::inline_scheduler>
+	async_semaphore::acquire_awaiter<Scheduler> lock(Scheduler scheduler = {}) {
+		return semaphore.acquire(std::move(scheduler));
+	}
+
+	/**
+	 * Returns an awaiter that locks the mutex and resumes with a `lock_guard` that unlocks it.
+	 * @param scheduler Awaiter used to resume the coroutine after waiting, defaults to resuming inline.
+	 */
+	template<typename Scheduler = detail::inline_scheduler>
+	scoped_lock_awaiter<Scheduler> scoped_lock(Scheduler scheduler = {}) {
+		return scoped_lock_awaiter<Scheduler>(*this, std::move(scheduler));
+	}
+#endif
+
+	/**
+	 * Unlock the mutex, passing it to the next waiter if there is one.
+	 */
+	void unlock();
+
+private:
+	async_semaphore semaphore;
+};
+
+/**
+ * Event for coroutines that stays set until `reset`.
+ * While set, `co_await`ing it does not suspend; otherwise coroutines wait until `set` is called.
+ *
+ * Setting, resetting and waiting are lock-free.
+ * Schedulers work the same as in `async_semaphore`.
+ *
+ * @code
+ * dispatch_queue::async_manual_reset_event assets_loaded;
+ * co_await assets_loaded.wait(dispatch_queue.dispatch_main());
+ * @endcode
+ */
+class async_manual_reset_event {
+public:
+#ifdef __cpp_lib_coroutine
+	template<typename Scheduler>
+	struct wait_awaiter : detail::scheduled_waiter<Scheduler> {
+		const async_manual_reset_event& event;
+
+		wait_awaiter(const async_manual_reset_event& event, Scheduler scheduler)
+			: detail::scheduled_waiter<Scheduler>(std::move(scheduler))
+			, event(event)
+		{
+		}
+
+		bool await_ready() const {
+			return event.is_set();
+		}
+		bool await_suspend(std::coroutine_handle<> cont) {
+			this->handle = cont;
+			return event.enqueue(this);
+		}
+		void await_resume() const {}
+	};
+#endif
+
+	explicit async_manual_reset_event(bool initially_set = false);
+
+	async_manual_reset_event(const async_manual_reset_event&) = delete;
+	async_manual_reset_event& operator=(const async_manual_reset_event&) = delete;
+
+	/**
+	 * Returns whether the event is set.
+	 */
+	bool is_set() const;
+
+	/**
+	 * Set the event, resuming all waiters.
+	 */
+	void set();
+
+	/**
+	 * Reset the event, so that new waiters suspend until `set` is called again.
+	 */
+	void reset();
+
+#ifdef __cpp_lib_coroutine
+	/**
+	 * Returns an awaiter that suspends the coroutine until the event is set.
+	 * @param scheduler Awaiter used to resume the coroutine after waiting, defaults to resuming inline.
+	 */
+	template<typename Scheduler = detail::inline_scheduler>
+	wait_awaiter<Scheduler> wait(Scheduler scheduler = {}) const {
+		return wait_awaiter<Scheduler>(*this, std::move(scheduler));
+	}
+
+	/// Same as `wait()`.
+	wait_awaiter<detail::inline_scheduler> operator co_await() const {
+		return wait();
+	}
+#endif
+
+private:
+	/// `this` when set, otherwise the head of the waiter list or null
+	mutable std::atomic<void *> state;
+
+	/// @returns Whether the coroutine must suspend.
+	bool enqueue(detail::async_waiter *waiter) const;
+};
+
+/**
+ * Single-use countdown for coroutines: waiters resume once the count reaches zero.
+ *
+ * @code
+ * dispatch_queue::async_latch chunks_loaded(chunk_count);
+ * // each loader calls chunks_loaded.count_down()
+ * co_await chunks_loaded.wait(dispatch_queue.dispatch());
+ * @endcode
+ */
+class async_latch {
+public:
+	/**
+	 * @param expected Number of `count_down` calls before waiters resume.
+	 */
+	explicit async_latch(ptrdiff_t expected);
+
+	/**
+	 * Decrement the count by `n`, resuming all waiters when it reaches zero.
+	 */
+	void count_down(ptrdiff_t n = 1);
+
+	/**
+	 * Returns whether the count reached zero.
+	 */
+	bool try_wait() const;
+
+#ifdef __cpp_lib_coroutine
+	/**
+	 * Returns an awaiter that suspends the coroutine until the count reaches zero.
+	 * @param scheduler Awaiter used to resume the coroutine after waiting, defaults to resuming inline.
+	 */
+	template<typename Scheduler = detail::inline_scheduler>
+	async_manual_reset_event::wait_awaiter<Scheduler> wait(Scheduler scheduler = {}) const {
+		return event.wait(std::move(scheduler));
+	}
+
+	/// Same as `wait()`.
+	async_manual_reset_event::wait_awaiter<detail::inline_scheduler> operator co_await() const {
+		return wait();
+	}
+#endif
+
+private:
+	std::atomic<ptrdiff_t> count;
+	async_manual_reset_event event;
+};
+
+} // end namespace dispatch_queue
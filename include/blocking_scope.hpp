@@ -0,0 +1,39 @@
+#pragma once
+
+namespace dispatch_queue {
+
+namespace detail {
+class worker_pool;
+}
+
+/**
+ * RAII hint that the current task is about to block, for example on file I/O, locks or external APIs.
+ *
+ * While the scope is alive, the dispatch queue that owns the calling worker thread wakes or spawns
+ * a compensation thread, so the number of runnable workers stays at the queue's thread count.
+ * When the scope ends, excess compensation threads park after finishing their current task,
+ * to be reused by the next blocking scope.
+ * Nested scopes and scopes created outside worker threads have no effect.
+ *
+ * @code
+ * dispatch_queue.dispatch([] {
+ *     dispatch_queue::blocking_scope blocking;
+ *     read_large_file_synchronously();
+ * });
+ * @endcode
+ *
+ * @see dispatch_queue::dispatch_blocking
+ */
+class blocking_scope {
+public:
+	blocking_scope();
+	~blocking_scope();
+
+	blocking_scope(const blocking_scope&) = delete;
+	blocking_scope& operator=(const blocking_scope&) = delete;
+
+private:
+	detail::worker_pool *pool;
+};
+
+} // end namespace dispatch_queue
@@ -0,0 +1,417 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "async_primitives.hpp"
+
+#ifdef __cpp_lib_coroutine
+#include <optional>
+#endif
+
+namespace dispatch_queue {
+
+namespace detail {
+
+/**
+ * FIFO ring buffer of `T` that only grows, so that steady state push/pop does not allocate.
+ * Unlike `pending_task_queue`, slots are raw storage, so `T` does not need to be default constructible.
+ */
+template<typename T>
+class ring_buffer {
+public:
+	explicit ring_buffer(size_t initial_capacity = 16) {
+		size_t capacity = 1;
+		while (capacity < initial_capacity) {
+			capacity *= 2;
+		}
+		reallocate(capacity);
+	}
+
+	ring_buffer(const ring_buffer&) = delete;
+	ring_buffer& operator=(const ring_buffer&) = delete;
+
+	~ring_buffer() {
+		clear();
+	}
+
+	bool empty() const {
+		return count == 0;
+	}
+
+	size_t size() const {
+		return count;
+	}
+
+	void push(T&& value) {
+		if (count == capacity) {
+			reallocate(capacity * 2);
+		}
+		new (slot((head + count) & (capacity - 1))) T(std::move(value));
+		count++;
+	}
+
+	/// Move the first value out. The buffer must not be empty.
+	T pop() {
+		T *front = slot(head);
+		T value(std::move(*front));
+		front->~T();
+		head = (head + 1) & (capacity - 1);
+		count--;
+		return value;
+	}
+
+	void clear() {
+		for (; count > 0; count--) {
+			slot(head)->~T();
+			head = (head + 1) & (capacity - 1);
+		}
+		head = 0;
+	}
+
+private:
+	using storage = typename std::aligned_storage<sizeof(T), alignof(T)>::type;
+
+	std::unique_ptr<storage[]> slots;
+	size_t capacity = 0;
+	size_t head = 0;
+	size_t count = 0;
+
+	T *slot(size_t index) {
+		return reinterpret_cast<T *>(&slots[index]);
+	}
+
+	void reallocate(size_t new_capacity) {
+		// capacity is always a power of two, so indices wrap with a mask
+		std::unique_ptr<storage[]> new_slots(new storage[new_capacity]);
+		for (size_t i = 0; i < count; i++) {
+			T *value = slot((head + i) & (capacity - 1));
+			new (&new_slots[i]) T(std::move(*value));
+			value->~T();
+		}
+		slots = std::move(new_slots);
+		capacity = new_capacity;
+		head = 0;
+	}
+};
+
+} // end namespace detail
+
+/**
+ * Multi-producer multi-consumer channel for streaming values between coroutines and threads.
+ *
+ * Bounded channels suspend senders while the buffer is full, unbounded channels never do.
+ * Values are stored in a ring buffer that is allocated upfront for bounded channels, so steady state messaging does not allocate.
+ * Values sent while receivers are waiting are handed over directly, without going through the buffer.
+ *
+ * After `close`, sends fail and receivers get the values still buffered, then an empty result.
+ *
+ * Suspended senders and receivers resume inline in the thread that unblocks them by default.
+ * Pass a scheduler like `dispatch_queue.dispatch()` or `dispatch_queue.dispatch_main()` to resume them there instead,
+ * as with `async_semaphore`.
+ *
+ * @code
+ * dispatch_queue::channel<frame> frames(8);
+ * // producer
+ * co_await frames.send(decode_frame(), dispatch_queue.dispatch());
+ * frames.close();
+ * // consumer
+ * while (auto f = co_await frames.receive(dispatch_queue.dispatch())) {
+ *     encode_frame(*f);
+ * }
+ * @endcode
+ */
+template<typename T>
+class channel {
+public:
+	/// Capacity of unbounded channels.
+	static constexpr size_t unbounded = 0;
+
+	/**
+	 * @param capacity Maximum number of buffered values, or `unbounded`.
+	 */
+	explicit channel(size_t capacity = unbounded)
+		: max_size(capacity)
+		, buffer(capacity == unbounded ? 16 : capacity)
+	{
+	}
+
+	channel(const channel&) = delete;
+	channel& operator=(const channel&) = delete;
+
+	/**
+	 * Send `value` if it fits in the buffer or a receiver is waiting, without waiting.
+	 * `value` is only moved from if it was sent.
+	 * @returns Whether the value was sent. Always fails after `close`.
+	 */
+	bool try_send(T&& value) {
+		std::unique_lock<std::mutex> lock(mutex);
+		if (is_full() && !receivers_head) {
+			return false;
+		}
+		return send_locked(lock, value);
+	}
+
+	/// @copydoc try_send(T&&)
+	bool try_send(const T& value) {
+		T copy(value);
+		return try_send(std::move(copy));
+	}
+
+	/**
+	 * Receive a buffered value, without waiting.
+	 * @returns Whether a value was received into `value`.
+	 */
+	bool try_receive(T& value) {
+		std::unique_lock<std::mutex> lock(mutex);
+		return receive_locked(lock, [&value](T&& received) {
+			value = std::move(received);
+		});
+	}
+
+	/**
+	 * Close the channel: further sends fail and waiting senders resume with failure.
+	 * Receivers still get buffered values, then an empty result.
+	 * It is safe to call this more than once.
+	 */
+	void close() {
+		detail::async_waiter *senders;
+		detail::async_waiter *receivers;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			is_closed_flag = true;
+			senders = senders_head;
+			receivers = receivers_head;
+			senders_head = senders_tail = nullptr;
+			receivers_head = receivers_tail = nullptr;
+		}
+		// Waiters default to failure, so they only need to be resumed
+		resume_all(senders);
+		resume_all(receivers);
+	}
+
+	/**
+	 * Returns whether `close` was called.
+	 */
+	bool is_closed() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return is_closed_flag;
+	}
+
+	/**
+	 * Returns the number of buffered values.
+	 */
+	size_t size() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return buffer.size();
+	}
+
+	/**
+	 * Returns the maximum number of buffered values, or `unbounded`.
+	 */
+	size_t capacity() const {
+		return max_size;
+	}
+
+private:
+	/// Suspended sender or receiver. Senders point to the value being sent, receivers to storage for the received value.
+	struct channel_waiter : detail::async_waiter {
+		T *value = nullptr;
+		bool result = false;
+	};
+
+public:
+#ifdef __cpp_lib_coroutine
+	template<typename Scheduler>
+	struct send_awaiter : detail::scheduled_waiter<Scheduler, channel_waiter> {
+		channel& owner;
+		T sent_value;
+
+		send_awaiter(channel& owner, T&& value, Scheduler scheduler)
+			: detail::scheduled_waiter<Scheduler, channel_waiter>(std::move(scheduler))
+			, owner(owner)
+			, sent_value(std::move(value))
+		{
+			this->value = &sent_value;
+		}
+		send_awaiter(const send_awaiter&) = delete;
+
+		bool await_ready() const noexcept { return false; }
+		bool await_suspend(std::coroutine_handle<> cont) {
+			this->handle = cont;
+			return owner.send_or_enqueue(this);
+		}
+		/// @returns Whether the value was sent, `false` if the channel was closed.
+		bool await_resume() const {
+			return this->result;
+		}
+	};
+
+	template<typename Scheduler>
+	struct receive_awaiter : detail::scheduled_waiter<Scheduler, channel_waiter> {
+		channel& owner;
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+
+		receive_awaiter(channel& owner, Scheduler scheduler)
+			: detail::scheduled_waiter<Scheduler, channel_waiter>(std::move(scheduler))
+			, owner(owner)
+		{
+			this->value = reinterpret_cast<T *>(&storage);
+		}
+		receive_awaiter(const receive_awaiter&) = delete;
+		~receive_awaiter() {
+			if (this->result) {
+				this->value->~T();
+			}
+		}
+
+		bool await_ready() const noexcept { return false; }
+		bool await_suspend(std::coroutine_handle<> cont) {
+			this->handle = cont;
+			return owner.receive_or_enqueue(this);
+		}
+		/// @returns The received value, or empty if the channel was closed and drained.
+		std::optional<T> await_resume() {
+			if (!this->result) {
+				return std::nullopt;
+			}
+			std::optional<T> received(std::move(*this->value));
+			this->value->~T();
+			this->result = false;
+			return received;
+		}
+	};
+
+	/**
+	 * Returns an awaiter that sends `value`, suspending the coroutine while a bounded channel is full.
+	 * The awaiter resumes with `false` if the channel is closed before the value is sent.
+	 * @param scheduler Awaiter used to resume the coroutine after waiting, defaults to resuming inline.
+	 */
+	template<typename Scheduler = detail::inline_scheduler>
+	send_awaiter<Scheduler> send(T value, Scheduler scheduler = {}) {
+		return send_awaiter<Scheduler>(*this, std::move(value), std::move(scheduler));
+	}
+
+	/**
+	 * Returns an awaiter that receives a value, suspending the coroutine while the channel is empty.
+	 * The awaiter resumes with an empty `std::optional` once the channel is closed and drained.
+	 * @param scheduler Awaiter used to resume the coroutine after waiting, defaults to resuming inline.
+	 */
+	template<typename Scheduler = detail::inline_scheduler>
+	receive_awaiter<Scheduler> receive(Scheduler scheduler = {}) {
+		return receive_awaiter<Scheduler>(*this, std::move(scheduler));
+	}
+#endif
+
+private:
+	size_t max_size;
+	mutable std::mutex mutex;
+	detail::ring_buffer<T> buffer;
+	bool is_closed_flag = false;
+	/// Senders only wait while the buffer is full, receivers only while it is empty
+	detail::async_waiter *senders_head = nullptr;
+	detail::async_waiter *senders_tail = nullptr;
+	detail::async_waiter *receivers_head = nullptr;
+	detail::async_waiter *receivers_tail = nullptr;
+
+	bool is_full() const {
+		return max_size != unbounded && buffer.size() >= max_size;
+	}
+
+	/// Hand `value` to a waiting receiver or push it to the buffer, which must not be full.
+	bool send_locked(std::unique_lock<std::mutex>& lock, T& value) {
+		if (is_closed_flag) {
+			return false;
+		}
+		channel_waiter *receiver = static_cast<channel_waiter *>(pop_waiter(receivers_head, receivers_tail));
+		if (receiver) {
+			new (receiver->value) T(std::move(value));
+			receiver->result = true;
+			lock.unlock();
+			receiver->resume();
+		}
+		else {
+			buffer.push(std::move(value));
+		}
+		return true;
+	}
+
+	/// Pop a buffered value into `store`, refilling the buffer from a waiting sender.
+	template<typename Store>
+	bool receive_locked(std::unique_lock<std::mutex>& lock, Store&& store) {
+		if (buffer.empty()) {
+			return false;
+		}
+		store(buffer.pop());
+		channel_waiter *sender = static_cast<channel_waiter *>(pop_waiter(senders_head, senders_tail));
+		if (sender) {
+			buffer.push(std::move(*sender->value));
+			sender->result = true;
+			lock.unlock();
+			sender->resume();
+		}
+		return true;
+	}
+
+	/// @returns Whether the coroutine must suspend.
+	bool send_or_enqueue(channel_waiter *waiter) {
+		std::unique_lock<std::mutex> lock(mutex);
+		if (!is_closed_flag && is_full() && !receivers_head) {
+			push_waiter(senders_head, senders_tail, waiter);
+			return true;
+		}
+		waiter->result = send_locked(lock, *waiter->value);
+		return false;
+	}
+
+	/// @returns Whether the coroutine must suspend.
+	bool receive_or_enqueue(channel_waiter *waiter) {
+		std::unique_lock<std::mutex> lock(mutex);
+		bool received = receive_locked(lock, [waiter](T&& received) {
+			new (waiter->value) T(std::move(received));
+			waiter->result = true;
+		});
+		if (received || is_closed_flag) {
+			return false;
+		}
+		push_waiter(receivers_head, receivers_tail, waiter);
+		return true;
+	}
+
+	static void push_waiter(detail::async_waiter *& head, detail::async_waiter *& tail, detail::async_waiter *waiter) {
+		waiter->next = nullptr;
+		if (tail) {
+			tail->next = waiter;
+		}
+		else {
+			head = waiter;
+		}
+		tail = waiter;
+	}
+
+	static detail::async_waiter *pop_waiter(detail::async_waiter *& head, detail::async_waiter *& tail) {
+		detail::async_waiter *waiter = head;
+		if (waiter) {
+			head = waiter->next;
+			if (!head) {
+				tail = nullptr;
+			}
+		}
+		return waiter;
+	}
+
+	static void resume_all(detail::async_waiter *waiter) {
+		while (waiter) {
+			// Read next before resuming, since resumed waiters may be destroyed
+			detail::async_waiter *next = waiter->next;
+			waiter->resume();
+			waiter = next;
+		}
+	}
+};
+
+} // end namespace dispatch_queue
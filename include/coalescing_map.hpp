@@ -0,0 +1,46 @@
+#pragma once
+
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace dispatch_queue {
+
+namespace detail {
+
+/**
+ * Unique identifier for type `T` that does not depend on RTTI.
+ */
+template<typename T>
+const void *type_id() {
+	static const char id = 0;
+	return &id;
+}
+
+/**
+ * Task dispatched with `dispatch_coalesced` or `dispatch_debounced` that has not started running yet.
+ */
+struct coalesced_entry {
+	/// Type erased `task_future<T>` shared by all merged requests
+	std::shared_ptr<void> future;
+	/// `type_id<T>()`, so that requests returning other types are never merged
+	const void *result_type;
+	bool is_debounced;
+	/// Debounced tasks only: work to be enqueued once `deadline` is reached
+	std::function<bool()> work;
+	std::chrono::steady_clock::time_point deadline;
+};
+
+/**
+ * Pending coalesced tasks by key.
+ */
+struct coalescing_map {
+	std::mutex mutex;
+	std::unordered_map<const void *, coalesced_entry> entries;
+};
+
+} // end namespace detail
+
+} // end namespace dispatch_queue
@@ -0,0 +1,160 @@
+#pragma once
+
+#ifdef __has_include
+	#if __has_include(<version>)
+		#include <version>
+	#endif
+#endif
+
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+
+#ifdef __cpp_lib_coroutine
+#include <coroutine>
+#endif
+
+namespace dispatch_queue {
+
+class dispatch_queue;
+
+namespace detail {
+
+/**
+ * Shared state of a `concurrency_limiter`: available slots and work waiting for one.
+ */
+class limiter_state {
+public:
+	explicit limiter_state(int max_concurrency);
+
+	int max_concurrency() const;
+	int running() const;
+	size_t deferred() const;
+
+	bool try_acquire();
+	/**
+	 * Acquire a slot or, if all slots are taken, store `admit` to be called once a slot is released to it.
+	 * `admit` returns whether it took the slot, otherwise the slot is handed over to the next deferred work.
+	 * @returns Whether the slot was acquired right away, in which case `admit` is discarded.
+	 */
+	bool acquire_or_defer(std::function<bool()>&& admit);
+	/**
+	 * Release a slot, handing it over to the oldest deferred work, if any.
+	 */
+	void release();
+
+private:
+	mutable std::mutex mutex;
+	int max_running;
+	int running_count = 0;
+	std::deque<std::function<bool()>> deferred_work;
+};
+
+} // end namespace detail
+
+/**
+ * Limits how many tasks of a category run at the same time, regardless of the dispatch queue's thread count.
+ *
+ * Tasks dispatched with a limiter whose slots are all taken are held back without occupying a worker thread,
+ * and enqueued in order as running tasks of the category finish.
+ * Limiters are cheap handles to shared state and may be used with several dispatch queues.
+ *
+ * @code
+ * dispatch_queue::concurrency_limiter database_limiter(4);
+ * dispatch_queue.dispatch(database_limiter, run_query, query);
+ * @endcode
+ */
+class concurrency_limiter {
+public:
+	/**
+	 * RAII slot acquired by `co_await acquire()`, released on destruction.
+	 */
+	class slot {
+	public:
+		slot() = default;
+		explicit slot(std::shared_ptr<detail::limiter_state> state) : state(std::move(state)) {}
+		slot(slot&& other) = default;
+		slot& operator=(slot&& other) {
+			release();
+			state = std::move(other.state);
+			return *this;
+		}
+		~slot() {
+			release();
+		}
+
+		/// Release the slot before destruction.
+		void release() {
+			if (state) {
+				state->release();
+				state.reset();
+			}
+		}
+
+	private:
+		std::shared_ptr<detail::limiter_state> state;
+	};
+
+	/**
+	 * @param max_concurrency Maximum number of tasks running at the same time, at least 1.
+	 */
+	explicit concurrency_limiter(int max_concurrency);
+
+	/**
+	 * Returns the maximum number of tasks running at the same time.
+	 */
+	int max_concurrency() const;
+
+	/**
+	 * Returns the number of taken slots.
+	 */
+	int running() const;
+
+	/**
+	 * Returns the number of tasks and coroutines waiting for a slot.
+	 */
+	size_t deferred() const;
+
+#ifdef __cpp_lib_coroutine
+	struct acquire_awaiter {
+		std::shared_ptr<detail::limiter_state> state;
+
+		bool await_ready() const {
+			return state->try_acquire();
+		}
+		bool await_suspend(std::coroutine_handle<> cont) const {
+			return !state->acquire_or_defer([cont]{
+				cont();
+				return true;
+			});
+		}
+		slot await_resume() const {
+			return slot(state);
+		}
+	};
+
+	/**
+	 * Suspend the coroutine until a slot is available, without blocking the thread.
+	 * If no slot is available, the coroutine is resumed in the thread that releases the next slot.
+	 *
+	 * @code
+	 * auto slot = co_await limiter.acquire();
+	 * // at most `max_concurrency` coroutines run this at the same time
+	 * @endcode
+	 *
+	 * @returns Awaitable that resumes with a `slot`, released when destroyed.
+	 */
+	acquire_awaiter acquire() const {
+		return acquire_awaiter { state };
+	}
+#endif
+
+private:
+	std::shared_ptr<detail::limiter_state> state;
+
+	friend class dispatch_queue;
+};
+
+} // end namespace dispatch_queue
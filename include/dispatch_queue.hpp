@@ -1,11 +1,34 @@
 #pragma once
 
+#include <cassert>
+#include <cerrno>
 #include <functional>
+#include <ostream>
+#include <string>
 #include <utility>
 
+#include "async_generator.hpp"
+#include "async_primitives.hpp"
+#include "blocking_scope.hpp"
+#include "channel.hpp"
+#include "coalescing_map.hpp"
+#include "concurrency_limiter.hpp"
 #include "function_result.hpp"
+#include "io_reactor.hpp"
 #include "task.hpp"
 #include "promise.hpp"
+#include "queue_stats.hpp"
+#include "result.hpp"
+#include "shared_pool.hpp"
+#include "scratch_arena.hpp"
+#include "target_loop.hpp"
+#include "task_graph.hpp"
+#include "task_label.hpp"
+#include "task_watchdog.hpp"
+#include "this_worker.hpp"
+#include "timer_thread.hpp"
+#include "when_all.hpp"
+#include "worker_options.hpp"
 #include "worker_pool.hpp"
 
 namespace dispatch_queue {
@@ -33,18 +56,53 @@ public:
 	 *                      Otherwise, `thread_count` threads will be created and tasks may run concurrently.
 	 *                      Pass a negative number to use the default value of `std::thread::hardware_concurrency()` threads.
 	 * @param worker_init  Functor called inside worker threads for initialization, receiving as argument the worker index.
-	 *                     May be used to set the thread name or initialize thread local variables, for example.
+	 *                     May be used to initialize thread local variables, for example.
+	 *                     Worker threads are already named after their index when it runs, see `worker_options`.
 	 */
 	template<typename Fn>
-	dispatch_queue(int thread_count, Fn&& worker_init) {
+	dispatch_queue(int thread_count, Fn&& worker_init)
+		: dispatch_queue(thread_count, worker_options(), std::forward<Fn>(worker_init))
+	{
+	}
+
+	/**
+	 * Initializes dispatch queue with `thread_count` background threads created with `options` and a no-op `worker_init`.
+	 * @see dispatch_queue(int, worker_options, Fn&&)
+	 */
+	dispatch_queue(int thread_count, worker_options options);
+
+	/**
+	 * Initializes dispatch queue with `thread_count` background threads created with `options` and a worker initialization functor.
+	 *
+	 * @param thread_count  Number of background threads used to run tasks, see `dispatch_queue(int, Fn&&)`.
+	 * @param options  Name, stack size and scheduling of worker threads, applied before `worker_init` runs.
+	 * @param worker_init  Functor called inside worker threads for initialization, receiving as argument the worker index.
+	 */
+	template<typename Fn>
+	dispatch_queue(int thread_count, worker_options options, Fn&& worker_init)
+		: main_target_loop("main")
+	{
 		if (thread_count < 0) {
 			thread_count = std::thread::hardware_concurrency();
 		}
 		if (thread_count > 0) {
-			worker_pool = std::make_unique<detail::worker_pool>(task_queue, thread_count, worker_init);
+			worker_pool = detail::worker_pool::create(thread_count, std::forward<Fn>(worker_init), std::move(options));
+			task_source->owner = this;
+			worker_pool->add_source(*task_source, 1);
 		}
 	}
 
+	/**
+	 * Initializes dispatch queue that runs background tasks in the threads of a shared pool.
+	 * No threads are created.
+	 *
+	 * @param pool  Pool whose threads will run tasks, also used by other dispatch queues.
+	 * @param weight  Number of tasks from this queue that workers take in a row before
+	 *                moving on to the next queue sharing the pool. Queues with higher
+	 *                weights get a larger share of the workers when the pool is busy.
+	 */
+	explicit dispatch_queue(const shared_pool& pool, int weight = 1);
+
 	dispatch_queue(const dispatch_queue&) = delete;
 	dispatch_queue& operator=(const dispatch_queue&) = delete;
 
@@ -56,13 +114,166 @@ public:
 	/**
 	 * Dispatch a task that calls `f` with forwarded arguments `args`.
 	 * If the dispatch queue is in immediate mode, the task is processed immediately in the calling thread.
+	 * `f` and `args` may be move-only.
 	 * @param f Functor to be executed
 	 * @param args Arguments forwarded to `f`
 	 * @returns Future for getting `f` result.
 	 */
 	template<typename F, typename... Args, typename Ret = detail::function_result<F, Args...>>
 	task<Ret> dispatch(F&& f, Args&&... args) {
-		return dispatch_internal(false, std::forward<F>(f), std::forward<Args>(args)...);
+		return dispatch_internal(nullptr, nullptr, std::forward<F>(f), std::forward<Args>(args)...);
+	}
+
+	/**
+	 * Dispatch a task named `label` that calls `f` with forwarded arguments `args`.
+	 * The label is shown in traces.
+	 * @param label Static task name
+	 * @param f Functor to be executed
+	 * @param args Arguments forwarded to `f`
+	 * @returns Future for getting `f` result.
+	 * @see write_chrome_trace
+	 */
+	template<typename F, typename... Args, typename Ret = detail::function_result<F, Args...>>
+	task<Ret> dispatch(task_label label, F&& f, Args&&... args) {
+		return dispatch_internal(nullptr, label.name, std::forward<F>(f), std::forward<Args>(args)...);
+	}
+
+	/**
+	 * Dispatch a task that calls `f` with forwarded arguments `args`, running at most `limiter.max_concurrency()`
+	 * tasks dispatched with `limiter` at the same time.
+	 * Tasks over the limit wait outside the queue without occupying a worker thread, and are enqueued in
+	 * dispatch order as tasks from the same limiter finish. `wait` also waits for them, `clear` drops them.
+	 * In immediate mode, the limit is ignored and `f` is called right away.
+	 * @param limiter Limiter for the category of the task, for example the database or network tasks
+	 * @param f Functor to be executed
+	 * @param args Arguments forwarded to `f`
+	 * @returns Future for getting `f` result.
+	 * @see concurrency_limiter
+	 */
+	template<typename F, typename... Args, typename Ret = detail::function_result<F, Args...>>
+	task<Ret> dispatch(const concurrency_limiter& limiter, F&& f, Args&&... args) {
+		if (!worker_pool) {
+			return dispatch_internal(nullptr, nullptr, std::forward<F>(f), std::forward<Args>(args)...);
+		}
+		auto future = detail::task_future<Ret>::create_pending();
+		dispatch_limited(limiter.state, { future->wrap(detail::make_copyable(std::bind(std::forward<F>(f), std::forward<Args>(args)...))) });
+		return task<Ret>(future);
+	}
+
+	/**
+	 * Dispatch a task that calls `f` with forwarded arguments `args`, preferably on the worker that `key` hashes to.
+	 * Tasks with the same key run on the same worker, keeping their data warm in its caches.
+	 * While that worker is busy, idle workers may still take the task, so a hot key does not leave other workers idle.
+	 * If the dispatch queue is in immediate mode, the task is processed immediately in the calling thread.
+	 * @param key Identity of the data used by the task, for example a shard index. Hashed with `std::hash<Key>`.
+	 * @param f Functor to be executed
+	 * @param args Arguments forwarded to `f`
+	 * @returns Future for getting `f` result.
+	 * @see dispatch_to_worker
+	 */
+	template<typename Key, typename F, typename... Args, typename Ret = detail::function_result<F, Args...>>
+	task<Ret> dispatch_with_affinity(const Key& key, F&& f, Args&&... args) {
+		int index = worker_pool ? (int) (std::hash<Key>()(key) % (size_t) worker_pool->thread_count()) : 0;
+		return dispatch_local_internal(index, false, std::forward<F>(f), std::forward<Args>(args)...);
+	}
+
+	/**
+	 * Dispatch a task that calls `f` with forwarded arguments `args` on the worker at `worker_index`.
+	 * The task only runs on that worker, the same index passed to `worker_init`,
+	 * so it may use thread local state initialized there.
+	 * If the dispatch queue is in immediate mode, the task is processed immediately in the calling thread.
+	 * @param worker_index Worker index, wrapped around the thread count
+	 * @param f Functor to be executed
+	 * @param args Arguments forwarded to `f`
+	 * @returns Future for getting `f` result.
+	 * @see dispatch_with_affinity
+	 */
+	template<typename F, typename... Args, typename Ret = detail::function_result<F, Args...>>
+	task<Ret> dispatch_to_worker(int worker_index, F&& f, Args&&... args) {
+		int index = worker_pool ? (int) ((unsigned) worker_index % (unsigned) worker_pool->thread_count()) : 0;
+		return dispatch_local_internal(index, true, std::forward<F>(f), std::forward<Args>(args)...);
+	}
+
+	/**
+	 * Dispatch a task that calls `f` with forwarded arguments `args` inside a `blocking_scope`.
+	 * Use this for tasks that spend most of their time blocked, so that they don't stall other tasks.
+	 * @param f Functor to be executed
+	 * @param args Arguments forwarded to `f`
+	 * @returns Future for getting `f` result.
+	 * @see blocking_scope
+	 */
+	template<typename F, typename... Args, typename Ret = detail::function_result<F, Args...>>
+	task<Ret> dispatch_blocking(F&& f, Args&&... args) {
+		auto work = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+		return dispatch_internal(nullptr, nullptr, [work = std::move(work)]() {
+			blocking_scope blocking;
+			return work();
+		});
+	}
+
+	/**
+	 * Dispatch a task that calls `f` with forwarded arguments `args`, merging it with a queued task with the same `key`.
+	 *
+	 * While a task dispatched with `key` is still queued, new requests with the same key don't dispatch new work
+	 * and return the same `task` instead, so that all callers share its result.
+	 * Once the task starts running, the next request with `key` dispatches a new task,
+	 * so that changes made while it runs are not missed.
+	 * Requests returning a different type than the queued task are never merged.
+	 *
+	 * @code
+	 * // Called many times per frame, but runs at most once per queued recompute
+	 * dispatch_queue.dispatch_coalesced(&mesh, recompute_bounds, &mesh);
+	 * @endcode
+	 *
+	 * In immediate mode, `f` is called right away, just like `dispatch`.
+	 * @param key Identity of the work, for example the address of the object being recomputed
+	 * @param f Functor to be executed
+	 * @param args Arguments forwarded to `f`
+	 * @returns Future for getting `f` result, shared by all merged requests.
+	 */
+	template<typename F, typename... Args, typename Ret = detail::function_result<F, Args...>>
+	task<Ret> dispatch_coalesced(const void *key, F&& f, Args&&... args) {
+		return coalesce_internal<Ret>(key, false, std::chrono::nanoseconds::zero(), std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+	}
+
+	/**
+	 * Dispatch a task that calls `f` with forwarded arguments `args` once no other request with the same `key`
+	 * arrives for `delay`.
+	 *
+	 * Each request with `key` made before the task is enqueued postpones it for another `delay`,
+	 * replaces its functor and arguments with the latest ones and returns the same `task`.
+	 * Requests returning a different type than the pending task are never merged.
+	 *
+	 * In immediate mode, `f` is called right away, just like `dispatch`.
+	 * @param key Identity of the work, for example the address of the object being recomputed
+	 * @param delay Time without new requests before the task is enqueued
+	 * @param f Functor to be executed
+	 * @param args Arguments forwarded to `f`
+	 * @returns Future for getting `f` result, shared by all merged requests.
+	 * @see dispatch_coalesced
+	 */
+	template<class Rep, class Period, typename F, typename... Args, typename Ret = detail::function_result<F, Args...>>
+	task<Ret> dispatch_debounced(const void *key, const std::chrono::duration<Rep, Period>& delay, F&& f, Args&&... args) {
+		return coalesce_internal<Ret>(key, true, std::chrono::duration_cast<std::chrono::nanoseconds>(delay), std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+	}
+
+	/**
+	 * Dispatch a task that calls `f` with forwarded arguments `args`, without creating a `task` for its result.
+	 * This is cheaper than `dispatch` for fire-and-forget work: no shared state is allocated
+	 * and small functors without arguments are stored inline.
+	 * Exceptions thrown by `f` are discarded, only being counted as failures in `stats`.
+	 * @param f Functor to be executed
+	 * @param args Arguments forwarded to `f`
+	 */
+	template<typename F>
+	void post(F&& f) {
+		post_internal(detail::pending_task { detail::make_pending_work(std::forward<F>(f)) });
+	}
+
+	/// @copydoc post(F&&)
+	template<typename F, typename Arg, typename... Args>
+	void post(F&& f, Arg&& arg, Args&&... args) {
+		post(std::bind(std::forward<F>(f), std::forward<Arg>(arg), std::forward<Args>(args)...));
 	}
 
 	/**
@@ -75,7 +286,40 @@ public:
 	 */
 	template<typename F, typename... Args, typename Ret = detail::function_result<F, Args...>>
 	task<Ret> dispatch_main(F&& f, Args&&... args) {
-		return dispatch_internal(true, std::forward<F>(f), std::forward<Args>(args)...);
+		return dispatch_internal(main_target_loop.queue.get(), nullptr, std::forward<F>(f), std::forward<Args>(args)...);
+	}
+
+	/**
+	 * Create a new target loop, for running tasks in threads other than the main one.
+	 * Tasks dispatched to the loop with `dispatch_to` will only be executed when calling `target_loop::run`.
+	 *
+	 * @code
+	 * auto audio_loop = dispatch_queue.create_loop("audio");
+	 * dispatch_queue.dispatch_to(audio_loop, []{ ... });
+	 * // inside audio thread
+	 * audio_loop.run();
+	 * @endcode
+	 *
+	 * @param name Loop name, useful for debugging
+	 * @see dispatch_to
+	 */
+	target_loop create_loop(std::string name);
+
+	/**
+	 * Dispatch a task that calls `f` with forwarded arguments `args` in the target `loop`.
+	 * Tasks dispatched with `dispatch_to` will only be executed when calling `loop.run()`.
+	 * @param loop Target loop, created by `create_loop`
+	 * @param f Functor to be executed
+	 * @param args Arguments forwarded to `f`
+	 * @returns Future for getting `f` result, failed with `std::errc::invalid_argument` if `loop` is not valid.
+	 * @see create_loop
+	 */
+	template<typename F, typename... Args, typename Ret = detail::function_result<F, Args...>>
+	task<Ret> dispatch_to(const target_loop& loop, F&& f, Args&&... args) {
+		if (!loop.valid()) {
+			return task<Ret>(detail::task_future<Ret>::create_failed(std::make_error_code(std::errc::invalid_argument)));
+		}
+		return dispatch_internal(loop.queue.get(), nullptr, std::forward<F>(f), std::forward<Args>(args)...);
 	}
 
 	/**
@@ -84,7 +328,7 @@ public:
 	bool is_threaded() const;
 
 	/**
-	 * Number of threads used for processing tasks.
+	 * Number of threads used for processing tasks, including threads of a shared pool used by other queues.
 	 * This will be 0 in immediate mode.
 	 */
 	int thread_count() const;
@@ -99,6 +343,87 @@ public:
 	 */
 	bool empty() const;
 
+	/**
+	 * Enable or disable collecting statistics about background tasks, which is disabled by default.
+	 * While disabled, workers only check a flag per task.
+	 * Statistics are only collected in threaded mode.
+	 * Collection is a setting of the worker pool, so it applies to all dispatch queues sharing a `shared_pool`.
+	 * @see stats
+	 */
+	void set_stats_enabled(bool enabled);
+
+	/**
+	 * Whether statistics are being collected.
+	 */
+	bool is_stats_enabled() const;
+
+	/**
+	 * Returns a snapshot of the statistics collected since they were enabled or last reset.
+	 * Workers keep running while the snapshot is taken, so values may be slightly out of sync with each other.
+	 * @see set_stats_enabled
+	 */
+	queue_stats stats() const;
+
+	/**
+	 * Reset collected statistics to zero.
+	 * This also resets `queue_stats::pool`, as seen by all dispatch queues sharing a `shared_pool`.
+	 */
+	void reset_stats();
+
+	/**
+	 * Enable or disable tracing of background tasks, which is disabled by default.
+	 * While enabled, enqueue, dequeue, start, finish and continuation events are recorded
+	 * into per-thread ring buffers holding the latest events.
+	 * Tracing is only available in threaded mode.
+	 * @see write_chrome_trace
+	 */
+	void set_tracing_enabled(bool enabled);
+
+	/**
+	 * Whether task tracing is enabled.
+	 */
+	bool is_tracing_enabled() const;
+
+	/**
+	 * Write events traced by this dispatch queue in Chrome's trace event JSON format.
+	 * The output can be opened in Perfetto or `chrome://tracing`.
+	 * Events recorded while writing may be partially overwritten, prefer calling this while the queue is idle.
+	 * @see set_tracing_enabled
+	 */
+	void write_chrome_trace(std::ostream& os) const;
+
+	/**
+	 * Discard traced events.
+	 * Trace buffers are shared by all dispatch queues, so this discards events from every queue.
+	 */
+	static void clear_trace();
+
+	/**
+	 * Enable a watchdog that calls `callback` for each background task running for longer than `threshold`.
+	 * Running tasks are checked every half `threshold` in a watchdog thread, where `callback` runs, and each task is reported once.
+	 * While enabled, workers store a timestamp per task and tasks are timestamped when queued for `oldest_pending_age`.
+	 * Queues sharing a pool share its watchdog. Pass an empty `callback` to disable the watchdog.
+	 * Must not be called from `callback`. The watchdog is only available in threaded mode.
+	 *
+	 * @code
+	 * dispatch_queue.set_watchdog(std::chrono::milliseconds(500), [](const dispatch_queue::stalled_task& task) {
+	 *     std::cerr << "Task " << (task.label ? task.label : "?") << " stalled worker " << task.worker_index << std::endl;
+	 * });
+	 * @endcode
+	 */
+	void set_watchdog(std::chrono::nanoseconds threshold, std::function<void(const stalled_task&)> callback);
+
+	/**
+	 * Whether the stalled task watchdog is enabled.
+	 */
+	bool is_watchdog_enabled() const;
+
+	/**
+	 * Returns how long the oldest queued task has been waiting, or zero if there are no queued tasks.
+	 * Tasks are only timestamped while the watchdog or statistics are enabled, tasks queued otherwise are not considered.
+	 */
+	std::chrono::nanoseconds oldest_pending_age() const;
+
 	/**
 	 * Cancel pending tasks, clearing the current queue.
 	 * Tasks that are being processed will still run to completion.
@@ -111,6 +436,41 @@ public:
 	 */
 	void main_loop();
 
+	/**
+	 * Returns a file descriptor that becomes readable while there are main loop tasks queued.
+	 *
+	 * Add it to your application's event loop (`epoll`, `poll`, `select`...) and call `main_loop` when it becomes readable.
+	 * The descriptor is owned by the dispatch queue and is reset by `main_loop`, so do not read from or close it.
+	 * This is only supported on Linux, other platforms return -1.
+	 */
+	int main_loop_fd() const;
+
+	/**
+	 * Wait until there are main loop tasks queued.
+	 * Tasks are not executed, call `main_loop` afterwards to run them.
+	 */
+	void main_loop_wait();
+
+	/**
+	 * Wait until there are main loop tasks queued.
+	 * Blocks until specified `timeout_duration` has elapsed or main loop tasks are queued, whichever comes first.
+	 * @returns `true` if there are main loop tasks queued, otherwise `false`.
+	 */
+	template<class Rep, class Period>
+	bool main_loop_wait_for(const std::chrono::duration<Rep, Period>& timeout_duration) {
+		return main_target_loop.wait_for(timeout_duration);
+	}
+
+	/**
+	 * Wait until there are main loop tasks queued.
+	 * Blocks until the specified `timeout_time` has been reached or main loop tasks are queued, whichever comes first.
+	 * @returns `true` if there are main loop tasks queued, otherwise `false`.
+	 */
+	template<class Clock, class Duration>
+	bool main_loop_wait_until(const std::chrono::time_point<Clock, Duration>& timeout_time) {
+		return main_target_loop.wait_until(timeout_time);
+	}
+
 	/**
 	 * Wait until all pending tasks finish processing.
 	 */
@@ -124,7 +484,7 @@ public:
 	template<class Rep, class Period>
 	bool wait_for(const std::chrono::duration<Rep, Period>& timeout_duration) {
 		if (worker_pool) {
-			return worker_pool->wait_for(timeout_duration);
+			return worker_pool->wait_for(*task_source, timeout_duration);
 		}
 		else {
 			return true;
@@ -139,7 +499,7 @@ public:
 	template<class Clock, class Duration>
 	bool wait_until(const std::chrono::time_point<Clock, Duration>& timeout_time) {
 		if (worker_pool) {
-			return worker_pool->wait_until(timeout_time);
+			return worker_pool->wait_until(*task_source, timeout_time);
 		}
 		else {
 			return true;
@@ -148,6 +508,7 @@ public:
 
 	/**
 	 * Cancel pending tasks, wait and release the used threads.
+	 * Threads of a shared pool keep running while the pool is used by other dispatch queues.
 	 * The queue now runs in immediate mode.
 	 * It is safe to call this more than once.
 	 */
@@ -156,34 +517,113 @@ public:
 #ifdef __cpp_lib_coroutine
 private:
 	struct dispatch_awaiter {
-		dispatch_queue& dispatch_queue;
+		dispatch_queue& queue;
 
 		bool await_ready() const noexcept { return false; }
         void await_suspend(std::coroutine_handle<> cont) const {
-            dispatch_queue.dispatch([cont]{
+            queue.dispatch([cont]{
 				cont();
-				if (cont.done()) {
-					cont.destroy();
-				}
 			});
         }
         void await_resume() {}
 	};
 
-	struct dispatch_main_awaiter {
-		dispatch_queue& dispatch_queue;
+	struct yield_awaiter {
+		dispatch_queue& queue;
+		bool should_yield;
+
+		bool await_ready() const noexcept { return !should_yield; }
+		void await_suspend(std::coroutine_handle<> cont) const {
+			// Posted work stores the handle inline, no task future is created
+			queue.post([cont]{
+				cont();
+			});
+		}
+		void await_resume() const noexcept {}
+	};
+
+	struct dispatch_to_awaiter {
+		dispatch_queue& queue;
+		target_loop loop;
 
 		bool await_ready() const noexcept { return false; }
         void await_suspend(std::coroutine_handle<> cont) const {
-            dispatch_queue.dispatch_main([cont]{
+			// The coroutine would never resume
+			assert(loop.valid());
+            queue.dispatch_to(loop, [cont]{
 				cont();
-				if (cont.done()) {
-					cont.destroy();
-				}
 			});
         }
         void await_resume() {}
 	};
+
+#ifdef __linux__
+	struct io_awaiter {
+		dispatch_queue& queue;
+		detail::io_operation operation;
+		/// Error reported instead of performing the operation, if waiting for `fd` failed or was cancelled
+		int error = 0;
+
+		bool await_ready() const {
+			return !queue.worker_pool || operation.is_ready();
+		}
+		bool await_suspend(std::coroutine_handle<> cont) {
+			dispatch_queue *resume_queue = &queue;
+			int result = queue.get_io_reactor().when_ready(operation.fd, operation.is_write(), [this, resume_queue, cont](int wait_error) {
+				error = wait_error;
+				if (wait_error == ECANCELED) {
+					// The queue is shutting down, so resume right away instead of posting
+					cont();
+				}
+				else {
+					resume_queue->post([cont]{
+						cont();
+					});
+				}
+			});
+			if (result != 0) {
+				error = result;
+				return false;
+			}
+			return true;
+		}
+		ssize_t await_resume() const {
+			if (error) {
+				errno = error;
+				return -1;
+			}
+			return operation.perform();
+		}
+	};
+
+	struct sleep_awaiter {
+		dispatch_queue& queue;
+		std::chrono::steady_clock::time_point deadline;
+
+		bool await_ready() const {
+			return !queue.worker_pool || deadline <= std::chrono::steady_clock::now();
+		}
+		bool await_suspend(std::coroutine_handle<> cont) {
+			dispatch_queue *resume_queue = &queue;
+			return queue.get_io_reactor().when_expired(deadline, [resume_queue, cont](int wait_error) {
+				if (wait_error == ECANCELED) {
+					// The queue is shutting down, so wake up early instead of posting
+					cont();
+				}
+				else {
+					resume_queue->post([cont]{
+						cont();
+					});
+				}
+			}) == 0;
+		}
+		void await_resume() const {
+			if (!queue.worker_pool) {
+				std::this_thread::sleep_until(deadline);
+			}
+		}
+	};
+#endif
 public:
 	/**
 	 * Returns an awaiter that resumes a coroutine using `dispatch` when `co_await`ed.
@@ -198,6 +638,42 @@ public:
 	dispatch_awaiter dispatch() {
 		return dispatch_awaiter(*this);
 	}
+	/**
+	 * Returns an awaiter that moves the coroutine to the back of the queue, letting tasks enqueued before it run first.
+	 * Resuming the coroutine is as cheap as `post`: no `task` is created.
+	 * In immediate mode, the coroutine continues right away.
+	 *
+	 * @code
+	 * dispatch_queue::task<void> my_coroutine() {
+	 *     for (auto& chunk : chunks) {
+	 *         process_chunk(chunk);
+	 *         co_await dispatch_queue.yield();
+	 *     }
+	 * }
+	 * @endcode
+	 */
+	yield_awaiter yield() {
+		return yield_awaiter { *this, worker_pool != nullptr };
+	}
+	/**
+	 * Returns an awaiter that works like `yield`, but only if the coroutine ran for at least `budget` in its current time slice.
+	 * Each task or coroutine resumption gets a new time slice. To save a clock read per task, the slice starts
+	 * with the first check rather than the task, unless statistics are enabled: check early in the task,
+	 * then often, so that long-running coroutines yield rarely.
+	 *
+	 * @code
+	 * dispatch_queue::task<void> my_coroutine() {
+	 *     for (auto& item : items) {
+	 *         process_item(item);
+	 *         co_await dispatch_queue.yield_if_expired(std::chrono::milliseconds(2));
+	 *     }
+	 * }
+	 * @endcode
+	 */
+	template<class Rep, class Period>
+	yield_awaiter yield_if_expired(const std::chrono::duration<Rep, Period>& budget) {
+		return yield_awaiter { *this, worker_pool && detail::worker_pool::is_time_slice_expired(std::chrono::duration_cast<std::chrono::nanoseconds>(budget)) };
+	}
 	/**
 	 * Returns an awaiter that resumes a coroutine using `dispatch_main` when `co_await`ed.
 	 *
@@ -208,26 +684,141 @@ public:
 	 * }
 	 * @endcode
 	 */
-	dispatch_main_awaiter dispatch_main() {
-		return dispatch_main_awaiter(*this);
+	dispatch_to_awaiter dispatch_main() {
+		return dispatch_to_awaiter(*this, main_target_loop);
+	}
+	/**
+	 * Returns an awaiter that resumes a coroutine using `dispatch_to` when `co_await`ed.
+	 *
+	 * @code
+	 * dispatch_queue::task<void> my_coroutine() {
+	 *     co_await dispatch_queue.dispatch_to(audio_loop);
+	 *     do_something_in_audio_thread();
+	 * }
+	 * @endcode
+	 */
+	dispatch_to_awaiter dispatch_to(const target_loop& loop) {
+		return dispatch_to_awaiter(*this, loop);
+	}
+
+#ifdef __linux__
+	/**
+	 * Read up to `size` bytes from `fd` into `buffer` without blocking a worker thread while no data is available.
+	 * The coroutine is suspended until `fd` becomes readable, then resumed in a background thread
+	 * that performs the read.
+	 * Use `co_await dispatch_main()` afterwards to continue in the main loop.
+	 *
+	 * @code
+	 * ssize_t bytes_read = co_await dispatch_queue.read(socket_fd, buffer, sizeof(buffer));
+	 * @endcode
+	 *
+	 * In immediate mode, the read is performed synchronously.
+	 * Only one pending read per file descriptor is supported: a second one fails with `EBUSY`.
+	 * Reads still pending when the dispatch queue is destroyed fail with `ECANCELED`,
+	 * resuming the coroutine in the destroying thread.
+	 * If waiting for readiness fails, pending and later reads fail with the error of `epoll_wait`.
+	 * @returns Result of `read`: the number of bytes read, or -1 with `errno` set on errors.
+	 */
+	io_awaiter read(int fd, void *buffer, size_t size) {
+		return io_awaiter(*this, detail::io_operation { detail::io_operation::kind::read, fd, buffer, size, nullptr, nullptr });
 	}
+
+	/**
+	 * Write up to `size` bytes from `buffer` into `fd` without blocking a worker thread while `fd` is not writable.
+	 * Only one pending write per file descriptor is supported.
+	 * @returns Result of `write`: the number of bytes written, or -1 with `errno` set on errors.
+	 * @see read
+	 */
+	io_awaiter write(int fd, const void *buffer, size_t size) {
+		return io_awaiter(*this, detail::io_operation { detail::io_operation::kind::write, fd, const_cast<void *>(buffer), size, nullptr, nullptr });
+	}
+
+	/**
+	 * Accept a connection on listening socket `fd` without blocking a worker thread while there are no pending connections.
+	 * @returns Result of `accept`: the new socket file descriptor, or -1 with `errno` set on errors.
+	 * @see read
+	 */
+	io_awaiter accept(int fd, sockaddr *address = nullptr, socklen_t *address_length = nullptr) {
+		return io_awaiter(*this, detail::io_operation { detail::io_operation::kind::accept, fd, nullptr, 0, address, address_length });
+	}
+
+	/**
+	 * Suspend the coroutine for `duration` without blocking a worker thread, then resume it in a background thread.
+	 * In immediate mode, the calling thread sleeps instead.
+	 * Sleeps still pending when the dispatch queue is destroyed end early, resuming the coroutine in the destroying thread.
+	 * Sleeps also end early if waiting for timers fails.
+	 */
+	template<class Rep, class Period>
+	sleep_awaiter sleep(const std::chrono::duration<Rep, Period>& duration) {
+		return sleep_awaiter(*this, std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(duration));
+	}
+#endif
 #endif
 
 private:
-	std::unique_ptr<detail::worker_pool> worker_pool;
-	detail::pending_task_queue task_queue;
+	std::shared_ptr<detail::worker_pool> worker_pool;
+	std::shared_ptr<detail::task_source> task_source = std::make_shared<detail::task_source>();
+	target_loop main_target_loop;
+	detail::coalescing_map coalesced_tasks;
+
+#ifdef __linux__
+	std::mutex io_reactor_mutex;
+	std::unique_ptr<detail::io_reactor> io_reactor;
+
+	detail::io_reactor& get_io_reactor();
+
+	/// Debounce timers share the I/O reactor's timer instead of running another thread
+	using timer_service = detail::io_reactor;
+#else
+	std::mutex timer_thread_mutex;
+	std::unique_ptr<detail::timer_thread> timer_thread;
+
+	using timer_service = detail::timer_thread;
+#endif
+
+	timer_service& get_timers();
+	std::shared_ptr<void> coalesce(const void *key, const void *result_type, bool is_debounced, std::chrono::nanoseconds delay, const std::function<std::function<bool()>(std::shared_ptr<void>&)>& make_work);
+	void enqueue_debounced(timer_service *timers, const void *key, const void *future);
+
+	void post_internal(detail::pending_task&& task);
+	void dispatch_limited(const std::shared_ptr<detail::limiter_state>& limiter, detail::pending_task&& task);
+
+	template<typename Ret, typename Work>
+	task<Ret> coalesce_internal(const void *key, bool is_debounced, std::chrono::nanoseconds delay, Work&& work) {
+		if (!worker_pool) {
+			return task<Ret>(detail::task_future<Ret>::create(work));
+		}
+		// Futures are only created and wrapped when a request is not merged into a queued one
+		auto shared_future = coalesce(key, detail::type_id<Ret>(), is_debounced, delay, [work](std::shared_ptr<void>& future) -> std::function<bool()> {
+			if (!future) {
+				future = detail::task_future<Ret>::create_pending();
+			}
+			return std::static_pointer_cast<detail::task_future<Ret>>(future)->wrap(work);
+		});
+		return task<Ret>(std::static_pointer_cast<detail::task_future<Ret>>(shared_future));
+	}
 
 	template<typename F, typename... Args, typename Ret = detail::function_result<F, Args...>>
-	task<Ret> dispatch_internal(bool run_on_main_loop, F&& f, Args&&... args) {
-		auto work = std::bind(std::move(f), std::forward<Args>(args)...);
-		if (worker_pool) {
+	task<Ret> dispatch_local_internal(int worker_index, bool is_pinned, F&& f, Args&&... args) {
+		if (!worker_pool) {
+			return dispatch_internal(nullptr, nullptr, std::forward<F>(f), std::forward<Args>(args)...);
+		}
+		auto future = detail::task_future<Ret>::create_pending();
+		worker_pool->enqueue_local_task(*task_source, worker_index, is_pinned, { future->wrap(detail::make_copyable(std::bind(std::forward<F>(f), std::forward<Args>(args)...))) });
+		return task<Ret>(future);
+	}
+
+	template<typename F, typename... Args, typename Ret = detail::function_result<F, Args...>>
+	task<Ret> dispatch_internal(detail::loop_queue *loop, const char *label, F&& f, Args&&... args) {
+		auto work = detail::make_copyable(std::bind(std::forward<F>(f), std::forward<Args>(args)...));
+		if (loop) {
 			auto future = detail::task_future<Ret>::create_pending();
-			worker_pool->enqueue_task({ future->wrap(work) }, run_on_main_loop);
+			loop->push({ future->wrap(std::move(work)), label });
 			return task<Ret>(future);
 		}
-		else if (run_on_main_loop) {
+		else if (worker_pool) {
 			auto future = detail::task_future<Ret>::create_pending();
-			task_queue.push({ future->wrap(work) }, run_on_main_loop);
+			worker_pool->enqueue_task(*task_source, { future->wrap(std::move(work)), label });
 			return task<Ret>(future);
 		}
 		else {
@@ -238,3 +829,8 @@ private:
 };
 
 } // end namespace dispatch_queue
+
+#include "pipeline.hpp"
+#include "task_cache.hpp"
+#include "task_group.hpp"
+#include "parallel_algorithms.hpp"
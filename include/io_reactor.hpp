@@ -0,0 +1,120 @@
+#pragma once
+
+#ifdef __linux__
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/socket.h>
+#include <sys/types.h>
+
+#include "wakeup_event.hpp"
+
+namespace dispatch_queue {
+
+namespace detail {
+
+/**
+ * Description of a non-blocking I/O system call, performed once its file descriptor is ready.
+ */
+struct io_operation {
+	enum class kind {
+		read,
+		write,
+		accept,
+	};
+
+	kind type;
+	int fd;
+	void *buffer;
+	size_t size;
+	sockaddr *address;
+	socklen_t *address_length;
+
+	/// Whether the operation waits for the file descriptor to be writable instead of readable.
+	bool is_write() const;
+	/// Returns true if `perform` would not block right now.
+	bool is_ready() const;
+	/// Run the system call, returning its result. On failure, returns -1 and sets `errno`.
+	ssize_t perform() const;
+};
+
+/**
+ * Reactor thread that waits on file descriptor readiness and timers using `epoll`.
+ *
+ * Callbacks receive 0 and run in the reactor thread, so they should only hand work over to other threads,
+ * like posting a coroutine resumption to a dispatch queue.
+ * Callbacks still waiting when the reactor is destroyed receive `ECANCELED` instead,
+ * in the destroying thread.
+ * If waiting with `epoll` fails, the reactor stops: waiting callbacks receive the error in the reactor thread,
+ * and later registrations fail with it.
+ * Regular files are always ready, so they are never watched by the reactor.
+ */
+class io_reactor {
+public:
+	io_reactor();
+	~io_reactor();
+
+	io_reactor(const io_reactor&) = delete;
+	io_reactor& operator=(const io_reactor&) = delete;
+
+	/**
+	 * Call `callback` once `fd` becomes readable, or writable if `for_write` is true.
+	 * Only one read waiter and one write waiter are supported per file descriptor.
+	 * @returns 0, or the error that prevents watching `fd`, in which case `callback` is never called:
+	 *          `EBUSY` if `fd` already has a waiter of the same kind, `ECANCELED` if the reactor is being destroyed,
+	 *          the error that stopped the reactor, or the error of `epoll_ctl`.
+	 */
+	int when_ready(int fd, bool for_write, std::function<void(int)> callback);
+
+	/**
+	 * Call `callback` once `deadline` is reached.
+	 * @returns 0, or the error that prevents waiting, in which case `callback` is never called:
+	 *          `ECANCELED` if the reactor is being destroyed, or the error that stopped the reactor.
+	 */
+	int when_expired(std::chrono::steady_clock::time_point deadline, std::function<void(int)> callback);
+
+private:
+	struct fd_waiters {
+		std::function<void(int)> reader;
+		std::function<void(int)> writer;
+	};
+
+	struct timer {
+		std::chrono::steady_clock::time_point deadline;
+		std::function<void(int)> callback;
+
+		bool operator>(const timer& other) const {
+			return deadline > other.deadline;
+		}
+	};
+
+	int epoll_fd;
+	int timer_fd;
+	wakeup_event wakeup;
+	std::mutex mutex;
+	std::unordered_map<int, fd_waiters> watched;
+	std::vector<timer> timers;
+	std::vector<std::function<void(int)>> ready_callbacks;
+	bool is_shutting_down = false;
+	/// Error of `epoll_wait` that stopped the reactor thread, or 0 while it is running
+	int failure = 0;
+	std::thread thread;
+
+	void run();
+	/// Move all waiting callbacks to `callbacks`, so they can be called outside the lock. Requires holding `mutex`.
+	void take_callbacks(std::vector<std::function<void(int)>>& callbacks);
+	void arm_timer();
+	bool watch(int fd, const fd_waiters& waiters, int operation);
+};
+
+} // end namespace detail
+
+} // end namespace dispatch_queue
+
+#endif
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+
+#include "pending_task_queue.hpp"
+#include "wakeup_event.hpp"
+
+namespace dispatch_queue {
+
+namespace detail {
+
+/**
+ * Thread-safe queue of tasks that run only when a target thread explicitly drains it.
+ * Each loop has its own mutex and wakeup event, so it does not contend with worker threads.
+ */
+class loop_queue {
+public:
+	loop_queue(std::string&& name);
+
+	loop_queue(const loop_queue&) = delete;
+	loop_queue& operator=(const loop_queue&) = delete;
+
+	const std::string& name() const;
+	bool empty();
+	size_t size();
+	void clear();
+
+	void push(pending_task&& task);
+	std::deque<pending_task> pop_all();
+
+	/// Event signaled while there are tasks queued.
+	wakeup_event& event();
+	const wakeup_event& event() const;
+
+private:
+	std::string loop_name;
+	std::mutex mutex;
+	std::deque<pending_task> tasks;
+	wakeup_event tasks_event;
+};
+
+} // end namespace detail
+
+} // end namespace dispatch_queue
@@ -0,0 +1,512 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "aligned_allocator.hpp"
+#include "dispatch_queue.hpp"
+#include "task_group.hpp"
+
+namespace dispatch_queue {
+
+namespace detail {
+
+/// Size of blocks processed by a single task, so that each block stays in a core's private caches
+constexpr size_t parallel_block_bytes = 64 * 1024;
+constexpr size_t parallel_cache_line_bytes = 64;
+/// Number of blocks per thread, so that faster threads can take over work from slower ones
+constexpr size_t parallel_blocks_per_thread = 4;
+
+/**
+ * Split of `[0, count)` into contiguous blocks.
+ * Block sizes are multiples of a cache line worth of elements, so that tasks writing to neighbouring blocks don't share cache lines.
+ */
+struct block_partition {
+	size_t count;
+	size_t block_size;
+	size_t block_count;
+
+	size_t begin(size_t block) const {
+		return block * block_size;
+	}
+	size_t end(size_t block) const {
+		return std::min(count, (block + 1) * block_size);
+	}
+};
+
+inline block_partition partition_blocks(const dispatch_queue& queue, size_t count, size_t min_block_size, size_t line_elements) {
+	size_t max_block_count = std::max((size_t) queue.thread_count() * parallel_blocks_per_thread, (size_t) 1);
+	size_t block_size = std::max(min_block_size, (count + max_block_count - 1) / max_block_count);
+	block_size = (block_size + line_elements - 1) / line_elements * line_elements;
+	return block_partition { count, block_size, count == 0 ? 0 : (count + block_size - 1) / block_size };
+}
+
+/// Partition `count` elements of type `T` in blocks of at least `parallel_block_bytes`.
+template<typename T>
+block_partition partition_blocks(const dispatch_queue& queue, size_t count) {
+	size_t line_elements = std::max(parallel_cache_line_bytes / sizeof(T), (size_t) 1);
+	return partition_blocks(queue, count, std::max(parallel_block_bytes / sizeof(T), line_elements), line_elements);
+}
+
+/**
+ * Call `f(begin, end, block)` for each block of `partition`, in parallel in `queue`'s workers.
+ * The calling thread runs the first block and helps with the others while waiting.
+ * Blocks run serially in immediate mode.
+ */
+template<typename F>
+void run_blocks(dispatch_queue& queue, const block_partition& partition, const F& f) {
+	if (partition.block_count <= 1 || !queue.is_threaded()) {
+		for (size_t block = 0; block < partition.block_count; block++) {
+			f(partition.begin(block), partition.end(block), block);
+		}
+		return;
+	}
+	task_group group(queue);
+	for (size_t block = 1; block < partition.block_count; block++) {
+		group.run([&f, &partition, block] {
+			f(partition.begin(block), partition.end(block), block);
+		});
+	}
+	f(partition.begin(0), partition.end(0), 0);
+	group.wait();
+}
+
+/**
+ * Merge sorted ranges `[first1, last1)` and `[first2, last2)` into `out`, moving elements.
+ * Large merges are split around the median of the larger range and run in parallel.
+ */
+template<typename InputIt, typename OutputIt, typename Compare>
+void parallel_merge(dispatch_queue& queue, InputIt first1, InputIt last1, InputIt first2, InputIt last2, OutputIt out, Compare comp, size_t min_size) {
+	size_t size1 = last1 - first1, size2 = last2 - first2;
+	if (size1 + size2 <= min_size || !queue.is_threaded()) {
+		std::merge(std::make_move_iterator(first1), std::make_move_iterator(last1), std::make_move_iterator(first2), std::make_move_iterator(last2), out, comp);
+		return;
+	}
+	if (size1 < size2) {
+		// Split the larger range, keeping elements from the first range before equal ones from the second range
+		InputIt mid2 = first2 + size2 / 2;
+		InputIt mid1 = std::upper_bound(first1, last1, *mid2, comp);
+		OutputIt mid_out = out + (mid1 - first1) + (mid2 - first2);
+		task_group group(queue);
+		group.run([=, &queue] { parallel_merge(queue, first1, mid1, first2, mid2, out, comp, min_size); });
+		parallel_merge(queue, mid1, last1, mid2, last2, mid_out, comp, min_size);
+		group.wait();
+	}
+	else {
+		InputIt mid1 = first1 + size1 / 2;
+		InputIt mid2 = std::lower_bound(first2, last2, *mid1, comp);
+		OutputIt mid_out = out + (mid1 - first1) + (mid2 - first2);
+		task_group group(queue);
+		group.run([=, &queue] { parallel_merge(queue, first1, mid1, first2, mid2, out, comp, min_size); });
+		parallel_merge(queue, mid1, last1, mid2, last2, mid_out, comp, min_size);
+		group.wait();
+	}
+}
+
+/**
+ * Output iterator that move constructs elements in uninitialized memory, for merging into a fresh buffer.
+ */
+template<typename T>
+struct uninitialized_output_iterator {
+	using iterator_category = std::output_iterator_tag;
+	using value_type = void;
+	using difference_type = std::ptrdiff_t;
+	using pointer = void;
+	using reference = void;
+
+	struct construct_on_assign {
+		T *element;
+
+		construct_on_assign& operator=(T&& value) {
+			::new (static_cast<void *>(element)) T(std::move(value));
+			return *this;
+		}
+	};
+
+	T *element;
+
+	construct_on_assign operator*() const {
+		return { element };
+	}
+	uninitialized_output_iterator& operator++() {
+		++element;
+		return *this;
+	}
+	uninitialized_output_iterator operator++(int) {
+		return { element++ };
+	}
+	uninitialized_output_iterator operator+(difference_type offset) const {
+		return { element + offset };
+	}
+};
+
+/**
+ * Uninitialized memory for the elements of a parallel sort, destroying them only once all were constructed.
+ */
+template<typename T>
+class merge_buffer {
+public:
+	explicit merge_buffer(size_t count)
+		: elements(count > 0 ? aligned_allocator<T>().allocate(count) : nullptr)
+		, count(count)
+	{
+	}
+	~merge_buffer() {
+		if (is_constructed) {
+			for (size_t i = 0; i < count; i++) {
+				elements[i].~T();
+			}
+		}
+		if (elements) {
+			aligned_allocator<T>().deallocate(elements, count);
+		}
+	}
+
+	merge_buffer(const merge_buffer&) = delete;
+	merge_buffer& operator=(const merge_buffer&) = delete;
+
+	T *data() const {
+		return elements;
+	}
+	void set_constructed() {
+		is_constructed = true;
+	}
+
+private:
+	T *elements;
+	size_t count;
+	bool is_constructed = false;
+};
+
+/**
+ * Whether a merge into uninitialized memory can be interrupted without leaking the elements constructed so far,
+ * either because merging cannot throw or because elements need no destruction.
+ */
+template<typename T, typename Compare>
+constexpr bool can_merge_uninitialized() {
+#ifdef __cpp_exceptions
+	return std::is_trivially_destructible<T>::value
+		|| (std::is_nothrow_move_constructible<T>::value && noexcept(std::declval<Compare&>()(std::declval<const T&>(), std::declval<const T&>())));
+#else
+	return true;
+#endif
+}
+
+} // end namespace detail
+
+/**
+ * Call `f(i)` for each index in `[first, last)`, in parallel in `queue`'s workers.
+ * Indices are split in contiguous blocks of at least `grain_size` indices, a few blocks per worker.
+ * The calling thread takes part in the work and returns once all calls finished.
+ * If calls throw exceptions, the first one is rethrown.
+ */
+template<typename Index, typename F>
+void parallel_for(dispatch_queue& queue, Index first, Index last, F f, size_t grain_size = 1) {
+	if (last <= first) {
+		return;
+	}
+	detail::block_partition partition = detail::partition_blocks(queue, (size_t) (last - first), std::max(grain_size, (size_t) 1), 1);
+	detail::run_blocks(queue, partition, [first, &f](size_t begin, size_t end, size_t) {
+		for (size_t i = begin; i < end; i++) {
+			f((Index) (first + i));
+		}
+	});
+}
+
+/**
+ * Parallel `std::transform`: store `op(*it)` for each element of `[first, last)` in the range starting at `d_first`.
+ * Both ranges must be random access.
+ * @returns Iterator past the last written element.
+ */
+template<typename RandomIt, typename OutputIt, typename UnaryOp>
+OutputIt parallel_transform(dispatch_queue& queue, RandomIt first, RandomIt last, OutputIt d_first, UnaryOp op) {
+	using value_type = typename std::iterator_traits<OutputIt>::value_type;
+	size_t count = last - first;
+	detail::run_blocks(queue, detail::partition_blocks<value_type>(queue, count), [=, &op](size_t begin, size_t end, size_t) {
+		for (size_t i = begin; i < end; i++) {
+			d_first[i] = op(first[i]);
+		}
+	});
+	return d_first + count;
+}
+
+/**
+ * Parallel `std::reduce`: combine `init` and the elements of `[first, last)` with `op`, which must be associative.
+ * Elements are combined in order inside each block, and block results are combined in order.
+ */
+template<typename RandomIt, typename T, typename BinaryOp = std::plus<>>
+T parallel_reduce(dispatch_queue& queue, RandomIt first, RandomIt last, T init, BinaryOp op = {}) {
+	size_t count = last - first;
+	detail::block_partition partition = detail::partition_blocks<typename std::iterator_traits<RandomIt>::value_type>(queue, count);
+	std::vector<T> partial_results(partition.block_count, init);
+	detail::run_blocks(queue, partition, [=, &op, &partial_results](size_t begin, size_t end, size_t block) {
+		T accumulator = first[begin];
+		for (size_t i = begin + 1; i < end; i++) {
+			accumulator = op(std::move(accumulator), first[i]);
+		}
+		partial_results[block] = std::move(accumulator);
+	});
+	for (T& partial_result : partial_results) {
+		init = op(std::move(init), std::move(partial_result));
+	}
+	return init;
+}
+
+/**
+ * Parallel `std::inclusive_scan`: store the running combination of `[first, last)` with `op` in the range starting at `d_first`.
+ * `op` must be associative. The output range may be the input range.
+ * Runs in two passes over the input: block totals first, then each block's scan starting from the total of previous blocks.
+ * @returns Iterator past the last written element.
+ */
+template<typename RandomIt, typename OutputIt, typename BinaryOp = std::plus<>>
+OutputIt parallel_inclusive_scan(dispatch_queue& queue, RandomIt first, RandomIt last, OutputIt d_first, BinaryOp op = {}) {
+	using value_type = typename std::iterator_traits<RandomIt>::value_type;
+	size_t count = last - first;
+	detail::block_partition partition = detail::partition_blocks<value_type>(queue, count);
+	if (partition.block_count <= 1 || !queue.is_threaded()) {
+		if (count > 0) {
+			value_type accumulator = first[0];
+			d_first[0] = accumulator;
+			for (size_t i = 1; i < count; i++) {
+				accumulator = op(std::move(accumulator), first[i]);
+				d_first[i] = accumulator;
+			}
+		}
+		return d_first + count;
+	}
+
+	std::vector<value_type> block_totals;
+	block_totals.reserve(partition.block_count);
+	for (size_t block = 0; block < partition.block_count; block++) {
+		block_totals.push_back(first[partition.begin(block)]);
+	}
+	// The last block's total is never used
+	detail::block_partition totals_partition = partition;
+	totals_partition.block_count--;
+	detail::run_blocks(queue, totals_partition, [=, &op, &block_totals](size_t begin, size_t end, size_t block) {
+		value_type accumulator = first[begin];
+		for (size_t i = begin + 1; i < end; i++) {
+			accumulator = op(std::move(accumulator), first[i]);
+		}
+		block_totals[block] = std::move(accumulator);
+	});
+	for (size_t block = 1; block < partition.block_count - 1; block++) {
+		block_totals[block] = op(block_totals[block - 1], block_totals[block]);
+	}
+	detail::run_blocks(queue, partition, [=, &op, &block_totals](size_t begin, size_t end, size_t block) {
+		value_type accumulator = block == 0 ? first[begin] : op(block_totals[block - 1], first[begin]);
+		d_first[begin] = accumulator;
+		for (size_t i = begin + 1; i < end; i++) {
+			accumulator = op(std::move(accumulator), first[i]);
+			d_first[i] = accumulator;
+		}
+	});
+	return d_first + count;
+}
+
+/**
+ * Parallel `std::exclusive_scan`: like `parallel_inclusive_scan`, but each output element is the combination of
+ * `init` and the elements before it, excluding the element itself.
+ * @returns Iterator past the last written element.
+ */
+template<typename RandomIt, typename OutputIt, typename T, typename BinaryOp = std::plus<>>
+OutputIt parallel_exclusive_scan(dispatch_queue& queue, RandomIt first, RandomIt last, OutputIt d_first, T init, BinaryOp op = {}) {
+	size_t count = last - first;
+	detail::block_partition partition = detail::partition_blocks<typename std::iterator_traits<RandomIt>::value_type>(queue, count);
+	if (partition.block_count <= 1 || !queue.is_threaded()) {
+		for (size_t i = 0; i < count; i++) {
+			// Read before writing, the output range may be the input range
+			T value = first[i];
+			d_first[i] = init;
+			init = op(std::move(init), std::move(value));
+		}
+		return d_first + count;
+	}
+
+	std::vector<T> block_offsets(partition.block_count, init);
+	detail::block_partition totals_partition = partition;
+	totals_partition.block_count--;
+	detail::run_blocks(queue, totals_partition, [=, &op, &block_offsets](size_t begin, size_t end, size_t block) {
+		T accumulator = first[begin];
+		for (size_t i = begin + 1; i < end; i++) {
+			accumulator = op(std::move(accumulator), first[i]);
+		}
+		block_offsets[block + 1] = std::move(accumulator);
+	});
+	for (size_t block = 1; block < partition.block_count; block++) {
+		block_offsets[block] = op(block_offsets[block - 1], block_offsets[block]);
+	}
+	detail::run_blocks(queue, partition, [=, &op, &block_offsets](size_t begin, size_t end, size_t block) {
+		T accumulator = block_offsets[block];
+		for (size_t i = begin; i < end; i++) {
+			T value = first[i];
+			d_first[i] = accumulator;
+			accumulator = op(std::move(accumulator), std::move(value));
+		}
+	});
+	return d_first + count;
+}
+
+/**
+ * Parallel `std::copy_if`: copy the elements of `[first, last)` for which `pred` returns true to the range starting at `d_first`,
+ * keeping their relative order. `pred` is called once per element.
+ * The output range must be random access and must not overlap the input range.
+ * @returns Iterator past the last copied element.
+ */
+template<typename RandomIt, typename OutputIt, typename UnaryPredicate>
+OutputIt parallel_copy_if(dispatch_queue& queue, RandomIt first, RandomIt last, OutputIt d_first, UnaryPredicate pred) {
+	size_t count = last - first;
+	detail::block_partition partition = detail::partition_blocks<typename std::iterator_traits<RandomIt>::value_type>(queue, count);
+	if (partition.block_count <= 1 || !queue.is_threaded()) {
+		return std::copy_if(first, last, d_first, pred);
+	}
+
+	// Keep predicate results, so that the copy pass knows where each block starts without calling `pred` again
+	std::vector<unsigned char> selected(count);
+	std::vector<size_t> block_offsets(partition.block_count + 1, 0);
+	detail::run_blocks(queue, partition, [=, &pred, &selected, &block_offsets](size_t begin, size_t end, size_t block) {
+		size_t selected_count = 0;
+		for (size_t i = begin; i < end; i++) {
+			unsigned char is_selected = pred(first[i]) ? 1 : 0;
+			selected[i] = is_selected;
+			selected_count += is_selected;
+		}
+		block_offsets[block + 1] = selected_count;
+	});
+	for (size_t block = 1; block <= partition.block_count; block++) {
+		block_offsets[block] += block_offsets[block - 1];
+	}
+	detail::run_blocks(queue, partition, [=, &selected, &block_offsets](size_t begin, size_t end, size_t block) {
+		OutputIt out = d_first + block_offsets[block];
+		for (size_t i = begin; i < end; i++) {
+			if (selected[i]) {
+				*out = first[i];
+				++out;
+			}
+		}
+	});
+	return d_first + block_offsets[partition.block_count];
+}
+
+/**
+ * Parallel `std::find_if`: returns an iterator to the first element of `[first, last)` for which `pred` returns true, or `last`.
+ * Blocks after an element that was already found stop early.
+ */
+template<typename RandomIt, typename UnaryPredicate>
+RandomIt parallel_find_if(dispatch_queue& queue, RandomIt first, RandomIt last, UnaryPredicate pred) {
+	size_t count = last - first;
+	detail::block_partition partition = detail::partition_blocks<typename std::iterator_traits<RandomIt>::value_type>(queue, count);
+	if (partition.block_count <= 1 || !queue.is_threaded()) {
+		return std::find_if(first, last, pred);
+	}
+
+	std::atomic<size_t> found_index { count };
+	// Check for earlier matches once per cache line worth of elements
+	const size_t check_interval = std::max(detail::parallel_cache_line_bytes / sizeof(typename std::iterator_traits<RandomIt>::value_type), (size_t) 1);
+	detail::run_blocks(queue, partition, [=, &pred, &found_index](size_t begin, size_t end, size_t) {
+		for (size_t chunk = begin; chunk < end; chunk += check_interval) {
+			if (found_index.load(std::memory_order_relaxed) < chunk) {
+				return;
+			}
+			size_t chunk_end = std::min(chunk + check_interval, end);
+			for (size_t i = chunk; i < chunk_end; i++) {
+				if (pred(first[i])) {
+					size_t current = found_index.load(std::memory_order_relaxed);
+					while (i < current && !found_index.compare_exchange_weak(current, i, std::memory_order_relaxed)) {}
+					return;
+				}
+			}
+		}
+	});
+	return first + found_index.load(std::memory_order_relaxed);
+}
+
+/**
+ * Parallel `std::find`: returns an iterator to the first element of `[first, last)` equal to `value`, or `last`.
+ */
+template<typename RandomIt, typename T>
+RandomIt parallel_find(dispatch_queue& queue, RandomIt first, RandomIt last, const T& value) {
+	return parallel_find_if(queue, first, last, [&value](const typename std::iterator_traits<RandomIt>::value_type& element) {
+		return element == value;
+	});
+}
+
+/**
+ * Parallel sort of `[first, last)` according to `comp`. Like `std::sort`, the sort is not stable.
+ * Blocks are sorted in parallel with `std::sort`, then merged in parallel rounds alternating between the range
+ * and a temporary buffer, splitting large merges around their median so that the last rounds also use all workers.
+ * The first round merges straight into uninitialized memory when merging cannot throw or elements are trivially destructible,
+ * otherwise elements are moved into the buffer first.
+ * Falls back to `std::sort` in immediate mode and for small ranges.
+ */
+template<typename RandomIt, typename Compare = std::less<>>
+void parallel_sort(dispatch_queue& queue, RandomIt first, RandomIt last, Compare comp = {}) {
+	using value_type = typename std::iterator_traits<RandomIt>::value_type;
+	size_t count = last - first;
+	detail::block_partition partition = detail::partition_blocks<value_type>(queue, count);
+	if (partition.block_count <= 1 || !queue.is_threaded()) {
+		std::sort(first, last, comp);
+		return;
+	}
+
+	detail::run_blocks(queue, partition, [=, &comp](size_t begin, size_t end, size_t) {
+		std::sort(first + begin, first + end, comp);
+	});
+
+	auto merge_round = [&](auto source, auto destination, size_t run_size) {
+		size_t pair_count = (count + 2 * run_size - 1) / (2 * run_size);
+		task_group group(queue);
+		for (size_t pair = 0; pair < pair_count; pair++) {
+			group.run([=, &queue, &comp] {
+				size_t begin = pair * 2 * run_size;
+				size_t middle = std::min(begin + run_size, count);
+				size_t end = std::min(begin + 2 * run_size, count);
+				detail::parallel_merge(queue, source + begin, source + middle, source + middle, source + end, destination + begin, comp, partition.block_size);
+			});
+		}
+		group.wait();
+	};
+
+	// The first round merges from the range into the buffer, so that each round moves every element once
+	size_t run_size = partition.block_size;
+	detail::merge_buffer<value_type> uninitialized_buffer(detail::can_merge_uninitialized<value_type, Compare>() ? count : 0);
+	std::vector<value_type> moved_buffer;
+	value_type *buffer;
+	if (detail::can_merge_uninitialized<value_type, Compare>()) {
+		buffer = uninitialized_buffer.data();
+		merge_round(first, detail::uninitialized_output_iterator<value_type> { buffer }, run_size);
+		uninitialized_buffer.set_constructed();
+		run_size *= 2;
+	}
+	else {
+		// An exception while merging into uninitialized memory would leak the elements moved so far
+		moved_buffer.assign(std::make_move_iterator(first), std::make_move_iterator(last));
+		buffer = moved_buffer.data();
+	}
+
+	bool is_sorted_in_buffer = true;
+	for (; run_size < count; run_size *= 2) {
+		if (is_sorted_in_buffer) {
+			merge_round(buffer, first, run_size);
+		}
+		else {
+			merge_round(first, buffer, run_size);
+		}
+		is_sorted_in_buffer = !is_sorted_in_buffer;
+	}
+	if (is_sorted_in_buffer) {
+		detail::run_blocks(queue, partition, [=](size_t begin, size_t end, size_t) {
+			std::move(buffer + begin, buffer + end, first + begin);
+		});
+	}
+}
+
+} // end namespace dispatch_queue
@@ -1,26 +1,117 @@
 #pragma once
 
-#include <deque>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 namespace dispatch_queue {
 
 namespace detail {
 
-using pending_task = std::function<void()>;
+/**
+ * Type-erased task waiting to be run.
+ */
+struct pending_task {
+	/// Runs the task, returning whether it succeeded.
+	std::function<bool()> work;
+	/// Static name passed with `task_label`, if any.
+	const char *label = nullptr;
+	/// When the task was queued, only set while collecting statistics or watching for stalls.
+	std::chrono::steady_clock::time_point enqueue_time;
+	/// Trace identifier, only set while tracing.
+	uint64_t id = 0;
 
+	pending_task() = default;
+	pending_task(std::function<bool()> work, const char *label = nullptr)
+		: work(std::move(work))
+		, label(label)
+	{
+	}
+
+	bool operator()() const {
+		return work();
+	}
+};
+
+/**
+ * Wraps `f` as the work of a pending task that reports whether it succeeded.
+ * Exceptions thrown by `f` are discarded.
+ */
+template<typename F>
+std::function<bool()> make_pending_work(F&& f) {
+	return [f = typename std::decay<F>::type(std::forward<F>(f))]() mutable {
+#ifdef __cpp_exceptions
+		try {
+			f();
+			return true;
+		}
+		catch (...) {
+			return false;
+		}
+#else
+		f();
+		return true;
+#endif
+	};
+}
+
+/**
+ * Callable that shares a functor which cannot be copied, so that it can be stored in `std::function`.
+ */
+template<typename F>
+struct shared_functor {
+	std::shared_ptr<F> f;
+
+	template<typename... Args>
+	decltype(auto) operator()(Args&&... args) const {
+		return (*f)(std::forward<Args>(args)...);
+	}
+};
+
+/**
+ * Returns `f` if it can be copied, or a `shared_functor` owning it otherwise,
+ * so that move-only functors and functors bound to move-only arguments can be dispatched.
+ */
+template<typename F, typename Functor = typename std::decay<F>::type>
+typename std::enable_if<std::is_copy_constructible<Functor>::value, Functor>::type make_copyable(F&& f) {
+	return std::forward<F>(f);
+}
+
+template<typename F, typename Functor = typename std::decay<F>::type>
+typename std::enable_if<!std::is_copy_constructible<Functor>::value, shared_functor<Functor>>::type make_copyable(F&& f) {
+	return { std::make_shared<Functor>(std::forward<F>(f)) };
+}
+
+/**
+ * FIFO queue of pending tasks.
+ * Implemented as a ring buffer that only grows, so that steady state push/pop does not allocate.
+ */
 class pending_task_queue {
 public:
 	bool empty() const;
 	size_t size() const;
 	void clear();
+	/// Exchange contents with `other`, for example to destroy tasks outside of a lock.
+	void swap(pending_task_queue& other);
 
-	void push(pending_task&& task, bool run_on_main_loop);
+	void push(pending_task&& task);
+	/// Push `task` before all other tasks, so that it is the next one popped.
+	void push_front(pending_task&& task);
 	bool try_pop(pending_task& task);
-	std::deque<pending_task> pop_main_loop_tasks();
+	/// Returns the next task to be popped, or null if the queue is empty.
+	const pending_task *front() const;
 
 private:
-	std::deque<pending_task> background_tasks;
-	std::deque<pending_task> main_loop_tasks;
+	std::vector<pending_task> background_tasks;
+	size_t head = 0;
+	size_t count = 0;
+
+	void grow();
 };
 
 } // end namespace detail
@@ -0,0 +1,286 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "dispatch_queue.hpp"
+
+namespace dispatch_queue {
+
+/**
+ * How a pipeline stage processes items.
+ */
+enum class pipeline_stage_mode {
+	/// Processes one item at a time, in the order they were produced by the source
+	serial_in_order,
+	/// Processes one item at a time, in any order
+	serial_out_of_order,
+	/// Processes any number of items concurrently
+	parallel,
+};
+
+namespace detail {
+
+template<typename T>
+struct pipeline_stage {
+	pipeline_stage_mode mode;
+	std::function<void(T&)> work;
+};
+
+/**
+ * State of a single pipeline run.
+ * Items flow through preallocated tokens, so the number of items in flight never exceeds the token count.
+ */
+template<typename T>
+class pipeline_run {
+	struct token {
+		T item;
+		size_t sequence;
+	};
+
+	struct stage_state {
+		std::mutex mutex;
+		bool is_busy = false;
+		size_t next_sequence = 0;
+		/// In order stages: tokens waiting for their turn, indexed by `sequence % token_count`
+		/// Out of order stages: tokens waiting for the stage to be free
+		std::vector<token *> waiting;
+	};
+
+public:
+	template<typename Source>
+	pipeline_run(dispatch_queue& queue, const std::vector<pipeline_stage<T>>& stages, size_t token_count, Source&& source)
+		: queue(queue)
+		, stages(stages)
+		, source(std::forward<Source>(source))
+		, tokens(token_count)
+		, stage_states(new stage_state[stages.size()])
+	{
+		free_tokens.reserve(token_count);
+		for (token& t : tokens) {
+			free_tokens.push_back(&t);
+		}
+		for (size_t i = 0; i < stages.size(); i++) {
+			if (stages[i].mode == pipeline_stage_mode::serial_in_order) {
+				stage_states[i].waiting.resize(token_count, nullptr);
+			}
+			else if (stages[i].mode == pipeline_stage_mode::serial_out_of_order) {
+				stage_states[i].waiting.reserve(token_count);
+			}
+		}
+	}
+
+	void run() {
+		pump_input();
+		std::unique_lock<std::mutex> lock(mutex);
+		finished_condition_variable.wait(lock, [this]() { return is_finished; });
+#ifdef __cpp_exceptions
+		if (first_exception) {
+			std::rethrow_exception(first_exception);
+		}
+#endif
+	}
+
+private:
+	dispatch_queue& queue;
+	const std::vector<pipeline_stage<T>>& stages;
+	std::function<bool(T&)> source;
+	std::vector<token> tokens;
+	std::unique_ptr<stage_state[]> stage_states;
+
+	std::mutex mutex;
+	std::condition_variable finished_condition_variable;
+	std::vector<token *> free_tokens;
+	size_t next_input_sequence = 0;
+	bool is_input_running = false;
+	bool is_input_done = false;
+	bool is_finished = false;
+	std::exception_ptr first_exception;
+
+	/// Produce items from source while there are free tokens, one thread at a time.
+	void pump_input() {
+		std::unique_lock<std::mutex> lock(mutex);
+		if (is_input_running || is_input_done) {
+			return;
+		}
+		is_input_running = true;
+		while (!free_tokens.empty() && !is_input_done) {
+			token *t = free_tokens.back();
+			free_tokens.pop_back();
+			lock.unlock();
+
+			bool has_item = false;
+			DISPATCH_QUEUE_TRY {
+				has_item = source(t->item);
+			}
+			DISPATCH_QUEUE_CATCH(...) {
+				set_exception(std::current_exception());
+			}
+
+			lock.lock();
+			if (!has_item) {
+				free_tokens.push_back(t);
+				is_input_done = true;
+				break;
+			}
+			t->sequence = next_input_sequence++;
+			lock.unlock();
+			queue.post([this, t]() {
+				process(t, 0, false);
+			});
+			lock.lock();
+		}
+		is_input_running = false;
+		check_finished(lock);
+	}
+
+	/// Run token `t` through stages starting at `stage_index`.
+	/// If `owns_stage` is true, the serial stage at `stage_index` was already reserved for `t`.
+	void process(token *t, size_t stage_index, bool owns_stage) {
+		for (size_t i = stage_index; i < stages.size(); i++) {
+			const pipeline_stage<T>& stage = stages[i];
+			stage_state& state = stage_states[i];
+			if (stage.mode != pipeline_stage_mode::parallel && !(owns_stage && i == stage_index)) {
+				std::lock_guard<std::mutex> lock(state.mutex);
+				if (stage.mode == pipeline_stage_mode::serial_in_order) {
+					if (state.is_busy || t->sequence != state.next_sequence) {
+						state.waiting[t->sequence % tokens.size()] = t;
+						return;
+					}
+				}
+				else if (state.is_busy) {
+					state.waiting.push_back(t);
+					return;
+				}
+				state.is_busy = true;
+			}
+
+			DISPATCH_QUEUE_TRY {
+				stage.work(t->item);
+			}
+			DISPATCH_QUEUE_CATCH(...) {
+				set_exception(std::current_exception());
+			}
+
+			if (stage.mode != pipeline_stage_mode::parallel) {
+				token *next = nullptr;
+				{
+					std::lock_guard<std::mutex> lock(state.mutex);
+					if (stage.mode == pipeline_stage_mode::serial_in_order) {
+						state.next_sequence++;
+						token *&slot = state.waiting[state.next_sequence % tokens.size()];
+						if (slot && slot->sequence == state.next_sequence) {
+							next = slot;
+							slot = nullptr;
+						}
+					}
+					else if (!state.waiting.empty()) {
+						next = state.waiting.back();
+						state.waiting.pop_back();
+					}
+					state.is_busy = next != nullptr;
+				}
+				if (next) {
+					queue.post([this, next, i]() {
+						process(next, i, true);
+					});
+				}
+			}
+		}
+		release(t);
+	}
+
+	void release(token *t) {
+		std::unique_lock<std::mutex> lock(mutex);
+		free_tokens.push_back(t);
+		if (!is_input_running && !is_input_done) {
+			lock.unlock();
+			pump_input();
+		}
+		else {
+			check_finished(lock);
+		}
+	}
+
+	void set_exception(std::exception_ptr exception) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!first_exception) {
+			first_exception = exception;
+		}
+		is_input_done = true;
+	}
+
+	/// Takes the held lock to document that `mutex` must be locked
+	void check_finished(std::unique_lock<std::mutex>&) {
+		if (is_input_done && !is_input_running && free_tokens.size() == tokens.size()) {
+			is_finished = true;
+			finished_condition_variable.notify_all();
+		}
+	}
+};
+
+} // end namespace detail
+
+/**
+ * Bounded pipeline of stages that process items produced by a source, running on a dispatch queue.
+ *
+ * At most `max_tokens` items are in flight at any time, bounding memory usage.
+ * Items are stored in preallocated tokens of type `T` that are reused for new items once they leave the last stage,
+ * so stages usually transform the item in place.
+ * Serial stages never block workers: items that are not ready for a serial stage are parked until the stage is free.
+ *
+ * @code
+ * dispatch_queue::pipeline<frame> frames;
+ * frames.add_stage(dispatch_queue::pipeline_stage_mode::parallel, decode);
+ * frames.add_stage(dispatch_queue::pipeline_stage_mode::parallel, transform);
+ * frames.add_stage(dispatch_queue::pipeline_stage_mode::serial_in_order, encode);
+ * frames.run(dispatch_queue, 8, [&](frame& f) {
+ *     return read_next_frame(f);
+ * });
+ * @endcode
+ */
+template<typename T>
+class pipeline {
+public:
+	/**
+	 * Add a stage that calls `work` for every item.
+	 */
+	pipeline& add_stage(pipeline_stage_mode mode, std::function<void(T&)> work) {
+		stages.push_back({ mode, std::move(work) });
+		return *this;
+	}
+
+	/**
+	 * Returns the number of stages.
+	 */
+	size_t stage_count() const {
+		return stages.size();
+	}
+
+	/**
+	 * Run the pipeline on `queue`, blocking until all items produced by `source` went through all stages.
+	 *
+	 * `source` is called serially, in a single thread at a time, to fill new items.
+	 * It must return `false` when there are no more items.
+	 * If a stage or the source throws an exception, no more items are produced and the first exception is rethrown after in-flight items finish.
+	 *
+	 * @param queue Dispatch queue where stages run
+	 * @param max_tokens Maximum number of items in flight
+	 * @param source Functor with signature `bool(T&)` that fills the next item
+	 */
+	template<typename Source>
+	void run(dispatch_queue& queue, size_t max_tokens, Source&& source) const {
+		detail::pipeline_run<T> run(queue, stages, max_tokens > 0 ? max_tokens : 1, std::forward<Source>(source));
+		run.run();
+	}
+
+private:
+	std::vector<detail::pipeline_stage<T>> stages;
+};
+
+} // end namespace dispatch_queue
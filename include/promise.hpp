@@ -3,6 +3,7 @@
 #ifdef __cpp_lib_coroutine
 
 #include <coroutine>
+#include <system_error>
 
 #include "task.hpp"
 
@@ -15,10 +16,14 @@ class promise {
 public:
 	auto get_return_object() { return future; }
 	std::suspend_never initial_suspend() noexcept { return {}; }
-	std::suspend_always final_suspend() noexcept { return {}; }
+	std::suspend_never final_suspend() noexcept { return {}; }
 	void return_value(T&& value) {
 		future->set_value(std::move(value));
 	}
+	/// `co_return failure(error_code)` fails the task with an error code, without throwing
+	void return_value(result_failure<std::error_code>&& failure) requires (!is_result<T>::value) {
+		future->set_error(failure.error);
+	}
 	void unhandled_exception() {
 		future->set_exception(std::current_exception());
 	}
@@ -33,7 +38,7 @@ class promise<void> {
 public:
 	auto get_return_object() { return future; }
 	std::suspend_never initial_suspend() noexcept { return {}; }
-	std::suspend_always final_suspend() noexcept { return {}; }
+	std::suspend_never final_suspend() noexcept { return {}; }
 	void return_void() {
 		future->set_value();
 	}
@@ -45,8 +50,43 @@ private:
 	std::shared_ptr<detail::task_future<void>> future = detail::task_future<void>::create_pending();
 };
 
+/**
+ * Awaiter returned by `fail`, which fails the awaiting task with an error code.
+ */
+struct failure_awaiter {
+	std::error_code error;
+
+	bool await_ready() const noexcept { return false; }
+	template<typename T>
+	void await_suspend(std::coroutine_handle<promise<T>> handle) const {
+		// Destroying the frame also destroys this awaiter, so keep what is needed to fail the task
+		auto future = handle.promise().get_return_object();
+		std::error_code task_error = error;
+		handle.destroy();
+		future->set_error(task_error);
+	}
+	void await_resume() const noexcept {}
+};
+
 } // end namespace detail
 
+/**
+ * Fails the calling `task` coroutine with `error`, without throwing.
+ * The coroutine never resumes from `co_await fail(error)`: its local variables are destroyed and the task fails.
+ * Unlike `co_return failure(error)`, also works in `task<void>` coroutines, and under `-fno-exceptions`.
+ *
+ * @code
+ * dispatch_queue::task<void> save(dispatch_queue::dispatch_queue& queue, int fd, const char *data, size_t size) {
+ *     if (co_await queue.write(fd, data, size) < 0) {
+ *         co_await dispatch_queue::fail(std::error_code(errno, std::generic_category()));
+ *     }
+ * }
+ * @endcode
+ */
+inline detail::failure_awaiter fail(std::error_code error) {
+	return detail::failure_awaiter { error };
+}
+
 } // end namespace dispatch_queue
 
 template<typename T, typename... Args>
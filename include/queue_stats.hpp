@@ -0,0 +1,110 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace dispatch_queue {
+
+/**
+ * Log-linear histogram of durations with nanosecond resolution.
+ *
+ * Each power of two range is split in `sub_bucket_count` linear buckets,
+ * so bucket bounds have a relative error of at most 12.5%.
+ */
+class duration_histogram {
+public:
+	static constexpr int sub_bucket_bits = 3;
+	static constexpr int sub_bucket_count = 1 << sub_bucket_bits;
+	static constexpr int bucket_count = sub_bucket_count + (64 - sub_bucket_bits) * sub_bucket_count;
+
+	/**
+	 * Number of recorded durations.
+	 */
+	uint64_t count() const;
+
+	/**
+	 * Returns an upper bound for the duration at percentile `p`, in the range [0, 100].
+	 * Returns zero if the histogram is empty.
+	 */
+	std::chrono::nanoseconds percentile(double p) const;
+
+	/**
+	 * Number of durations recorded in each bucket.
+	 */
+	const std::array<uint64_t, bucket_count>& buckets() const;
+
+	/**
+	 * Smallest duration that falls in bucket `index`.
+	 */
+	static std::chrono::nanoseconds bucket_lower_bound(int index);
+
+	/**
+	 * Largest duration that falls in bucket `index`.
+	 */
+	static std::chrono::nanoseconds bucket_upper_bound(int index);
+
+	/**
+	 * Index of the bucket where `nanoseconds` falls.
+	 */
+	static int bucket_index(uint64_t nanoseconds);
+
+	void record(std::chrono::nanoseconds duration);
+	void add(int index, uint64_t count);
+
+private:
+	std::array<uint64_t, bucket_count> bucket_counts {};
+};
+
+/**
+ * Statistics of a single worker thread.
+ */
+struct worker_stats {
+	/// Number of tasks that finished successfully
+	uint64_t completed = 0;
+	/// Number of tasks that failed
+	uint64_t failed = 0;
+	/// Time spent running tasks
+	std::chrono::nanoseconds busy_time {};
+	/// Time spent waiting for tasks
+	std::chrono::nanoseconds idle_time {};
+};
+
+/**
+ * Snapshot of the statistics of a worker pool, counting the tasks of all dispatch queues that share it.
+ * @see queue_stats::pool
+ */
+struct pool_stats {
+	/// Number of tasks that finished successfully
+	uint64_t completed = 0;
+	/// Number of tasks that failed
+	uint64_t failed = 0;
+	/// Number of threads spawned to replace workers blocked inside a `blocking_scope`
+	uint64_t compensation_threads = 0;
+	/// Per worker statistics, indexed by worker index, followed by running compensation threads.
+	/// Counts of compensation threads that exited after idling are kept in the pool totals.
+	std::vector<worker_stats> workers;
+	/// Time between a task being dispatched and starting to run
+	duration_histogram wait_time;
+	/// Time spent running tasks
+	duration_histogram run_time;
+};
+
+/**
+ * Snapshot of a dispatch queue's statistics.
+ * @see dispatch_queue::stats
+ */
+struct queue_stats {
+	/// Number of tasks dispatched to the background queue
+	uint64_t enqueued = 0;
+	/// Largest number of tasks queued at the same time
+	size_t max_depth = 0;
+	/// Statistics of the workers running the queue's tasks.
+	/// Workers are shared by all dispatch queues created from the same `shared_pool`,
+	/// so these include tasks of the other queues.
+	pool_stats pool;
+};
+
+} // end namespace dispatch_queue
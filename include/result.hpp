@@ -0,0 +1,313 @@
+#pragma once
+
+#include <cassert>
+#include <new>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+namespace dispatch_queue {
+
+/**
+ * Error wrapper used to construct failed `result`s, created with `failure`.
+ */
+template<typename E>
+struct result_failure {
+	E error;
+};
+
+/**
+ * Returns a wrapper that converts to a failed `result` holding `error`.
+ *
+ * @code
+ * dispatch_queue::result<int> parse(const std::string& text) {
+ *     if (text.empty()) {
+ *         return dispatch_queue::failure(std::make_error_code(std::errc::invalid_argument));
+ *     }
+ *     return std::stoi(text);
+ * }
+ * @endcode
+ */
+template<typename E>
+result_failure<typename std::decay<E>::type> failure(E&& error) {
+	return { std::forward<E>(error) };
+}
+
+template<typename T, typename E>
+class result;
+
+namespace detail {
+
+template<typename T>
+struct is_result : std::false_type {};
+
+template<typename T, typename E>
+struct is_result<result<T, E>> : std::true_type {};
+
+} // end namespace detail
+
+/**
+ * Either a value of type `T` or an error of type `E`, like C++23's `std::expected`.
+ *
+ * Tasks returning `result`s report failures by value: no exception is thrown, captured or allocated,
+ * and failures can be reported when compiling with `-fno-exceptions`.
+ * Use `task<result<T, E>>::and_then` and `map` for continuations that only run on success,
+ * and `when_all` for joining tasks, propagating the first error.
+ */
+template<typename T, typename E = std::error_code>
+class result {
+public:
+	using value_type = T;
+	using error_type = E;
+
+	result(const T& value) : has_value_flag(true) {
+		new (&stored_value) T(value);
+	}
+	result(T&& value) : has_value_flag(true) {
+		new (&stored_value) T(std::move(value));
+	}
+	template<typename G>
+	result(result_failure<G> failure) : has_value_flag(false) {
+		new (&stored_error) E(std::move(failure.error));
+	}
+
+	result(const result& other) : has_value_flag(other.has_value_flag) {
+		if (has_value_flag) {
+			new (&stored_value) T(other.stored_value);
+		}
+		else {
+			new (&stored_error) E(other.stored_error);
+		}
+	}
+	result(result&& other) noexcept(std::is_nothrow_move_constructible<T>::value && std::is_nothrow_move_constructible<E>::value)
+		: has_value_flag(other.has_value_flag)
+	{
+		if (has_value_flag) {
+			new (&stored_value) T(std::move(other.stored_value));
+		}
+		else {
+			new (&stored_error) E(std::move(other.stored_error));
+		}
+	}
+	/// If copying throws, the result keeps its previous value or error.
+	result& operator=(const result& other) {
+		if (has_value_flag && other.has_value_flag) {
+			stored_value = other.stored_value;
+		}
+		else if (!has_value_flag && !other.has_value_flag) {
+			stored_error = other.stored_error;
+		}
+		else if (other.has_value_flag) {
+			replace(stored_error, stored_value, other.stored_value);
+		}
+		else {
+			replace(stored_value, stored_error, other.stored_error);
+		}
+		return *this;
+	}
+	/// If moving throws, the result keeps its previous value or error.
+	result& operator=(result&& other) noexcept(
+		std::is_nothrow_move_constructible<T>::value && std::is_nothrow_move_assignable<T>::value
+		&& std::is_nothrow_move_constructible<E>::value && std::is_nothrow_move_assignable<E>::value)
+	{
+		if (has_value_flag && other.has_value_flag) {
+			stored_value = std::move(other.stored_value);
+		}
+		else if (!has_value_flag && !other.has_value_flag) {
+			stored_error = std::move(other.stored_error);
+		}
+		else if (other.has_value_flag) {
+			replace(stored_error, stored_value, std::move(other.stored_value));
+		}
+		else {
+			replace(stored_value, stored_error, std::move(other.stored_error));
+		}
+		return *this;
+	}
+	~result() {
+		destroy();
+	}
+
+	bool has_value() const {
+		return has_value_flag;
+	}
+	explicit operator bool() const {
+		return has_value_flag;
+	}
+
+	/// Returns the value. The result must have a value.
+	T& value() & {
+		assert(has_value_flag);
+		return stored_value;
+	}
+	/// @copydoc value()
+	const T& value() const& {
+		assert(has_value_flag);
+		return stored_value;
+	}
+	/// @copydoc value()
+	T&& value() && {
+		assert(has_value_flag);
+		return std::move(stored_value);
+	}
+	T& operator*() & { return value(); }
+	const T& operator*() const& { return value(); }
+	T *operator->() { return &value(); }
+	const T *operator->() const { return &value(); }
+
+	/// Returns the error. The result must not have a value.
+	const E& error() const {
+		assert(!has_value_flag);
+		return stored_error;
+	}
+
+	/// Returns the value, or `default_value` if the result has an error.
+	template<typename U>
+	T value_or(U&& default_value) const& {
+		return has_value_flag ? stored_value : static_cast<T>(std::forward<U>(default_value));
+	}
+
+	/**
+	 * Returns `f(value())` if the result has a value, otherwise the same error.
+	 * `f` must return a `result` with the same error type.
+	 */
+	template<typename F>
+	auto and_then(F&& f) const& -> decltype(f(std::declval<const T&>())) {
+		using next_result = decltype(f(std::declval<const T&>()));
+		static_assert(detail::is_result<next_result>::value, "and_then must return a result");
+		if (has_value_flag) {
+			return f(stored_value);
+		}
+		return next_result(result_failure<E> { stored_error });
+	}
+
+	/**
+	 * Returns a result holding `f(value())` if the result has a value, otherwise the same error.
+	 */
+	template<typename F>
+	auto map(F&& f) const& -> result<decltype(f(std::declval<const T&>())), E> {
+		using mapped_result = result<decltype(f(std::declval<const T&>())), E>;
+		if (has_value_flag) {
+			return mapped_result(f(stored_value));
+		}
+		return mapped_result(result_failure<E> { stored_error });
+	}
+
+private:
+	bool has_value_flag;
+	union {
+		T stored_value;
+		E stored_error;
+	};
+
+	void destroy() {
+		if (has_value_flag) {
+			stored_value.~T();
+		}
+		else {
+			stored_error.~E();
+		}
+	}
+
+	/// Replace the `current` alternative with a `Next` constructed from `source`, like `std::expected`:
+	/// the result keeps `current` if construction throws.
+	template<typename Current, typename Next, typename Source>
+	void replace(Current& current, Next& next, Source&& source) {
+		using strategy = std::integral_constant<int,
+			std::is_nothrow_constructible<Next, Source&&>::value ? 0
+			: std::is_nothrow_move_constructible<Next>::value ? 1
+			: 2>;
+		replace(current, next, std::forward<Source>(source), strategy());
+		has_value_flag = !has_value_flag;
+	}
+	/// Construction does not throw
+	template<typename Current, typename Next, typename Source>
+	static void replace(Current& current, Next& next, Source&& source, std::integral_constant<int, 0>) {
+		current.~Current();
+		new (&next) Next(std::forward<Source>(source));
+	}
+	/// Construct a temporary first, since moving it does not throw
+	template<typename Current, typename Next, typename Source>
+	static void replace(Current& current, Next& next, Source&& source, std::integral_constant<int, 1>) {
+		Next temporary(std::forward<Source>(source));
+		current.~Current();
+		new (&next) Next(std::move(temporary));
+	}
+	/// Back up the current alternative, restoring it if construction throws
+	template<typename Current, typename Next, typename Source>
+	static void replace(Current& current, Next& next, Source&& source, std::integral_constant<int, 2>) {
+		static_assert(std::is_nothrow_move_constructible<Current>::value, "result assignment requires T or E to be nothrow move constructible");
+		Current backup(std::move(current));
+		current.~Current();
+#ifdef __cpp_exceptions
+		try {
+			new (&next) Next(std::forward<Source>(source));
+		}
+		catch (...) {
+			new (&current) Current(std::move(backup));
+			throw;
+		}
+#else
+		new (&next) Next(std::forward<Source>(source));
+#endif
+	}
+};
+
+/**
+ * Success without a value, or an error of type `E`.
+ */
+template<typename E>
+class result<void, E> {
+public:
+	using value_type = void;
+	using error_type = E;
+
+	result() : has_value_flag(true), stored_error() {}
+	template<typename G>
+	result(result_failure<G> failure) : has_value_flag(false), stored_error(std::move(failure.error)) {}
+
+	bool has_value() const {
+		return has_value_flag;
+	}
+	explicit operator bool() const {
+		return has_value_flag;
+	}
+
+	/// Does nothing, for symmetry with results that hold values. The result must not have an error.
+	void value() const {
+		assert(has_value_flag);
+	}
+
+	/// Returns the error. The result must not have a value.
+	const E& error() const {
+		assert(!has_value_flag);
+		return stored_error;
+	}
+
+	/// Returns `f()` if the result succeeded, otherwise the same error.
+	template<typename F>
+	auto and_then(F&& f) const -> decltype(f()) {
+		using next_result = decltype(f());
+		static_assert(detail::is_result<next_result>::value, "and_then must return a result");
+		if (has_value_flag) {
+			return f();
+		}
+		return next_result(result_failure<E> { stored_error });
+	}
+
+	/// Returns a result holding `f()` if the result succeeded, otherwise the same error.
+	template<typename F>
+	auto map(F&& f) const -> result<decltype(f()), E> {
+		using mapped_result = result<decltype(f()), E>;
+		if (has_value_flag) {
+			return mapped_result(f());
+		}
+		return mapped_result(result_failure<E> { stored_error });
+	}
+
+private:
+	bool has_value_flag;
+	E stored_error;
+};
+
+} // end namespace dispatch_queue
@@ -0,0 +1,120 @@
+#pragma once
+
+#ifdef __has_include
+	#if __has_include(<version>)
+		#include <version>
+	#endif
+#endif
+
+#include <cstddef>
+
+#ifdef __cpp_lib_memory_resource
+#include <memory_resource>
+#endif
+
+namespace dispatch_queue {
+
+/**
+ * Monotonic bump-pointer allocator for temporary memory, owned by a single thread.
+ *
+ * Allocating only moves a pointer forward, without any synchronization.
+ * Memory is never freed individually: `reset` makes all of it available again at once.
+ * When a chunk runs out, a larger one is allocated, and `reset` merges chunks so that
+ * the next cycle fits in a single chunk.
+ *
+ * Destructors of objects placed in the arena are not called.
+ *
+ * @see this_worker::arena
+ */
+class scratch_arena {
+public:
+	/**
+	 * @param initial_capacity Size of the first chunk, allocated on the first call to `allocate`.
+	 */
+	explicit scratch_arena(size_t initial_capacity = 64 * 1024);
+	~scratch_arena();
+
+	scratch_arena(const scratch_arena&) = delete;
+	scratch_arena& operator=(const scratch_arena&) = delete;
+
+	/**
+	 * Allocate `size` bytes aligned to `alignment`, which must be a power of two.
+	 * The memory stays valid until the next `reset`.
+	 */
+	void *allocate(size_t size, size_t alignment = alignof(std::max_align_t));
+
+	/**
+	 * Allocate uninitialized memory for `count` objects of type `T`.
+	 */
+	template<typename T>
+	T *allocate_array(size_t count) {
+		return static_cast<T *>(allocate(sizeof(T) * count, alignof(T)));
+	}
+
+	/**
+	 * Make all allocated memory available again, invalidating previous allocations.
+	 */
+	void reset();
+
+	/**
+	 * Returns the number of bytes allocated since the last `reset`, not counting alignment padding.
+	 */
+	size_t used() const;
+
+	/**
+	 * Returns the total size of the arena's chunks.
+	 */
+	size_t capacity() const;
+
+private:
+	struct chunk_header {
+		chunk_header *previous;
+		size_t size;
+	};
+
+	chunk_header *current_chunk = nullptr;
+	char *cursor = nullptr;
+	char *end = nullptr;
+	size_t initial_capacity;
+	size_t used_bytes = 0;
+	size_t total_capacity = 0;
+
+	void add_chunk(size_t min_size);
+	void free_chunks();
+};
+
+#ifdef __cpp_lib_memory_resource
+/**
+ * `std::pmr::memory_resource` that allocates from a `scratch_arena`, so that STL containers can use it.
+ * Deallocation is a no-op, memory is reclaimed by `scratch_arena::reset`.
+ *
+ * @code
+ * dispatch_queue::scratch_arena_resource resource(arena);
+ * std::pmr::vector<int> values(&resource);
+ * @endcode
+ */
+class scratch_arena_resource : public std::pmr::memory_resource {
+public:
+	explicit scratch_arena_resource(scratch_arena& arena) : arena(arena) {}
+
+	scratch_arena& get_arena() const {
+		return arena;
+	}
+
+protected:
+	void *do_allocate(size_t bytes, size_t alignment) override {
+		return arena.allocate(bytes, alignment);
+	}
+
+	void do_deallocate(void *, size_t, size_t) override {}
+
+	bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override {
+		return this == &other;
+	}
+
+private:
+	scratch_arena& arena;
+};
+#endif
+
+} // end namespace dispatch_queue
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <memory>
+#include <thread>
+#include <utility>
+
+#include "worker_options.hpp"
+#include "worker_pool.hpp"
+
+namespace dispatch_queue {
+
+/**
+ * Pool of worker threads that may be shared by several dispatch queues.
+ *
+ * Each dispatch queue created over a shared pool has its own task queue, `wait`, `clear` and `size`,
+ * while workers pick tasks from all queues in weighted round-robin order.
+ * This avoids oversubscribing the CPU when many subsystems create their own dispatch queues.
+ * Creating a dispatch queue over an existing pool does not spawn threads.
+ *
+ * Threads are stopped when the pool and all dispatch queues using it are destroyed.
+ *
+ * @code
+ * dispatch_queue::dispatch_queue physics(dispatch_queue::shared_pool::global(), 2);
+ * dispatch_queue::dispatch_queue audio(dispatch_queue::shared_pool::global());
+ * @endcode
+ */
+class shared_pool {
+public:
+	/**
+	 * Initializes pool with `thread_count` threads and a no-op `worker_init`.
+	 * @see shared_pool(int, Fn&&)
+	 */
+	explicit shared_pool(int thread_count = -1);
+
+	/**
+	 * Initializes pool with `thread_count` threads and a worker initialization functor.
+	 *
+	 * @param thread_count  Number of background threads used to run tasks, at least 1.
+	 *                      Pass a negative number to use the default value of `std::thread::hardware_concurrency()` threads.
+	 * @param worker_init  Functor called inside worker threads for initialization, receiving as argument the worker index.
+	 */
+	template<typename Fn>
+	shared_pool(int thread_count, Fn&& worker_init)
+		: shared_pool(thread_count, worker_options(), std::forward<Fn>(worker_init))
+	{
+	}
+
+	/**
+	 * Initializes pool with `thread_count` threads created with `options` and a no-op `worker_init`.
+	 * @see shared_pool(int, worker_options, Fn&&)
+	 */
+	shared_pool(int thread_count, worker_options options);
+
+	/**
+	 * Initializes pool with `thread_count` threads created with `options` and a worker initialization functor.
+	 *
+	 * @param thread_count  Number of background threads used to run tasks, see `shared_pool(int, Fn&&)`.
+	 * @param options  Name, stack size and scheduling of worker threads, applied before `worker_init` runs.
+	 * @param worker_init  Functor called inside worker threads for initialization, receiving as argument the worker index.
+	 */
+	template<typename Fn>
+	shared_pool(int thread_count, worker_options options, Fn&& worker_init) {
+		if (thread_count < 0) {
+			thread_count = std::thread::hardware_concurrency();
+		}
+		pool = detail::worker_pool::create(thread_count > 0 ? thread_count : 1, std::forward<Fn>(worker_init), std::move(options));
+	}
+
+	/**
+	 * Process-wide pool with `std::thread::hardware_concurrency()` threads, created on first use.
+	 */
+	static shared_pool& global();
+
+	/**
+	 * Returns the number of worker threads.
+	 */
+	int thread_count() const;
+
+private:
+	std::shared_ptr<detail::worker_pool> pool;
+
+	friend class dispatch_queue;
+};
+
+} // end namespace dispatch_queue
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+#include "queue_stats.hpp"
+
+namespace dispatch_queue {
+
+namespace detail {
+
+/// Relaxed increment for counters that have a single writer thread, avoiding a locked read-modify-write.
+inline void add_relaxed(std::atomic<uint64_t>& counter, uint64_t value) {
+	counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+/**
+ * Statistics written only by their worker thread.
+ * Aligned to cache lines so that workers don't contend with each other.
+ */
+struct alignas(64) worker_stats_counters {
+	std::atomic<uint64_t> completed {};
+	std::atomic<uint64_t> failed {};
+	std::atomic<uint64_t> busy_nanoseconds {};
+	std::atomic<uint64_t> idle_nanoseconds {};
+	std::array<std::atomic<uint64_t>, duration_histogram::bucket_count> wait_time_buckets {};
+	std::array<std::atomic<uint64_t>, duration_histogram::bucket_count> run_time_buckets {};
+
+	void record_idle(std::chrono::nanoseconds idle_time);
+	void record_wait(std::chrono::nanoseconds wait_time);
+	void record_run(std::chrono::nanoseconds run_time, bool succeeded);
+
+	void reset();
+	void add_to(pool_stats& stats) const;
+};
+
+} // end namespace detail
+
+} // end namespace dispatch_queue
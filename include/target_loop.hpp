@@ -0,0 +1,105 @@
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <string>
+
+#include "loop_queue.hpp"
+
+namespace dispatch_queue {
+
+class dispatch_queue;
+
+/**
+ * Handle to a loop owned by a user thread, like the dispatch queue's main loop.
+ *
+ * Tasks dispatched to a target loop with `dispatch_queue::dispatch_to` only run when the owning thread calls `run`.
+ * Each target loop has its own queue and wakeup event, independent of the dispatch queue's worker threads.
+ *
+ * Target loops are cheap to copy, copies refer to the same loop.
+ * All methods are thread-safe.
+ */
+class target_loop {
+public:
+	target_loop() = default;
+
+	/**
+	 * Checks if the handle refers to a loop.
+	 */
+	bool valid() const;
+
+	/**
+	 * Name passed to `dispatch_queue::create_loop`.
+	 */
+	const std::string& name() const;
+
+	/**
+	 * Returns the number of queued tasks.
+	 */
+	size_t size() const;
+
+	/**
+	 * Returns whether there are no tasks queued.
+	 */
+	bool empty() const;
+
+	/**
+	 * Cancel pending tasks.
+	 */
+	void clear();
+
+	/**
+	 * Invoke tasks dispatched to this loop.
+	 * This should be called by the thread that owns the loop.
+	 */
+	void run();
+
+	/**
+	 * Returns a file descriptor that becomes readable while there are tasks queued.
+	 * The descriptor is reset by `run`, so do not read from or close it.
+	 * This is only supported on Linux, other platforms return -1.
+	 */
+	int fd() const;
+
+	/**
+	 * Wait until there are tasks queued.
+	 * Tasks are not executed, call `run` afterwards to run them.
+	 */
+	void wait();
+
+	/**
+	 * Wait until there are tasks queued.
+	 * Blocks until specified `timeout_duration` has elapsed or tasks are queued, whichever comes first.
+	 * @returns `true` if there are tasks queued, otherwise `false`.
+	 */
+	template<class Rep, class Period>
+	bool wait_for(const std::chrono::duration<Rep, Period>& timeout_duration) {
+		return queue->event().wait_for(std::chrono::duration_cast<std::chrono::nanoseconds>(timeout_duration));
+	}
+
+	/**
+	 * Wait until there are tasks queued.
+	 * Blocks until the specified `timeout_time` has been reached or tasks are queued, whichever comes first.
+	 * @returns `true` if there are tasks queued, otherwise `false`.
+	 */
+	template<class Clock, class Duration>
+	bool wait_until(const std::chrono::time_point<Clock, Duration>& timeout_time) {
+		return queue->event().wait_until(timeout_time);
+	}
+
+	bool operator==(const target_loop& other) const {
+		return queue == other.queue;
+	}
+	bool operator!=(const target_loop& other) const {
+		return queue != other.queue;
+	}
+
+private:
+	std::shared_ptr<detail::loop_queue> queue;
+
+	target_loop(std::string&& name);
+
+	friend class dispatch_queue;
+};
+
+} // end namespace dispatch_queue
@@ -1,11 +1,18 @@
 #pragma once
 
+#ifdef __has_include
+	#if __has_include(<version>)
+		#include <version>
+	#endif
+#endif
+
 #ifdef __cpp_lib_coroutine
 #include <coroutine>
 #endif
 
 #include "function_result.hpp"
 #include "is_instance_of.hpp"
+#include "result.hpp"
 #include "task_future.hpp"
 
 namespace dispatch_queue {
@@ -36,6 +43,16 @@ public:
 		return (bool)future;
 	}
 
+	/**
+	 * Checks if both tasks refer to the same shared state.
+	 */
+	bool operator==(const task& other) const {
+		return future == other.future;
+	}
+	bool operator!=(const task& other) const {
+		return future != other.future;
+	}
+
 #ifdef __cpp_concepts
 	/**
 	 * Add a continuation `f` that is guaranteed to run after this task finishes.
@@ -71,10 +88,39 @@ public:
 		}));
 	}
 
+	/**
+	 * Add a continuation for tasks returning a `result`, that calls `f` with the result's value only if it has one.
+	 * `f` must return a `result` with the same error type. Otherwise, the continuation's result holds the same error,
+	 * without throwing or calling `f`.
+	 *
+	 * @code
+	 * dispatch_queue::task<dispatch_queue::result<record>> validated = dispatch_queue.dispatch(parse, line)
+	 *     .and_then([](const row& r) { return validate(r); });
+	 * @endcode
+	 */
+	template<typename F, typename U = T, typename = std::enable_if_t<detail::is_result<U>::value>>
+	auto and_then(F&& f) const {
+		return then([f](const task& finished) {
+			return finished.get().and_then(f);
+		});
+	}
+
+	/**
+	 * Add a continuation for tasks returning a `result`, whose result holds `f` called with the value if there is one,
+	 * or the same error otherwise, without calling `f`.
+	 */
+	template<typename F, typename U = T, typename = std::enable_if_t<detail::is_result<U>::value>>
+	auto map(F&& f) const {
+		return then([f](const task& finished) {
+			return finished.get().map(f);
+		});
+	}
+
 	/**
 	 * Waits until the task's value is ready (by calling `wait`), then returns the stored value.
 	 *
 	 * If the task failed with an exception, rethrows the exception instead.
+	 * If the task failed with an error code, throws it as `std::system_error`.
 	 */
 	T get() const {
 		return future->get();
@@ -94,6 +140,13 @@ public:
 		return future->get_exception();
 	}
 
+	/**
+	 * Returns the error code the task failed with, if it failed without an exception.
+	 */
+	std::error_code get_error() const {
+		return future->get_error();
+	}
+
 	/**
 	 * Waits until the task is either ready or failed with an exception.
 	 *
@@ -144,9 +197,6 @@ private:
 		void await_suspend(std::coroutine_handle<> cont) const {
 			t.future->then([cont]{
 				cont();
-				if (cont.done()) {
-					cont.destroy();
-				}
 			});
 		}
 
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <system_error>
+#include <unordered_map>
+#include <utility>
+
+#include "dispatch_queue.hpp"
+
+namespace dispatch_queue {
+
+namespace detail {
+
+/**
+ * Work of a cached task, which fails the task with `std::errc::operation_canceled` if destroyed without running,
+ * so that tasks dropped by `dispatch_queue::clear` or `shutdown` don't stay pending in the cache.
+ */
+template<typename T, typename F>
+class cached_work {
+public:
+	cached_work(std::shared_ptr<task_future<T>> future, F&& work)
+		: future(std::move(future))
+		, work(std::move(work))
+	{
+	}
+	cached_work(cached_work&&) = default;
+	cached_work& operator=(cached_work&&) = delete;
+
+	~cached_work() {
+		if (future) {
+			future->set_error(std::make_error_code(std::errc::operation_canceled));
+		}
+	}
+
+	bool operator()() {
+		auto ran_future = std::move(future);
+		return ran_future->do_work(work);
+	}
+
+private:
+	std::shared_ptr<task_future<T>> future;
+	F work;
+};
+
+} // end namespace detail
+
+/**
+ * Single-flight memoization of task results by key.
+ *
+ * The first request for a key dispatches the work, while concurrent and later requests return the same `task<T>`,
+ * so all waiters and continuations share a single result.
+ * Failed tasks are not kept: the next request for their key dispatches the work again.
+ * Tasks discarded by `dispatch_queue::clear` or `shutdown` before running fail with `std::errc::operation_canceled`.
+ *
+ * When a capacity is set, the least recently used entries are evicted once the cache is full.
+ * Evicting or invalidating an entry only removes it from the cache: tasks already returned still complete normally.
+ *
+ * @code
+ * dispatch_queue::task_cache<std::string, texture> textures(64);
+ * auto texture = textures.get_or_dispatch(dispatch_queue, path, load_texture, path);
+ * @endcode
+ */
+template<typename Key, typename T, typename Hash = std::hash<Key>, typename KeyEqual = std::equal_to<Key>>
+class task_cache {
+public:
+	/**
+	 * @param capacity Maximum number of entries, or 0 for an unbounded cache.
+	 */
+	explicit task_cache(size_t capacity = 0)
+		: max_size(capacity)
+	{
+	}
+
+	task_cache(const task_cache&) = delete;
+	task_cache& operator=(const task_cache&) = delete;
+
+	/**
+	 * Returns the cached task for `key`, or dispatches a task that calls `f` with forwarded arguments `args` to `queue`
+	 * and caches it if `key` is not cached or its task failed.
+	 */
+	template<typename F, typename... Args>
+	task<T> get_or_dispatch(dispatch_queue& queue, const Key& key, F&& f, Args&&... args) {
+		std::shared_ptr<detail::task_future<T>> future;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			auto it = entries.find(key);
+			if (it != entries.end()) {
+				if (it->second.result.get_state() != task_state::failed) {
+					lru.splice(lru.begin(), lru, it->second.lru_position);
+					return it->second.result;
+				}
+				lru.erase(it->second.lru_position);
+				entries.erase(it);
+			}
+			future = detail::task_future<T>::create_pending();
+			it = entries.emplace(key, entry { task<T>(future), {} }).first;
+			lru.push_front(&it->first);
+			it->second.lru_position = lru.begin();
+			evict_excess();
+		}
+		// Dispatch outside the lock, immediate queues run the work right away
+		auto work = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+		queue.post(detail::make_copyable(detail::cached_work<T, decltype(work)>(future, std::move(work))));
+		return task<T>(future);
+	}
+
+	/**
+	 * Returns the cached task for `key`, or an invalid task if `key` is not cached.
+	 */
+	task<T> find(const Key& key) {
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = entries.find(key);
+		if (it == entries.end()) {
+			return task<T>();
+		}
+		lru.splice(lru.begin(), lru, it->second.lru_position);
+		return it->second.result;
+	}
+
+	/**
+	 * Remove `key` from the cache, so that the next request dispatches the work again.
+	 * @returns Whether `key` was cached.
+	 */
+	bool invalidate(const Key& key) {
+		std::lock_guard<std::mutex> lock(mutex);
+		auto it = entries.find(key);
+		if (it == entries.end()) {
+			return false;
+		}
+		lru.erase(it->second.lru_position);
+		entries.erase(it);
+		return true;
+	}
+
+	/**
+	 * Remove all entries from the cache.
+	 */
+	void clear() {
+		std::lock_guard<std::mutex> lock(mutex);
+		lru.clear();
+		entries.clear();
+	}
+
+	/**
+	 * Returns the number of cached entries, including in-flight ones.
+	 */
+	size_t size() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return entries.size();
+	}
+
+	/**
+	 * Returns the maximum number of entries, or 0 for an unbounded cache.
+	 */
+	size_t capacity() const {
+		std::lock_guard<std::mutex> lock(mutex);
+		return max_size;
+	}
+
+	/**
+	 * Change the maximum number of entries, evicting the least recently used ones if needed.
+	 * @param capacity Maximum number of entries, or 0 for an unbounded cache.
+	 */
+	void set_capacity(size_t capacity) {
+		std::lock_guard<std::mutex> lock(mutex);
+		max_size = capacity;
+		evict_excess();
+	}
+
+private:
+	struct entry {
+		task<T> result;
+		typename std::list<const Key *>::iterator lru_position;
+	};
+
+	mutable std::mutex mutex;
+	std::unordered_map<Key, entry, Hash, KeyEqual> entries;
+	/// Keys from most to least recently used, pointing to keys stored in `entries`
+	std::list<const Key *> lru;
+	size_t max_size;
+
+	void evict_excess() {
+		while (max_size > 0 && entries.size() > max_size) {
+			const Key *least_recently_used = lru.back();
+			lru.pop_back();
+			entries.erase(*least_recently_used);
+		}
+	}
+};
+
+} // end namespace dispatch_queue
@@ -1,13 +1,16 @@
 #pragma once
 
 #include <condition_variable>
+#include <cstdlib>
 #include <exception>
 #include <functional>
 #include <memory>
 #include <mutex>
+#include <system_error>
 #include <vector>
 
 #include "function_result.hpp"
+#include "trace_recorder.hpp"
 
 namespace dispatch_queue {
 
@@ -16,7 +19,7 @@ enum class task_state {
 	pending,
 	/// Task finished successfully and the result value is readily available
 	ready,
-	/// Task failed with an exception
+	/// Task failed with an exception or an error code
 	failed,
 };
 
@@ -30,10 +33,24 @@ namespace detail {
 	#define DISPATCH_QUEUE_CATCH(...) if (0)
 #endif
 
+/**
+ * Returns the tasks batched by the calling worker thread to their queue, so that other workers may run them.
+ * Called before the thread blocks, since it could be waiting for one of them.
+ */
+void release_worker_batch();
+
 class task_future_base {
 	auto wait_predicate() {
 		return [this]{ return state != task_state::pending; };
 	}
+	/// Releases the calling worker's batched tasks if waiting on `lock` would block
+	void prepare_to_block(std::unique_lock<std::mutex>& lock) {
+		if (state == task_state::pending) {
+			lock.unlock();
+			release_worker_batch();
+			lock.lock();
+		}
+	}
 public:
 	task_state get_state() {
 		std::lock_guard<std::mutex> lock(mutex);
@@ -45,29 +62,43 @@ public:
 		return exception;
 	}
 
+	std::error_code get_error() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return error;
+	}
+
 	void set_exception(std::exception_ptr exception) {
-		{
-			std::lock_guard<std::mutex> lock(mutex);
-			state = task_state::failed;
-			this->exception = exception;
-		}
-		condition_variable.notify_all();
+		std::unique_lock<std::mutex> lock(mutex);
+		state = task_state::failed;
+		this->exception = exception;
+		finish(lock);
+	}
+
+	/// Fail without an exception, which does not allocate and works with `-fno-exceptions`.
+	void set_error(std::error_code error) {
+		std::unique_lock<std::mutex> lock(mutex);
+		state = task_state::failed;
+		this->error = error;
+		finish(lock);
 	}
 
 	void wait() {
 		std::unique_lock<std::mutex> lock(mutex);
+		prepare_to_block(lock);
 		condition_variable.wait(lock, wait_predicate());
 	}
 
 	template<class Rep, class Period>
 	bool wait_for(const std::chrono::duration<Rep, Period>& timeout_duration) {
 		std::unique_lock<std::mutex> lock(mutex);
+		prepare_to_block(lock);
 		return condition_variable.wait_for(lock, timeout_duration, wait_predicate());
 	}
 
 	template<class Clock, class Duration>
 	bool wait_until(const std::chrono::time_point<Clock, Duration>& timeout_time) {
 		std::unique_lock<std::mutex> lock(mutex);
+		prepare_to_block(lock);
 		return condition_variable.wait_until(lock, timeout_time, wait_predicate());
 	}
 
@@ -75,7 +106,9 @@ protected:
 	std::mutex mutex;
 	std::condition_variable condition_variable;
 	std::exception_ptr exception;
+	std::error_code error;
 	task_state state;
+	std::vector<std::function<void()>> continuations;
 
 	struct private_construct {};
 
@@ -84,13 +117,44 @@ protected:
 	{
 	}
 	task_future_base(private_construct, std::exception_ptr exception)
-		: state(task_state::failed)
-		, exception(exception)
+		: exception(exception)
+		, state(task_state::failed)
+	{
+	}
+	task_future_base(private_construct, std::error_code error)
+		: error(error)
+		, state(task_state::failed)
 	{
 	}
 
 	task_future_base(const task_future_base&) = delete;
 	task_future_base& operator=(const task_future_base&) = delete;
+
+	/// Rethrow the failure of a failed task: its exception, or its error code as `std::system_error`.
+	/// Without exception support, error codes abort instead.
+	[[noreturn]] void rethrow_failure() {
+		if (exception) {
+			std::rethrow_exception(exception);
+		}
+#ifdef __cpp_exceptions
+		throw std::system_error(error);
+#else
+		std::abort();
+#endif
+	}
+
+	/// Wake waiters and run continuations after state was set with `lock` held.
+	void finish(std::unique_lock<std::mutex>& lock) {
+		auto continuations = std::move(this->continuations);
+		lock.unlock();
+		condition_variable.notify_all();
+		if (!continuations.empty()) {
+			trace_recorder::record_continuations(continuations.size());
+		}
+		for (auto&& continuation : continuations) {
+			continuation();
+		}
+	}
 };
 
 
@@ -126,6 +190,9 @@ public:
 	static std::shared_ptr<task_future> create_failed(std::exception_ptr exception) {
 		return std::make_shared<task_future>(private_construct{}, exception);
 	}
+	static std::shared_ptr<task_future> create_failed(std::error_code error) {
+		return std::make_shared<task_future>(private_construct{}, error);
+	}
 	template<typename F>
 	static std::shared_ptr<task_future> create(F&& work) {
 		DISPATCH_QUEUE_TRY {
@@ -155,47 +222,42 @@ public:
 
 	T get() {
 		wait();
-		if (exception) {
-			std::rethrow_exception(exception);
+		if (state == task_state::failed) {
+			rethrow_failure();
 		}
 		return value;
 	}
 
+	/// Runs `work`, storing its result. Returns whether `work` succeeded.
 	template<typename F, typename... Args>
-	void do_work(F&& work, Args&&... args) {
+	bool do_work(F&& work, Args&&... args) {
 		DISPATCH_QUEUE_TRY {
 			auto value = work(std::forward<Args>(args)...);
 			set_value(std::move(value));
+			return true;
 		}
 		DISPATCH_QUEUE_CATCH(...) {
 			set_exception(std::current_exception());
-		}
-
-		auto continuations = std::move(this->continuations);
-		for (auto&& continuation : continuations) {
-			continuation();
+			return false;
 		}
 	}
 
 	template<typename F>
 	auto wrap(F&& work) {
 		auto shared_this = this->shared_from_this();
-		return [shared_this, work]{
-			shared_this->do_work(work);
+		return [shared_this, work = std::forward<F>(work)]{
+			return shared_this->do_work(work);
 		};
 	}
 
 	void set_value(T&& value) {
-		{
-			std::lock_guard<std::mutex> lock(mutex);
-			state = task_state::ready;
-			this->value = std::move(value);
-		}
-		condition_variable.notify_all();
+		std::unique_lock<std::mutex> lock(mutex);
+		state = task_state::ready;
+		new (&this->value) T(std::move(value));
+		finish(lock);
 	}
 
 private:
-	std::vector<std::function<void()>> continuations;
 	union {
 		struct{} empty;
 		T value;
@@ -223,6 +285,9 @@ public:
 	static std::shared_ptr<task_future> create_failed(std::exception_ptr exception) {
 		return std::make_shared<task_future>(private_construct{}, exception);
 	}
+	static std::shared_ptr<task_future> create_failed(std::error_code error) {
+		return std::make_shared<task_future>(private_construct{}, error);
+	}
 	template<typename F>
 	static std::shared_ptr<task_future> create(F&& work) {
 		DISPATCH_QUEUE_TRY {
@@ -252,45 +317,38 @@ public:
 
 	void get() {
 		wait();
-		if (exception) {
-			std::rethrow_exception(exception);
+		if (state == task_state::failed) {
+			rethrow_failure();
 		}
 	}
 
+	/// Runs `work`, storing its result. Returns whether `work` succeeded.
 	template<typename F, typename... Args>
-	void do_work(F&& work, Args&&... args) {
+	bool do_work(F&& work, Args&&... args) {
 		DISPATCH_QUEUE_TRY {
 			work(std::forward<Args>(args)...);
 			set_value();
+			return true;
 		}
 		DISPATCH_QUEUE_CATCH(...) {
 			set_exception(std::current_exception());
-		}
-
-		auto continuations = std::move(this->continuations);
-		for (auto&& continuation : continuations) {
-			continuation();
+			return false;
 		}
 	}
 
 	template<typename F>
 	auto wrap(F&& work) {
 		auto shared_this = this->shared_from_this();
-		return [shared_this, work]{
-			shared_this->do_work(work);
+		return [shared_this, work = std::forward<F>(work)]{
+			return shared_this->do_work(work);
 		};
 	}
 
 	void set_value() {
-		{
-			std::lock_guard<std::mutex> lock(mutex);
-			state = task_state::ready;
-		}
-		condition_variable.notify_all();
+		std::unique_lock<std::mutex> lock(mutex);
+		state = task_state::ready;
+		finish(lock);
 	}
-
-private:
-	std::vector<std::function<void()>> continuations;
 };
 
 } // end namespace detail
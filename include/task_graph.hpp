@@ -0,0 +1,129 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace dispatch_queue {
+
+class dispatch_queue;
+
+/**
+ * Directed acyclic graph of tasks, built once and executed repeatedly on a dispatch queue.
+ *
+ * Each node keeps an atomic counter of unfinished predecessors, reset at the start of each run.
+ * When a node finishes, successors whose counter reaches zero are posted directly to the queue,
+ * without allocating a future or continuation per edge, so running an already built graph does not allocate.
+ *
+ * Nodes and edges must not be changed while the graph is running.
+ *
+ * @code
+ * dispatch_queue::task_graph graph;
+ * auto load = graph.add_node(load_assets);
+ * auto physics = graph.add_node(update_physics);
+ * auto render = graph.add_node(render_frame);
+ * graph.add_edge(load, render);
+ * graph.add_edge(physics, render);
+ * while (running) {
+ *     graph.run(dispatch_queue);
+ * }
+ * @endcode
+ */
+class task_graph {
+public:
+	using node_id = size_t;
+
+	/**
+	 * Node execution times of the last run, relative to the start of the run.
+	 */
+	struct node_timing {
+		std::chrono::nanoseconds start;
+		std::chrono::nanoseconds finish;
+
+		std::chrono::nanoseconds duration() const {
+			return finish - start;
+		}
+	};
+
+	task_graph() = default;
+	task_graph(const task_graph&) = delete;
+	task_graph& operator=(const task_graph&) = delete;
+
+	/**
+	 * Add a node that runs `work`.
+	 * @param work Functor to be executed every time the graph runs
+	 * @param label Static name for the node, shown in traces
+	 * @returns Identifier for the node, used to add edges and query timings
+	 */
+	node_id add_node(std::function<void()> work, const char *label = nullptr);
+
+	/**
+	 * Add an edge so that `after` only runs once `before` has finished.
+	 */
+	void add_edge(node_id before, node_id after);
+
+	/**
+	 * Returns the number of nodes.
+	 */
+	size_t node_count() const;
+
+	/**
+	 * Returns the static name passed to `add_node`.
+	 */
+	const char *label(node_id node) const;
+
+	/**
+	 * Run all nodes in dependency order on `queue`, blocking until they all finish.
+	 *
+	 * Do not call this from a task running in `queue` if all of its threads may be blocked waiting.
+	 * If any node throws an exception, its successors still run and the first exception is rethrown after all nodes finish.
+	 *
+	 * @returns `false` if the graph contains a cycle, in which case no nodes run, otherwise `true`.
+	 */
+	bool run(dispatch_queue& queue);
+
+	/**
+	 * Returns the execution times of `node` in the last run.
+	 */
+	node_timing timing(node_id node) const;
+
+	/**
+	 * Returns the chain of nodes with the longest total duration in the last run, from first to last.
+	 * Speeding up nodes outside the critical path does not make the graph run faster.
+	 */
+	std::vector<node_id> critical_path() const;
+
+private:
+	struct node {
+		std::function<void()> work;
+		const char *label;
+		std::vector<node_id> successors;
+		uint32_t predecessor_count = 0;
+		std::atomic<uint32_t> pending_predecessors { 0 };
+		node_timing last_timing {};
+	};
+
+	std::deque<node> nodes;
+	std::vector<node_id> roots;
+	bool is_validated = false;
+	bool is_acyclic = false;
+
+	dispatch_queue *running_queue = nullptr;
+	std::chrono::steady_clock::time_point run_start;
+	std::atomic<size_t> remaining_nodes { 0 };
+	std::mutex mutex;
+	std::condition_variable finished_condition_variable;
+	bool is_finished = false;
+	std::exception_ptr first_exception;
+
+	void validate();
+	void execute(node_id id);
+};
+
+} // end namespace dispatch_queue
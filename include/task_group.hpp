@@ -0,0 +1,213 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "async_primitives.hpp"
+#include "pending_task_queue.hpp"
+#include "task.hpp"
+
+namespace dispatch_queue {
+
+class dispatch_queue;
+
+namespace detail {
+
+/**
+ * Shared state of a `task_group`: children not started yet and a counter of unfinished children.
+ */
+class task_group_state {
+public:
+	/// Count a new child, which must be pushed with `push` afterwards.
+	void add();
+	void push(pending_task&& child);
+	/// Pop a child and run it in the calling thread.
+	/// @returns Whether a child was run.
+	bool run_one();
+	/// Run or wait for all children, collecting the exceptions they threw.
+	std::vector<std::exception_ptr> wait();
+
+private:
+	/// Children that were added but did not finish yet
+	std::atomic<size_t> pending_count { 0 };
+	std::mutex mutex;
+	std::condition_variable condition_variable;
+	pending_task_queue children;
+	int sleeping_waiters = 0;
+	std::vector<std::exception_ptr> exceptions;
+
+	void finish_one();
+};
+
+} // end namespace detail
+
+/**
+ * Structured fork-join: run child tasks in a dispatch queue and wait for all of them together.
+ *
+ * Children are tracked by a single atomic counter instead of a `task` per child, so spawning does not
+ * allocate shared futures. While waiting, the calling thread runs children that did not start yet,
+ * so recursive algorithms that wait for their children inside worker threads keep all workers busy
+ * instead of blocking them.
+ *
+ * Exceptions thrown by children are collected: `wait` rethrows the first one and `exceptions` returns all of them.
+ *
+ * @code
+ * uint64_t fibonacci(dispatch_queue::dispatch_queue& q, int n) {
+ *     if (n < 20) {
+ *         return serial_fibonacci(n);
+ *     }
+ *     uint64_t a, b;
+ *     dispatch_queue::task_group group(q);
+ *     group.run([&] { a = fibonacci(q, n - 1); });
+ *     group.run([&] { b = fibonacci(q, n - 2); });
+ *     group.wait();
+ *     return a + b;
+ * }
+ * @endcode
+ */
+class task_group {
+public:
+	/**
+	 * @param queue Dispatch queue that runs the children. In immediate mode, children run inside `run`.
+	 */
+	explicit task_group(dispatch_queue& queue);
+
+	/**
+	 * Waits for the remaining children, ignoring their exceptions.
+	 */
+	~task_group();
+
+	task_group(const task_group&) = delete;
+	task_group& operator=(const task_group&) = delete;
+
+	/**
+	 * Run a child task that calls `f` with forwarded arguments `args`.
+	 * Children may run more children in the same group.
+	 */
+	template<typename F, typename... Args>
+	void run(F&& f, Args&&... args) {
+		auto work = std::bind(std::forward<F>(f), std::forward<Args>(args)...);
+		state->add();
+		state->push(detail::pending_task { [work]() mutable {
+			work();
+			return true;
+		} });
+		post_runner();
+	}
+
+	/**
+	 * Wait until all children finish, running children that did not start yet in the calling thread.
+	 * If children threw exceptions, rethrows the first one after all children finished.
+	 * The group may be reused afterwards.
+	 */
+	void wait();
+
+	/**
+	 * Returns the exceptions thrown by children before the last call to `wait`.
+	 */
+	const std::vector<std::exception_ptr>& exceptions() const;
+
+private:
+	dispatch_queue& queue;
+	std::shared_ptr<detail::task_group_state> state;
+	std::vector<std::exception_ptr> last_exceptions;
+
+	/// Post a task to `queue` that runs the next child, if `wait` did not run it already.
+	void post_runner();
+};
+
+#ifdef __cpp_lib_coroutine
+/**
+ * Structured concurrency for coroutines: spawn `task`s and `co_await join()` to resume once all of them finished.
+ *
+ * Spawned tasks are tracked by a single atomic counter. Exceptions are collected like in `task_group`:
+ * the join awaiter rethrows the first one and `exceptions` returns all of them.
+ * The scope must be joined exactly once, and only destroyed after the join awaiter resumes.
+ *
+ * @code
+ * dispatch_queue::async_scope scope;
+ * for (auto& url : urls) {
+ *     scope.spawn(download(dispatch_queue, url));
+ * }
+ * co_await scope.join(dispatch_queue.dispatch());
+ * @endcode
+ */
+class async_scope {
+public:
+	template<typename Scheduler>
+	struct join_awaiter : async_manual_reset_event::wait_awaiter<Scheduler> {
+		async_scope& scope;
+
+		join_awaiter(async_scope& scope, Scheduler scheduler)
+			: async_manual_reset_event::wait_awaiter<Scheduler>(scope.joined, std::move(scheduler))
+			, scope(scope)
+		{
+		}
+
+		void await_resume() const {
+#ifdef __cpp_exceptions
+			if (!scope.collected_exceptions.empty()) {
+				std::rethrow_exception(scope.collected_exceptions.front());
+			}
+#endif
+		}
+	};
+
+	async_scope() = default;
+	async_scope(const async_scope&) = delete;
+	async_scope& operator=(const async_scope&) = delete;
+
+	/**
+	 * Track `spawned` until it finishes.
+	 */
+	template<typename T>
+	void spawn(task<T> spawned) {
+		pending_count.fetch_add(1, std::memory_order_relaxed);
+		spawned.then([this](task<T> finished) {
+			if (std::exception_ptr exception = finished.get_exception()) {
+				std::lock_guard<std::mutex> lock(mutex);
+				collected_exceptions.push_back(exception);
+			}
+			release();
+		});
+	}
+
+	/**
+	 * Returns an awaiter that resumes once all spawned tasks finished.
+	 * Tasks must not be spawned after calling this.
+	 * @param scheduler Awaiter used to resume the coroutine after waiting, defaults to resuming inline.
+	 */
+	template<typename Scheduler = detail::inline_scheduler>
+	join_awaiter<Scheduler> join(Scheduler scheduler = {}) {
+		release();
+		return join_awaiter<Scheduler>(*this, std::move(scheduler));
+	}
+
+	/**
+	 * Returns the exceptions thrown by spawned tasks. Only call this after the join awaiter resumed.
+	 */
+	const std::vector<std::exception_ptr>& exceptions() const {
+		return collected_exceptions;
+	}
+
+private:
+	/// Unfinished spawned tasks, plus one until `join` is called
+	std::atomic<size_t> pending_count { 1 };
+	std::mutex mutex;
+	std::vector<std::exception_ptr> collected_exceptions;
+	async_manual_reset_event joined;
+
+	void release() {
+		if (pending_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			joined.set();
+		}
+	}
+};
+#endif
+
+} // end namespace dispatch_queue
@@ -0,0 +1,20 @@
+#pragma once
+
+namespace dispatch_queue {
+
+/**
+ * Static name for a dispatched task, shown in traces.
+ *
+ * The string is not copied, so it must outlive the dispatch queue, for example a string literal.
+ *
+ * @code
+ * dispatch_queue.dispatch(dispatch_queue::task_label("decode"), decode_frame, frame);
+ * @endcode
+ */
+struct task_label {
+	const char *name;
+
+	explicit task_label(const char *name) : name(name) {}
+};
+
+} // end namespace dispatch_queue
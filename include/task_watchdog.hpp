@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dispatch_queue {
+
+/**
+ * Task reported by the watchdog for running longer than its threshold.
+ */
+struct stalled_task {
+	/// Static name passed with `task_label`, or null if the task has no label
+	const char *label;
+	/// Index of the worker thread running the task, see `this_worker::index`
+	int worker_index;
+	/// How long the task was running when it was flagged
+	std::chrono::nanoseconds running_time;
+};
+
+namespace detail {
+
+/**
+ * Start time and label of the task running in a worker thread, written only by that worker and read by the watchdog.
+ * Aligned to cache lines so that workers don't contend with each other.
+ */
+struct alignas(64) watchdog_slot {
+	/// Start of the running task in steady clock nanoseconds, or 0 while the worker is idle
+	std::atomic<int64_t> task_start { 0 };
+	std::atomic<const char *> task_label { nullptr };
+	int worker_index = -1;
+	/// Start of the last task reported as stalled, only used by the watchdog thread
+	int64_t reported_start = 0;
+
+	void begin(const char *label) {
+		task_label.store(label, std::memory_order_release);
+		task_start.store(std::chrono::steady_clock::now().time_since_epoch().count(), std::memory_order_release);
+	}
+	void end() {
+		task_start.store(0, std::memory_order_relaxed);
+	}
+};
+
+/**
+ * Thread that periodically checks the slots of worker threads, reporting tasks that run for longer than a threshold.
+ *
+ * Each stalled task is reported once. The callback runs in the watchdog thread.
+ */
+class task_watchdog {
+public:
+	/**
+	 * @param threshold Running time after which tasks are reported.
+	 * @param callback Called for each stalled task.
+	 * @param collect_slots Fills a vector with the slots of all worker threads, including compensation threads spawned later.
+	 */
+	task_watchdog(std::chrono::nanoseconds threshold, std::function<void(const stalled_task&)> callback, std::function<void(std::vector<watchdog_slot *>&)> collect_slots);
+	~task_watchdog();
+
+	task_watchdog(const task_watchdog&) = delete;
+	task_watchdog& operator=(const task_watchdog&) = delete;
+
+private:
+	std::chrono::nanoseconds threshold;
+	std::function<void(const stalled_task&)> callback;
+	std::function<void(std::vector<watchdog_slot *>&)> collect_slots;
+
+	std::mutex mutex;
+	std::condition_variable condition_variable;
+	bool is_shutting_down = false;
+	std::thread thread;
+
+	void run();
+	void check(const std::vector<watchdog_slot *>& slots);
+};
+
+} // end namespace detail
+
+} // end namespace dispatch_queue
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "scratch_arena.hpp"
+
+namespace dispatch_queue {
+
+class dispatch_queue;
+
+/**
+ * Context of the worker thread running the current task.
+ *
+ * @code
+ * dispatch_queue.dispatch([] {
+ *     float *samples = dispatch_queue::this_worker::arena().allocate_array<float>(sample_count);
+ *     // ... no need to free `samples`, the arena is reset when the task finishes
+ * });
+ * @endcode
+ */
+namespace this_worker {
+
+/**
+ * Returns the index of the calling worker thread, the same passed to `worker_init`,
+ * or -1 if not called from a worker thread.
+ * Compensation threads spawned for blocking tasks have indices starting at the pool's thread count.
+ */
+int index();
+
+/**
+ * Returns the dispatch queue whose task is running in the calling worker thread,
+ * or null if not called from a background task.
+ * With shared pools, this is the queue that dispatched the task, not the pool.
+ */
+dispatch_queue *queue();
+
+/**
+ * Returns the scratch arena of the calling thread.
+ * In worker threads, it is reset after each task, so task bodies may allocate temporary memory
+ * without freeing it. Call `reset` for resetting it earlier, for example between iterations of a loop.
+ * In other threads, it is only reset on demand.
+ */
+scratch_arena& arena();
+
+#ifdef __cpp_lib_memory_resource
+/**
+ * Returns a `std::pmr::memory_resource` that allocates from the calling thread's `arena`.
+ *
+ * @code
+ * std::pmr::vector<int> visited(dispatch_queue::this_worker::memory_resource());
+ * @endcode
+ */
+inline std::pmr::memory_resource *memory_resource() {
+	static thread_local scratch_arena_resource resource(arena());
+	return &resource;
+}
+#endif
+
+} // end namespace this_worker
+
+} // end namespace dispatch_queue
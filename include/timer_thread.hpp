@@ -0,0 +1,60 @@
+#pragma once
+
+#ifndef __linux__
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace dispatch_queue {
+
+namespace detail {
+
+/**
+ * Thread that calls callbacks once their deadlines are reached, used for timers where `io_reactor` is not available.
+ *
+ * Callbacks receive 0 and run in the timer thread, so they should only hand work over to other threads.
+ * Callbacks still pending when the timer thread is destroyed receive `ECANCELED` instead,
+ * in the destroying thread.
+ */
+class timer_thread {
+public:
+	timer_thread();
+	~timer_thread();
+
+	timer_thread(const timer_thread&) = delete;
+	timer_thread& operator=(const timer_thread&) = delete;
+
+	/**
+	 * Call `callback` once `deadline` is reached.
+	 * @returns 0, or `ECANCELED` if the timer thread is being destroyed, in which case `callback` is never called.
+	 */
+	int when_expired(std::chrono::steady_clock::time_point deadline, std::function<void(int)> callback);
+
+private:
+	struct timer {
+		std::chrono::steady_clock::time_point deadline;
+		std::function<void(int)> callback;
+
+		bool operator>(const timer& other) const {
+			return deadline > other.deadline;
+		}
+	};
+
+	std::mutex mutex;
+	std::condition_variable condition_variable;
+	std::vector<timer> timers;
+	bool is_shutting_down = false;
+	std::thread thread;
+
+	void run();
+};
+
+} // end namespace detail
+
+} // end namespace dispatch_queue
+
+#endif
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace dispatch_queue {
+
+namespace detail {
+
+enum class trace_event_type : uint8_t {
+	/// Task was queued, recorded in the dispatching thread
+	enqueue,
+	/// Task was popped from the queue by a worker
+	dequeue,
+	/// Task started running
+	start,
+	/// Task finished running, `data` is 1 if it succeeded
+	finish,
+	/// Task is running continuations, `data` is the continuation count
+	continuation,
+};
+
+struct trace_event {
+	uint64_t timestamp;
+	uint64_t task_id;
+	const char *label;
+	uint32_t pool_id;
+	uint32_t data;
+	trace_event_type type;
+};
+
+/**
+ * Storage of a trace event in a ring buffer.
+ * Readers may copy a slot while its owner overwrites it, so fields are relaxed atomics
+ * and readers discard copies of slots that the owner may have reached meanwhile.
+ */
+struct trace_slot {
+	std::atomic<uint64_t> timestamp;
+	std::atomic<uint64_t> task_id;
+	std::atomic<const char *> label;
+	std::atomic<uint32_t> pool_id;
+	std::atomic<uint32_t> data;
+	std::atomic<trace_event_type> type;
+
+	void store(const trace_event& event) {
+		timestamp.store(event.timestamp, std::memory_order_relaxed);
+		task_id.store(event.task_id, std::memory_order_relaxed);
+		label.store(event.label, std::memory_order_relaxed);
+		pool_id.store(event.pool_id, std::memory_order_relaxed);
+		data.store(event.data, std::memory_order_relaxed);
+		type.store(event.type, std::memory_order_relaxed);
+	}
+	trace_event load() const {
+		return {
+			timestamp.load(std::memory_order_relaxed),
+			task_id.load(std::memory_order_relaxed),
+			label.load(std::memory_order_relaxed),
+			pool_id.load(std::memory_order_relaxed),
+			data.load(std::memory_order_relaxed),
+			type.load(std::memory_order_relaxed),
+		};
+	}
+};
+
+/**
+ * Fixed size ring buffer of trace events.
+ * Only its owner thread writes to it, so recording is lock-free.
+ */
+struct trace_buffer {
+	static constexpr uint64_t capacity = 1 << 13;
+
+	std::atomic<uint64_t> head { 0 };
+	std::atomic<uint64_t> tail { 0 };
+	uint32_t thread_id;
+	std::string thread_name;
+	std::array<trace_slot, capacity> events;
+};
+
+/**
+ * Process-wide recorder of task lifecycle events.
+ * Each thread records into its own `trace_buffer`, taken the first time it records an event.
+ * Buffers of exited threads keep their events until a new thread reuses them,
+ * so the number of buffers is bounded by the number of threads alive at once.
+ */
+class trace_recorder {
+public:
+	static trace_recorder& instance();
+
+	uint32_t new_pool_id();
+	uint64_t new_task_id();
+
+	void record(trace_event_type type, uint32_t pool_id, uint64_t task_id, const char *label, uint32_t data = 0);
+
+	/// Write events recorded for `pool_id` in Chrome's trace event JSON format.
+	void write_chrome_trace(std::ostream& os, uint32_t pool_id);
+
+	/// Discard all recorded events.
+	void clear();
+
+	/// Name used for the calling thread in traces.
+	static void set_thread_name(std::string name);
+
+	/// Sets the traced task being run by the calling thread, used for recording continuations.
+	static void set_current_task(uint32_t pool_id, uint64_t task_id, const char *label);
+	/// Records a continuation event if the calling thread is running a traced task.
+	static void record_continuations(size_t count);
+
+private:
+	/// Returns the buffer of a thread to `free_buffers` when the thread exits.
+	struct thread_buffer_owner {
+		trace_buffer *buffer = nullptr;
+		~thread_buffer_owner();
+	};
+
+	std::mutex mutex;
+	std::vector<std::unique_ptr<trace_buffer>> buffers;
+	std::vector<trace_buffer *> free_buffers;
+	uint32_t next_thread_id = 1;
+	std::atomic<uint32_t> next_pool_id { 1 };
+	std::atomic<uint64_t> next_task_id { 1 };
+
+	trace_buffer& thread_buffer();
+};
+
+} // end namespace detail
+
+} // end namespace dispatch_queue
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <chrono>
+
+#ifndef __linux__
+#include <condition_variable>
+#include <mutex>
+#endif
+
+namespace dispatch_queue {
+
+namespace detail {
+
+/**
+ * Level-triggered event used to signal that tasks are available.
+ *
+ * On Linux this is backed by an `eventfd`, so the event may also be polled by external event loops
+ * using `native_handle`. Failing to create it throws `std::system_error`, or aborts without exceptions.
+ * On other platforms it is implemented using a mutex and condition variable and `native_handle` returns -1.
+ */
+class wakeup_event {
+public:
+	wakeup_event();
+	~wakeup_event();
+
+	wakeup_event(const wakeup_event&) = delete;
+	wakeup_event& operator=(const wakeup_event&) = delete;
+
+	/// Mark event as signaled, waking up waiters.
+	void notify();
+	/// Mark event as not signaled.
+	void reset();
+
+	/// File descriptor that becomes readable while the event is signaled, or -1 if unsupported.
+	int native_handle() const;
+
+	void wait();
+	bool wait_for(std::chrono::nanoseconds timeout_duration);
+
+	template<class Clock, class Duration>
+	bool wait_until(const std::chrono::time_point<Clock, Duration>& timeout_time) {
+		return wait_for(std::chrono::duration_cast<std::chrono::nanoseconds>(timeout_time - Clock::now()));
+	}
+
+private:
+#ifdef __linux__
+	int fd;
+#else
+	std::mutex mutex;
+	std::condition_variable condition_variable;
+	bool is_signaled = false;
+#endif
+};
+
+} // end namespace detail
+
+} // end namespace dispatch_queue
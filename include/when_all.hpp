@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "result.hpp"
+#include "task.hpp"
+
+namespace dispatch_queue {
+
+namespace detail {
+
+/**
+ * Shared state of a `when_all` join: the joined tasks and how many of them did not finish yet.
+ */
+template<typename T, typename Joined>
+struct when_all_state {
+	std::vector<task<T>> tasks;
+	std::atomic<size_t> remaining;
+	std::shared_ptr<task_future<Joined>> future = task_future<Joined>::create_pending();
+
+	explicit when_all_state(std::vector<task<T>>&& tasks)
+		: tasks(std::move(tasks))
+		, remaining(this->tasks.size())
+	{
+	}
+
+	/// Propagates the failure of `failed` to the joined task, forwarding its exception or error code.
+	void fail(const task<T>& failed) {
+		if (std::exception_ptr exception = failed.get_exception()) {
+			future->set_exception(exception);
+		}
+		else {
+			future->set_error(failed.get_error());
+		}
+	}
+};
+
+/**
+ * Calls `finish(state)` once all tasks of `state` finished.
+ */
+template<typename State, typename Finish>
+void when_all_finished(const std::shared_ptr<State>& state, Finish finish) {
+	if (state->tasks.empty()) {
+		finish(*state);
+		return;
+	}
+	for (auto& joined : state->tasks) {
+		joined.then([state, finish](const auto&) {
+			if (state->remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				finish(*state);
+			}
+		});
+	}
+}
+
+} // end namespace detail
+
+/**
+ * Returns a task with the values of all `tasks` in order, that finishes once all of them finished.
+ * If any task failed, the joined task fails with the first failure in order, with the same exception or error code.
+ */
+template<typename T>
+task<std::vector<T>> when_all(std::vector<task<T>> tasks) {
+	using state_type = detail::when_all_state<T, std::vector<T>>;
+	auto state = std::make_shared<state_type>(std::move(tasks));
+	detail::when_all_finished(state, [](state_type& state) {
+		std::vector<T> values;
+		values.reserve(state.tasks.size());
+		for (const task<T>& finished : state.tasks) {
+			if (finished.get_state() == task_state::failed) {
+				state.fail(finished);
+				return;
+			}
+			values.push_back(finished.get());
+		}
+		state.future->set_value(std::move(values));
+	});
+	return task<std::vector<T>>(state->future);
+}
+
+/**
+ * Returns a task that finishes once all `tasks` finished.
+ * If any task failed, the joined task fails with the first failure in order, with the same exception or error code.
+ */
+inline task<void> when_all(std::vector<task<void>> tasks) {
+	using state_type = detail::when_all_state<void, void>;
+	auto state = std::make_shared<state_type>(std::move(tasks));
+	detail::when_all_finished(state, [](state_type& state) {
+		for (const task<void>& finished : state.tasks) {
+			if (finished.get_state() == task_state::failed) {
+				state.fail(finished);
+				return;
+			}
+		}
+		state.future->set_value();
+	});
+	return task<void>(state->future);
+}
+
+/**
+ * Returns a task with a `result` holding the values of all `tasks` in order, that finishes once all of them finished.
+ * If any result holds an error, the joined result holds the first error in order, propagated by value without throwing.
+ * Tasks that failed with exceptions or error codes still fail the joined task.
+ */
+template<typename T, typename E>
+task<result<std::vector<T>, E>> when_all(std::vector<task<result<T, E>>> tasks) {
+	static_assert(!std::is_void<T>::value, "use when_all with task<result<void, E>> through map or and_then");
+	using joined_type = result<std::vector<T>, E>;
+	using state_type = detail::when_all_state<result<T, E>, joined_type>;
+	auto state = std::make_shared<state_type>(std::move(tasks));
+	detail::when_all_finished(state, [](state_type& state) {
+		std::vector<T> values;
+		values.reserve(state.tasks.size());
+		for (const task<result<T, E>>& finished : state.tasks) {
+			if (finished.get_state() == task_state::failed) {
+				state.fail(finished);
+				return;
+			}
+			result<T, E> value = finished.get();
+			if (!value) {
+				state.future->set_value(joined_type(result_failure<E> { value.error() }));
+				return;
+			}
+			values.push_back(std::move(value).value());
+		}
+		state.future->set_value(joined_type(std::move(values)));
+	});
+	return task<joined_type>(state->future);
+}
+
+} // end namespace dispatch_queue
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+namespace dispatch_queue {
+
+/**
+ * Scheduling policy of worker threads, only applied on Linux.
+ */
+enum class worker_scheduling {
+	/// Keep the scheduling inherited from the thread that creates the workers
+	inherit,
+	/// Default time-sharing scheduling (`SCHED_OTHER`), with `priority` as the nice value
+	normal,
+	/// Time-sharing scheduling for non-interactive work (`SCHED_BATCH`), with `priority` as the nice value
+	batch,
+	/// Scheduling for very low priority work (`SCHED_IDLE`)
+	idle,
+	/// Real-time first-in first-out scheduling (`SCHED_FIFO`), with `priority` between 1 and 99
+	fifo,
+	/// Real-time round-robin scheduling (`SCHED_RR`), with `priority` between 1 and 99
+	round_robin,
+};
+
+/**
+ * Attributes of the worker threads created by a dispatch queue or shared pool.
+ *
+ * Attributes are applied inside each worker thread before `worker_init` runs.
+ * Failures to apply them, for example lacking privileges for real-time scheduling, are ignored
+ * and workers keep running with default attributes.
+ *
+ * @code
+ * dispatch_queue::worker_options options;
+ * options.name = "audio";
+ * options.stack_size = 256 * 1024;
+ * options.scheduling = dispatch_queue::worker_scheduling::fifo;
+ * options.priority = 10;
+ * dispatch_queue::dispatch_queue audio_queue(2, options);
+ * @endcode
+ */
+struct worker_options {
+	/// Thread name, followed by the worker index. Linux truncates thread names to 15 characters.
+	std::string name = "worker";
+	/// Stack size of worker threads in bytes, or 0 for the platform default, which is usually 8MB on Linux.
+	/// Raised to the minimum stack size supported. Only applied on platforms with POSIX threads.
+	size_t stack_size = 0;
+	worker_scheduling scheduling = worker_scheduling::inherit;
+	/// Priority for real-time scheduling, or nice value for time-sharing scheduling
+	int priority = 0;
+	/// How long a compensation thread spawned for a `blocking_scope` stays parked without being needed before exiting
+	std::chrono::nanoseconds compensation_idle_timeout = std::chrono::seconds(1);
+};
+
+} // end namespace dispatch_queue
@@ -1,69 +1,272 @@
 #pragma once
 
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
 #include <mutex>
+#include <string>
 #include <thread>
+#include <vector>
 
+#include "aligned_allocator.hpp"
 #include "pending_task_queue.hpp"
+#include "queue_stats.hpp"
+#include "stats_counters.hpp"
+#include "task_watchdog.hpp"
+#include "trace_recorder.hpp"
+#include "worker_options.hpp"
+#include "worker_thread.hpp"
 
 
 namespace dispatch_queue {
 
+class dispatch_queue;
+
 namespace detail {
 
+/**
+ * Background tasks of a single dispatch queue, scheduled by a worker pool that may be shared with other queues.
+ * All fields are protected by the pool's mutex.
+ */
+struct task_source {
+	pending_task_queue queue;
+	/// Queue that dispatches tasks to this source, returned by `this_worker::queue()`
+	dispatch_queue *owner = nullptr;
+	/// Number of tasks taken in a row before workers move on to the next source
+	int weight = 1;
+	int credits = 0;
+	int running_count = 0;
+	/// Number of tasks held back by concurrency limiters, that will be enqueued later
+	int deferred_count = 0;
+	/// Incremented when pending tasks are discarded, so that deferred tasks from before that are discarded as well
+	uint64_t generation = 0;
+
+	/// Tasks dispatched with affinity to each worker, taken by other workers while their owner is busy
+	std::vector<pending_task_queue> affinity_queues;
+	/// Tasks that only run on their worker
+	std::vector<pending_task_queue> pinned_queues;
+	/// Number of tasks in `affinity_queues` and `pinned_queues`
+	size_t local_count = 0;
+
+	/// Number of tasks in worker batches in the low 32 bits, and the batch generation in the high 32 bits.
+	/// Workers take batched tasks without locking, while clearing the source bumps the generation to discard them.
+	std::atomic<uint64_t> batched_state { 0 };
+
+	uint64_t enqueued_count = 0;
+	size_t max_depth = 0;
+
+	size_t batched_count() const {
+		return (size_t) (batched_state.load(std::memory_order_relaxed) & 0xffffffffu);
+	}
+	size_t pending_count() const {
+		return queue.size() + local_count + batched_count();
+	}
+};
+
+/**
+ * Tasks a worker took from a source with a single lock acquisition, run in order without locking again.
+ *
+ * The owner and idle workers helping it both take tasks from the front, claiming each one by advancing `next`.
+ * Other fields only change while the owner holds the pool's mutex and the batch is empty,
+ * so idle workers read them under the mutex.
+ */
+struct alignas(64) worker_batch {
+	/// Tasks taken along with the popped one, so that a worker takes at most 16 tasks per lock acquisition
+	static constexpr uint32_t capacity = 15;
+
+	task_source *source = nullptr;
+	/// Batch generation of `source` when the tasks were taken
+	uint32_t generation = 0;
+	uint32_t size = 0;
+	/// Index of the next task to be claimed
+	std::atomic<uint32_t> next { 0 };
+	std::array<pending_task, capacity> tasks;
+
+	uint32_t remaining() const {
+		uint32_t claimed = next.load(std::memory_order_acquire);
+		return claimed < size ? size - claimed : 0;
+	}
+};
+
 class worker_pool {
-	auto wait_predicate() const {
-		return [this]{ return is_shutting_down || task_queue.empty(); };
+	auto wait_predicate(const task_source& source) const {
+		return [this, &source]{ return is_shutting_down || (source.pending_count() == 0 && source.running_count == 0 && source.deferred_count == 0); };
 	}
 public:
 	template<typename Fn>
-	worker_pool(pending_task_queue& task_queue, int thread_count, Fn&& worker_init)
-		: task_queue(task_queue)
+	worker_pool(int thread_count, Fn&& worker_init, worker_options options = {})
+		: worker_init(std::forward<Fn>(worker_init))
+		, options(std::move(options))
+		, target_thread_count(thread_count)
+		, worker_counters(thread_count)
+		, is_worker_idle(thread_count, true)
+		, idle_worker_count(thread_count)
+		, pool_id(trace_recorder::instance().new_pool_id())
+		, watchdog_slots(thread_count)
+		, worker_batches(thread_count)
 	{
 		worker_threads.reserve(thread_count);
 		for (int i = 0; i < thread_count; i++) {
-			worker_threads.emplace_back([&, this, i]() {
-				worker_init(i);
-				run_task_loop();
-			});
+			watchdog_slots[i].worker_index = i;
+			worker_threads.emplace_back(this->options, std::bind(&worker_pool::run_worker, this, i, std::ref(worker_counters[i]), std::ref(watchdog_slots[i]), false));
 		}
 	}
 	~worker_pool();
 
+	/**
+	 * Create a pool that may be released by one of its own tasks.
+	 * Worker threads can't join themselves, so such a pool is destroyed by another thread once the task returns.
+	 */
+	template<typename Fn>
+	static std::shared_ptr<worker_pool> create(int thread_count, Fn&& worker_init, worker_options options = {}) {
+		return std::shared_ptr<worker_pool>(new worker_pool(thread_count, std::forward<Fn>(worker_init), std::move(options)), &destroy);
+	}
+
 	worker_pool(const worker_pool&) = delete;
 	worker_pool& operator=(const worker_pool&) = delete;
 
 	int thread_count() const;
-	size_t size();
 
-	void enqueue_task(pending_task&& task, bool run_on_main_loop);
-	std::deque<pending_task> pop_main_loop_tasks();
-	void clear();
+	/// Start scheduling tasks from `source`, taking up to `weight` tasks in a row from it.
+	void add_source(task_source& source, int weight);
+	/// Stop scheduling tasks from `source`, discarding its pending tasks and waiting for its running tasks to finish.
+	/// When called from a task of `source`, waits for the other tasks only: use `release_after_task`
+	/// if `source` is destroyed before that task returns.
+	void remove_source(task_source& source);
+
+	size_t size(const task_source& source);
+	void enqueue_task(task_source& source, pending_task&& task);
+	/// Enqueue a task in the local queue of the worker at `worker_index`.
+	/// Pinned tasks only run on that worker, other tasks may be taken by idle workers while it is busy.
+	void enqueue_local_task(task_source& source, int worker_index, bool is_pinned, pending_task&& task);
+	/// Count a task that will be enqueued later with `admit_task`, returning the source's current generation.
+	uint64_t defer_task(task_source& source);
+	/// Enqueue a task counted by `defer_task`, unless `source` was cleared since then.
+	/// @returns Whether the task was enqueued.
+	bool admit_task(task_source& source, uint64_t generation, pending_task&& task);
+	void clear(task_source& source);
 	void shutdown();
 
-	void wait();
+	void set_stats_enabled(bool enabled);
+	bool is_stats_enabled() const;
+	queue_stats stats(const task_source& source);
+	void reset_stats(task_source& source);
+
+	void set_tracing_enabled(bool enabled);
+	bool is_tracing_enabled() const;
+	void write_chrome_trace(std::ostream& os);
+
+	/// Start a watchdog that calls `callback` for tasks running longer than `threshold`, replacing the previous one.
+	/// An empty `callback` stops the watchdog.
+	void set_watchdog(std::chrono::nanoseconds threshold, std::function<void(const stalled_task&)> callback);
+	bool is_watchdog_enabled() const;
+	/// Returns how long the oldest task of `source` has been queued, if tasks are being timestamped.
+	std::chrono::nanoseconds oldest_pending_age(const task_source& source);
+
+	void wait(const task_source& source);
 
 	template<class Rep, class Period>
-	bool wait_for(const std::chrono::duration<Rep, Period>& timeout_duration) {
+	bool wait_for(const task_source& source, const std::chrono::duration<Rep, Period>& timeout_duration) {
 		std::unique_lock<std::mutex> lock(mutex);
-		return all_done_condition_variable.wait_for(lock, timeout_duration, wait_predicate());
+		return all_done_condition_variable.wait_for(lock, timeout_duration, wait_predicate(source));
 	}
 
 	template<class Clock, class Duration>
-	bool wait_until(const std::chrono::time_point<Clock, Duration>& timeout_time) {
+	bool wait_until(const task_source& source, const std::chrono::time_point<Clock, Duration>& timeout_time) {
 		std::unique_lock<std::mutex> lock(mutex);
-		return all_done_condition_variable.wait_until(lock, timeout_time, wait_predicate());
+		return all_done_condition_variable.wait_until(lock, timeout_time, wait_predicate(source));
 	}
 
+	/// Returns the tasks in `batch` to the front of their source's queue, so that other workers may run them.
+	void release_batch(worker_batch& batch);
+
+	/// Mark the calling worker thread as blocked, waking or spawning a compensation thread to keep the number of runnable workers.
+	void begin_blocking();
+	/// Mark the calling worker thread as runnable again. Excess compensation threads park once they finish their current task.
+	void end_blocking();
+
+	/// Returns the pool that owns the calling thread, or null if not called from a worker thread.
+	static worker_pool *current();
+	/// Returns the index of the calling worker thread, or -1 if not called from a worker thread.
+	static int current_worker_index();
+	/// Returns the source of the task running in the calling thread, or null if not called from a background task.
+	static task_source *current_source();
+	/// Keep `object` alive until the task running in the calling worker thread returns,
+	/// like the source of a dispatch queue destroyed by one of its own tasks.
+	static void release_after_task(std::shared_ptr<void> object);
+	/// Returns whether the task running in the calling thread used up `budget`.
+	/// In worker threads, the time slice starts with the first call of each task, or with the task itself
+	/// while collecting statistics, which reads the clock anyway. In other threads, it starts with the first call.
+	static bool is_time_slice_expired(std::chrono::nanoseconds budget);
+
 private:
 	std::mutex mutex;
 	std::condition_variable task_condition_variable;
 	std::condition_variable all_done_condition_variable;
-	std::vector<std::thread> worker_threads;
-	pending_task_queue& task_queue;
-	bool is_shutting_down;
+	std::vector<worker_thread> worker_threads;
+	std::vector<task_source *> sources;
+	size_t next_source = 0;
+	std::function<void(int)> worker_init;
+	worker_options options;
+	bool is_shutting_down = false;
+
+	// Compensation for workers blocked inside `blocking_scope`
+	std::condition_variable spare_condition_variable;
+	std::vector<worker_thread> compensation_threads;
+	std::deque<worker_stats_counters, aligned_allocator<worker_stats_counters>> compensation_counters;
+	/// Whether each compensation thread is running, since parked ones exit after `worker_options::compensation_idle_timeout`
+	std::vector<bool> is_compensation_active;
+	/// Compensation threads that exited, whose counters and watchdog slot are reused by the next one spawned
+	std::vector<int> retired_compensation;
+	int active_compensation_count = 0;
+	/// Task counts and durations of retired compensation threads
+	pool_stats retired_stats;
+	int target_thread_count;
+	int blocked_count = 0;
+	int parked_count = 0;
+	int unpark_signals = 0;
+	uint64_t compensation_thread_count = 0;
+
+	std::atomic<bool> is_collecting_stats { false };
+	std::vector<worker_stats_counters, aligned_allocator<worker_stats_counters>> worker_counters;
+
+	// Worker local queues
+	/// Whether each worker is waiting for tasks, in which case its local tasks are not taken by other workers
+	std::vector<bool> is_worker_idle;
+	/// Number of tasks in the local queues of all sources
+	size_t local_task_count = 0;
+	/// Number of workers with `is_worker_idle` set
+	int idle_worker_count;
+
+	std::atomic<bool> is_tracing { false };
+	uint32_t pool_id;
+
+	// Watchdog for stalled tasks
+	std::atomic<bool> is_watching { false };
+	std::vector<watchdog_slot, aligned_allocator<watchdog_slot>> watchdog_slots;
+	std::deque<watchdog_slot, aligned_allocator<watchdog_slot>> compensation_watchdog_slots;
+	std::mutex watchdog_mutex;
+	std::unique_ptr<task_watchdog> watchdog;
+
+	/// Batches of non-compensation workers, which idle workers help run
+	std::vector<worker_batch, aligned_allocator<worker_batch>> worker_batches;
 
-	void run_task_loop();
+	bool push_task(task_source& source, pending_task&& task, const uint64_t *deferred_generation, int worker_index = -1, bool is_pinned = false);
+	bool try_pop(pending_task& task, task_source *& source, int worker_index);
+	bool try_pop_local(std::vector<pending_task_queue> task_source::*queues, int worker_index, pending_task& task, task_source *& source);
+	void take_batch(task_source& source, worker_batch& batch);
+	bool take_batched_task(worker_batch& batch, pending_task& task);
+	void take_pending_tasks(task_source& source, pending_task_queue& discarded);
+	int runnable_count() const;
+	static void destroy(worker_pool *pool);
+	void spawn_compensation_thread();
+	void retire_compensation_thread(int worker_index);
+	void run_worker(int worker_index, worker_stats_counters& counters, watchdog_slot& slot, bool is_compensation);
+	void run_task_loop(int worker_index, worker_stats_counters& counters, watchdog_slot& slot, bool is_compensation);
 };
 
 } // end namespace detail
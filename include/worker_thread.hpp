@@ -0,0 +1,56 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <thread>
+
+#include "worker_options.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+	#include <pthread.h>
+	#define DISPATCH_QUEUE_PTHREADS
+#endif
+
+namespace dispatch_queue {
+
+namespace detail {
+
+/**
+ * Worker thread created with the stack size of `worker_options`.
+ *
+ * Uses POSIX threads where available, since `std::thread` does not support setting the stack size,
+ * and `std::thread` elsewhere. Like `std::thread`, it must be joined before being destroyed.
+ */
+class worker_thread {
+public:
+	/// Creates an object that does not represent a thread
+	worker_thread() = default;
+	worker_thread(const worker_options& options, std::function<void()> body);
+	worker_thread(worker_thread&& other) noexcept;
+	worker_thread& operator=(worker_thread&& other) noexcept;
+	~worker_thread();
+
+	worker_thread(const worker_thread&) = delete;
+	worker_thread& operator=(const worker_thread&) = delete;
+
+	bool joinable() const;
+	void join();
+
+	/**
+	 * Applies the name and scheduling of `options` to the calling thread, naming it after `worker_index`.
+	 * Returns the full thread name, which may be truncated by the platform.
+	 */
+	static std::string apply_options(const worker_options& options, int worker_index);
+
+private:
+#ifdef DISPATCH_QUEUE_PTHREADS
+	pthread_t handle {};
+	bool is_joinable = false;
+#else
+	std::thread thread;
+#endif
+};
+
+} // end namespace detail
+
+} // end namespace dispatch_queue
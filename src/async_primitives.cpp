@@ -0,0 +1,164 @@
+#include "../include/async_primitives.hpp"
+
+namespace dispatch_queue {
+
+///////////////////////////////////////////////////////////
+// async_semaphore
+///////////////////////////////////////////////////////////
+async_semaphore::async_semaphore(ptrdiff_t initial_count)
+	: count(initial_count)
+{
+}
+
+bool async_semaphore::try_acquire() {
+	ptrdiff_t available = count.load(std::memory_order_relaxed);
+	while (available > 0) {
+		if (count.compare_exchange_weak(available, available - 1, std::memory_order_acquire, std::memory_order_relaxed)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+bool async_semaphore::acquire_or_enqueue(detail::async_waiter *waiter) {
+	if (count.fetch_sub(1, std::memory_order_acquire) > 0) {
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	if (pending_wakeups > 0) {
+		// A release for this waiter happened before it got here
+		pending_wakeups--;
+		return false;
+	}
+	waiter->next = nullptr;
+	if (waiters_tail) {
+		waiters_tail->next = waiter;
+	}
+	else {
+		waiters_head = waiter;
+	}
+	waiters_tail = waiter;
+	return true;
+}
+
+void async_semaphore::release(ptrdiff_t release_count) {
+	for (ptrdiff_t i = 0; i < release_count; i++) {
+		if (count.fetch_add(1, std::memory_order_release) >= 0) {
+			continue;
+		}
+
+		// There is a waiter, but it may not be enqueued yet
+		detail::async_waiter *waiter;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			waiter = waiters_head;
+			if (waiter) {
+				waiters_head = waiter->next;
+				if (!waiters_head) {
+					waiters_tail = nullptr;
+				}
+			}
+			else {
+				pending_wakeups++;
+			}
+		}
+		if (waiter) {
+			waiter->resume();
+		}
+	}
+}
+
+ptrdiff_t async_semaphore::available() const {
+	ptrdiff_t available = count.load(std::memory_order_relaxed);
+	return available > 0 ? available : 0;
+}
+
+///////////////////////////////////////////////////////////
+// async_mutex
+///////////////////////////////////////////////////////////
+async_mutex::async_mutex()
+	: semaphore(1)
+{
+}
+
+bool async_mutex::try_lock() {
+	return semaphore.try_acquire();
+}
+
+void async_mutex::unlock() {
+	semaphore.release();
+}
+
+///////////////////////////////////////////////////////////
+// async_manual_reset_event
+///////////////////////////////////////////////////////////
+async_manual_reset_event::async_manual_reset_event(bool initially_set)
+	: state(initially_set ? this : nullptr)
+{
+}
+
+bool async_manual_reset_event::is_set() const {
+	return state.load(std::memory_order_acquire) == this;
+}
+
+void async_manual_reset_event::set() {
+	void *old_state = state.exchange(this, std::memory_order_acq_rel);
+	if (old_state == this || old_state == nullptr) {
+		return;
+	}
+
+	// Waiters were pushed to the front of the list, reverse it to resume them in FIFO order
+	detail::async_waiter *waiter = static_cast<detail::async_waiter *>(old_state);
+	detail::async_waiter *fifo = nullptr;
+	while (waiter) {
+		detail::async_waiter *next = waiter->next;
+		waiter->next = fifo;
+		fifo = waiter;
+		waiter = next;
+	}
+	while (fifo) {
+		// Read next before resuming, since resumed waiters may be destroyed
+		detail::async_waiter *next = fifo->next;
+		fifo->resume();
+		fifo = next;
+	}
+}
+
+void async_manual_reset_event::reset() {
+	void *set_state = this;
+	state.compare_exchange_strong(set_state, nullptr, std::memory_order_relaxed);
+}
+
+bool async_manual_reset_event::enqueue(detail::async_waiter *waiter) const {
+	const void *set_state = this;
+	void *old_state = state.load(std::memory_order_acquire);
+	do {
+		if (old_state == set_state) {
+			return false;
+		}
+		waiter->next = static_cast<detail::async_waiter *>(old_state);
+	} while (!state.compare_exchange_weak(old_state, waiter, std::memory_order_release, std::memory_order_acquire));
+	return true;
+}
+
+///////////////////////////////////////////////////////////
+// async_latch
+///////////////////////////////////////////////////////////
+async_latch::async_latch(ptrdiff_t expected)
+	: count(expected)
+	, event(expected <= 0)
+{
+}
+
+void async_latch::count_down(ptrdiff_t n) {
+	if (count.fetch_sub(n, std::memory_order_acq_rel) <= n) {
+		event.set();
+	}
+}
+
+bool async_latch::try_wait() const {
+	return event.is_set();
+}
+
+} // end namespace dispatch_queue
@@ -0,0 +1,29 @@
+#include "../include/blocking_scope.hpp"
+
+#include "../include/worker_pool.hpp"
+
+namespace dispatch_queue {
+
+namespace {
+
+thread_local bool is_blocking = false;
+
+} // end anonymous namespace
+
+blocking_scope::blocking_scope()
+	: pool(is_blocking ? nullptr : detail::worker_pool::current())
+{
+	if (pool) {
+		is_blocking = true;
+		pool->begin_blocking();
+	}
+}
+
+blocking_scope::~blocking_scope() {
+	if (pool) {
+		pool->end_blocking();
+		is_blocking = false;
+	}
+}
+
+} // end namespace dispatch_queue
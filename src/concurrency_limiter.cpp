@@ -0,0 +1,85 @@
+#include "../include/concurrency_limiter.hpp"
+
+#include <algorithm>
+
+namespace dispatch_queue {
+
+namespace detail {
+
+limiter_state::limiter_state(int max_concurrency)
+	: max_running(std::max(max_concurrency, 1))
+{
+}
+
+int limiter_state::max_concurrency() const {
+	return max_running;
+}
+
+int limiter_state::running() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return running_count;
+}
+
+size_t limiter_state::deferred() const {
+	std::lock_guard<std::mutex> lock(mutex);
+	return deferred_work.size();
+}
+
+bool limiter_state::try_acquire() {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (running_count < max_running) {
+		running_count++;
+		return true;
+	}
+	return false;
+}
+
+bool limiter_state::acquire_or_defer(std::function<bool()>&& admit) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (running_count < max_running) {
+		running_count++;
+		return true;
+	}
+	deferred_work.push_back(std::move(admit));
+	return false;
+}
+
+void limiter_state::release() {
+	while (true) {
+		std::function<bool()> admit;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (deferred_work.empty()) {
+				running_count--;
+				return;
+			}
+			// The slot goes straight to the deferred work, so running_count does not change
+			admit = std::move(deferred_work.front());
+			deferred_work.pop_front();
+		}
+		if (admit()) {
+			return;
+		}
+	}
+}
+
+} // end namespace detail
+
+concurrency_limiter::concurrency_limiter(int max_concurrency)
+	: state(std::make_shared<detail::limiter_state>(max_concurrency))
+{
+}
+
+int concurrency_limiter::max_concurrency() const {
+	return state->max_concurrency();
+}
+
+int concurrency_limiter::running() const {
+	return state->running();
+}
+
+size_t concurrency_limiter::deferred() const {
+	return state->deferred();
+}
+
+} // end namespace dispatch_queue
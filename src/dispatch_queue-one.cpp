@@ -1,3 +1,21 @@
+#include "async_primitives.cpp"
+#include "blocking_scope.cpp"
+#include "concurrency_limiter.cpp"
 #include "dispatch_queue.cpp"
+#include "io_reactor.cpp"
+#include "loop_queue.cpp"
 #include "pending_task_queue.cpp"
+#include "queue_stats.cpp"
+#include "scratch_arena.cpp"
+#include "shared_pool.cpp"
+#include "stats_counters.cpp"
+#include "target_loop.cpp"
+#include "task_graph.cpp"
+#include "task_group.cpp"
+#include "task_watchdog.cpp"
+#include "this_worker.cpp"
+#include "timer_thread.cpp"
+#include "trace_recorder.cpp"
+#include "wakeup_event.cpp"
 #include "worker_pool.cpp"
+#include "worker_thread.cpp"
@@ -3,6 +3,7 @@
 namespace dispatch_queue {
 
 dispatch_queue::dispatch_queue()
+	: main_target_loop("main")
 {
 }
 
@@ -11,6 +12,19 @@ dispatch_queue::dispatch_queue(int thread_count)
 {
 }
 
+dispatch_queue::dispatch_queue(int thread_count, worker_options options)
+	: dispatch_queue(thread_count, std::move(options), [](int){})
+{
+}
+
+dispatch_queue::dispatch_queue(const shared_pool& pool, int weight)
+	: worker_pool(pool.pool)
+	, main_target_loop("main")
+{
+	task_source->owner = this;
+	worker_pool->add_source(*task_source, weight);
+}
+
 dispatch_queue::~dispatch_queue() {
 	shutdown();
 }
@@ -30,7 +44,7 @@ int dispatch_queue::thread_count() const {
 
 size_t dispatch_queue::size() const {
 	if (worker_pool) {
-		return worker_pool->size();
+		return worker_pool->size(*task_source);
 	}
 	else {
 		return 0;
@@ -41,30 +55,323 @@ bool dispatch_queue::empty() const {
 	return size() == 0;
 }
 
+void dispatch_queue::set_stats_enabled(bool enabled) {
+	if (worker_pool) {
+		worker_pool->set_stats_enabled(enabled);
+	}
+}
+
+bool dispatch_queue::is_stats_enabled() const {
+	if (worker_pool) {
+		return worker_pool->is_stats_enabled();
+	}
+	else {
+		return false;
+	}
+}
+
+queue_stats dispatch_queue::stats() const {
+	if (worker_pool) {
+		return worker_pool->stats(*task_source);
+	}
+	else {
+		return {};
+	}
+}
+
+void dispatch_queue::reset_stats() {
+	if (worker_pool) {
+		worker_pool->reset_stats(*task_source);
+	}
+}
+
+void dispatch_queue::set_tracing_enabled(bool enabled) {
+	if (worker_pool) {
+		worker_pool->set_tracing_enabled(enabled);
+	}
+}
+
+bool dispatch_queue::is_tracing_enabled() const {
+	if (worker_pool) {
+		return worker_pool->is_tracing_enabled();
+	}
+	else {
+		return false;
+	}
+}
+
+void dispatch_queue::write_chrome_trace(std::ostream& os) const {
+	if (worker_pool) {
+		worker_pool->write_chrome_trace(os);
+	}
+	else {
+		os << "{\"traceEvents\":[]}\n";
+	}
+}
+
+void dispatch_queue::clear_trace() {
+	detail::trace_recorder::instance().clear();
+}
+
+void dispatch_queue::set_watchdog(std::chrono::nanoseconds threshold, std::function<void(const stalled_task&)> callback) {
+	if (worker_pool) {
+		worker_pool->set_watchdog(threshold, std::move(callback));
+	}
+}
+
+bool dispatch_queue::is_watchdog_enabled() const {
+	if (worker_pool) {
+		return worker_pool->is_watchdog_enabled();
+	}
+	else {
+		return false;
+	}
+}
+
+std::chrono::nanoseconds dispatch_queue::oldest_pending_age() const {
+	if (worker_pool) {
+		return worker_pool->oldest_pending_age(*task_source);
+	}
+	else {
+		return std::chrono::nanoseconds(0);
+	}
+}
+
 void dispatch_queue::clear() {
 	if (worker_pool) {
-		worker_pool->clear();
+		worker_pool->clear(*task_source);
 	}
+	std::lock_guard<std::mutex> lock(coalesced_tasks.mutex);
+	coalesced_tasks.entries.clear();
+}
+
+target_loop dispatch_queue::create_loop(std::string name) {
+	return target_loop(std::move(name));
 }
 
 void dispatch_queue::main_loop() {
-	std::deque<detail::pending_task> main_loop_tasks = worker_pool
-		? worker_pool->pop_main_loop_tasks()
-		: task_queue.pop_main_loop_tasks();
-	for (auto&& it : main_loop_tasks) {
-		it();
-	}
+	main_target_loop.run();
+}
+
+int dispatch_queue::main_loop_fd() const {
+	return main_target_loop.fd();
+}
+
+void dispatch_queue::main_loop_wait() {
+	main_target_loop.wait();
 }
 
 void dispatch_queue::wait() {
 	if (worker_pool) {
-		worker_pool->wait();
+		worker_pool->wait(*task_source);
+	}
+}
+
+void dispatch_queue::post_internal(detail::pending_task&& task) {
+	if (worker_pool) {
+		worker_pool->enqueue_task(*task_source, std::move(task));
+	}
+	else {
+		task();
+	}
+}
+
+void dispatch_queue::dispatch_limited(const std::shared_ptr<detail::limiter_state>& limiter, detail::pending_task&& task) {
+	// Releases the limiter slot once the task runs, or when it is dropped by `clear` or `shutdown`
+	struct limiter_slot {
+		std::shared_ptr<detail::limiter_state> limiter;
+		bool is_acquired = false;
+
+		~limiter_slot() {
+			release();
+		}
+		void release() {
+			if (is_acquired) {
+				is_acquired = false;
+				limiter->release();
+			}
+		}
+	};
+	auto slot = std::make_shared<limiter_slot>();
+	slot->limiter = limiter;
+	auto work = std::move(task.work);
+	task.work = [work, slot]() {
+		bool result = work();
+		slot->release();
+		return result;
+	};
+	if (limiter->try_acquire()) {
+		slot->is_acquired = true;
+		post_internal(std::move(task));
+		return;
+	}
+
+	// Deferred tasks are accounted for in the task source, so that `wait` waits for them and `clear` drops them
+	uint64_t generation = worker_pool->defer_task(*task_source);
+	std::weak_ptr<detail::worker_pool> weak_pool = worker_pool;
+	std::weak_ptr<detail::task_source> weak_source = task_source;
+	auto deferred_task = std::make_shared<detail::pending_task>(std::move(task));
+	auto admit = [weak_pool, weak_source, generation, deferred_task, slot]() {
+		auto pool = weak_pool.lock();
+		auto source = weak_source.lock();
+		slot->is_acquired = true;
+		if (!pool || !source || !pool->admit_task(*source, generation, std::move(*deferred_task))) {
+			// Queue was cleared or destroyed, the limiter passes the slot along
+			slot->is_acquired = false;
+			return false;
+		}
+		return true;
+	};
+	if (limiter->acquire_or_defer(admit)) {
+		admit();
 	}
 }
 
 void dispatch_queue::shutdown() {
+#ifdef __linux__
+	{
+		// Cancel I/O waiters and stop enqueueing debounced tasks before stopping workers.
+		// Cancelled coroutines resume in this thread and may await again, so the reactor is destroyed outside the lock.
+		std::unique_ptr<detail::io_reactor> cancelled_reactor;
+		{
+			std::lock_guard<std::mutex> lock(io_reactor_mutex);
+			cancelled_reactor = std::move(io_reactor);
+		}
+	}
+#else
+	{
+		// Stop enqueueing debounced tasks before stopping workers
+		std::unique_ptr<detail::timer_thread> cancelled_timers;
+		{
+			std::lock_guard<std::mutex> lock(timer_thread_mutex);
+			cancelled_timers = std::move(timer_thread);
+		}
+	}
+#endif
 	clear();
-	worker_pool.reset();
+	if (worker_pool) {
+		// Threads are only stopped if no other dispatch queue shares the pool
+		worker_pool->remove_source(*task_source);
+		if (detail::worker_pool::current_source() == task_source.get()) {
+			// Shut down by one of its own tasks, whose worker still uses the source once the task returns
+			detail::worker_pool::release_after_task(task_source);
+		}
+		worker_pool.reset();
+	}
+}
+
+dispatch_queue::timer_service& dispatch_queue::get_timers() {
+#ifdef __linux__
+	return get_io_reactor();
+#else
+	std::lock_guard<std::mutex> lock(timer_thread_mutex);
+	if (!timer_thread) {
+		timer_thread = std::make_unique<detail::timer_thread>();
+	}
+	return *timer_thread;
+#endif
+}
+
+std::shared_ptr<void> dispatch_queue::coalesce(const void *key, const void *result_type, bool is_debounced, std::chrono::nanoseconds delay, const std::function<std::function<bool()>(std::shared_ptr<void>&)>& make_work) {
+	auto deadline = std::chrono::steady_clock::now() + delay;
+	std::shared_ptr<void> future;
+	std::function<bool()> work;
+	bool has_entry = false;
+	{
+		std::lock_guard<std::mutex> lock(coalesced_tasks.mutex);
+		auto it = coalesced_tasks.entries.find(key);
+		if (it != coalesced_tasks.entries.end()) {
+			detail::coalesced_entry& entry = it->second;
+			if (entry.result_type == result_type && entry.is_debounced == is_debounced) {
+				if (is_debounced) {
+					// Postpone and replace work with the latest request
+					entry.work = make_work(entry.future);
+					entry.deadline = deadline;
+				}
+				return entry.future;
+			}
+			// Key is used by a task returning another type: dispatch without merging
+			work = make_work(future);
+		}
+		else {
+			work = make_work(future);
+			if (is_debounced) {
+				coalesced_tasks.entries.emplace(key, detail::coalesced_entry { future, result_type, true, std::move(work), deadline });
+			}
+			else {
+				coalesced_tasks.entries.emplace(key, detail::coalesced_entry { future, result_type, false, nullptr, deadline });
+				// Forget the entry as soon as the task starts, so that later requests run again
+				const void *future_ptr = future.get();
+				detail::coalescing_map *map = &coalesced_tasks;
+				work = [map, key, future_ptr, work]() {
+					{
+						std::lock_guard<std::mutex> lock(map->mutex);
+						auto it = map->entries.find(key);
+						if (it != map->entries.end() && it->second.future.get() == future_ptr) {
+							map->entries.erase(it);
+						}
+					}
+					return work();
+				};
+			}
+			has_entry = true;
+		}
+	}
+
+	if (!is_debounced) {
+		post_internal({ std::move(work) });
+	}
+	else if (has_entry) {
+		// Cancelled timers are dropped like cleared tasks
+		timer_service *timers = &get_timers();
+		const void *future_ptr = future.get();
+		timers->when_expired(deadline, [this, timers, key, future_ptr](int error) {
+			if (!error) {
+				enqueue_debounced(timers, key, future_ptr);
+			}
+		});
+	}
+	else {
+		get_timers().when_expired(deadline, [this, work](int error) {
+			if (!error) {
+				post_internal({ work });
+			}
+		});
+	}
+	return future;
+}
+
+void dispatch_queue::enqueue_debounced(timer_service *timers, const void *key, const void *future) {
+	detail::pending_task task;
+	{
+		std::lock_guard<std::mutex> lock(coalesced_tasks.mutex);
+		auto it = coalesced_tasks.entries.find(key);
+		if (it == coalesced_tasks.entries.end() || it->second.future.get() != future) {
+			return;
+		}
+		if (it->second.deadline > std::chrono::steady_clock::now()) {
+			auto deadline = it->second.deadline;
+			timers->when_expired(deadline, [this, timers, key, future](int error) {
+				if (!error) {
+					enqueue_debounced(timers, key, future);
+				}
+			});
+			return;
+		}
+		task.work = std::move(it->second.work);
+		coalesced_tasks.entries.erase(it);
+	}
+	post_internal(std::move(task));
+}
+
+#ifdef __linux__
+detail::io_reactor& dispatch_queue::get_io_reactor() {
+	std::lock_guard<std::mutex> lock(io_reactor_mutex);
+	if (!io_reactor) {
+		io_reactor = std::make_unique<detail::io_reactor>();
+	}
+	return *io_reactor;
 }
+#endif
 
 } // end namespace dispatch_queue
@@ -0,0 +1,239 @@
+#include "../include/io_reactor.hpp"
+
+#ifdef __linux__
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+namespace dispatch_queue {
+
+namespace detail {
+
+bool io_operation::is_write() const {
+	return type == kind::write;
+}
+
+bool io_operation::is_ready() const {
+	struct pollfd pfd = { fd, (short) (is_write() ? POLLOUT : POLLIN), 0 };
+	int result;
+	while ((result = poll(&pfd, 1, 0)) < 0 && errno == EINTR) {}
+	return result != 0;
+}
+
+ssize_t io_operation::perform() const {
+	ssize_t result;
+	switch (type) {
+		case kind::read:
+			while ((result = ::read(fd, buffer, size)) < 0 && errno == EINTR) {}
+			break;
+
+		case kind::write:
+			while ((result = ::write(fd, buffer, size)) < 0 && errno == EINTR) {}
+			break;
+
+		case kind::accept:
+			while ((result = ::accept4(fd, address, address_length, SOCK_CLOEXEC)) < 0 && errno == EINTR) {}
+			break;
+
+		default:
+			errno = EINVAL;
+			result = -1;
+			break;
+	}
+	return result;
+}
+
+io_reactor::io_reactor()
+	: epoll_fd(epoll_create1(EPOLL_CLOEXEC))
+	, timer_fd(timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK))
+{
+	struct epoll_event event = {};
+	event.events = EPOLLIN;
+	event.data.fd = timer_fd;
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, timer_fd, &event);
+	event.data.fd = wakeup.native_handle();
+	epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wakeup.native_handle(), &event);
+	thread = std::thread(&io_reactor::run, this);
+}
+
+io_reactor::~io_reactor() {
+	std::vector<std::function<void(int)>> cancelled_callbacks;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		is_shutting_down = true;
+		take_callbacks(cancelled_callbacks);
+	}
+	wakeup.notify();
+	thread.join();
+	close(timer_fd);
+	close(epoll_fd);
+
+	// Waiters would never be called back otherwise, leaking suspended coroutines
+	for (auto& callback : cancelled_callbacks) {
+		callback(ECANCELED);
+	}
+}
+
+int io_reactor::when_ready(int fd, bool for_write, std::function<void(int)> callback) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (is_shutting_down) {
+		return ECANCELED;
+	}
+	if (failure) {
+		return failure;
+	}
+	auto it = watched.find(fd);
+	bool is_new = it == watched.end();
+	if (is_new) {
+		it = watched.emplace(fd, fd_waiters()).first;
+	}
+	std::function<void(int)>& waiter = for_write ? it->second.writer : it->second.reader;
+	if (waiter) {
+		return EBUSY;
+	}
+	waiter = std::move(callback);
+	if (!watch(fd, it->second, is_new ? EPOLL_CTL_ADD : EPOLL_CTL_MOD)) {
+		int error = errno;
+		waiter = nullptr;
+		if (is_new) {
+			watched.erase(it);
+		}
+		return error;
+	}
+	return 0;
+}
+
+int io_reactor::when_expired(std::chrono::steady_clock::time_point deadline, std::function<void(int)> callback) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (is_shutting_down) {
+		return ECANCELED;
+	}
+	if (failure) {
+		return failure;
+	}
+	timers.push_back({ deadline, std::move(callback) });
+	std::push_heap(timers.begin(), timers.end(), std::greater<timer>());
+	if (timers.front().deadline == deadline) {
+		arm_timer();
+	}
+	return 0;
+}
+
+void io_reactor::run() {
+	struct epoll_event events[64];
+	while (true) {
+		int count = epoll_wait(epoll_fd, events, 64, -1);
+		if (count < 0 && errno != EINTR) {
+			// Nothing would call waiters back anymore: fail them, along with later registrations
+			int error = errno;
+			std::vector<std::function<void(int)>> failed_callbacks;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				failure = error;
+				take_callbacks(failed_callbacks);
+			}
+			for (auto& callback : failed_callbacks) {
+				callback(error);
+			}
+			return;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (is_shutting_down) {
+				return;
+			}
+			for (int i = 0; i < count; i++) {
+				int fd = events[i].data.fd;
+				if (fd == timer_fd) {
+					uint64_t expirations;
+					while (read(timer_fd, &expirations, sizeof(expirations)) < 0 && errno == EINTR) {}
+					auto now = std::chrono::steady_clock::now();
+					while (!timers.empty() && timers.front().deadline <= now) {
+						std::pop_heap(timers.begin(), timers.end(), std::greater<timer>());
+						ready_callbacks.push_back(std::move(timers.back().callback));
+						timers.pop_back();
+					}
+					arm_timer();
+					continue;
+				}
+
+				auto it = watched.find(fd);
+				if (it == watched.end()) {
+					continue;
+				}
+				uint32_t ready_events = events[i].events;
+				if ((ready_events & (EPOLLIN | EPOLLERR | EPOLLHUP)) && it->second.reader) {
+					ready_callbacks.push_back(std::move(it->second.reader));
+					it->second.reader = nullptr;
+				}
+				if ((ready_events & (EPOLLOUT | EPOLLERR | EPOLLHUP)) && it->second.writer) {
+					ready_callbacks.push_back(std::move(it->second.writer));
+					it->second.writer = nullptr;
+				}
+				// Registrations are one-shot: rearm for remaining waiters or stop watching
+				if (it->second.reader || it->second.writer) {
+					watch(fd, it->second, EPOLL_CTL_MOD);
+				}
+				else {
+					epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+					watched.erase(it);
+				}
+			}
+		}
+
+		for (auto& callback : ready_callbacks) {
+			callback(0);
+		}
+		ready_callbacks.clear();
+	}
+}
+
+void io_reactor::take_callbacks(std::vector<std::function<void(int)>>& callbacks) {
+	for (auto& entry : watched) {
+		if (entry.second.reader) {
+			callbacks.push_back(std::move(entry.second.reader));
+		}
+		if (entry.second.writer) {
+			callbacks.push_back(std::move(entry.second.writer));
+		}
+	}
+	watched.clear();
+	for (timer& pending_timer : timers) {
+		callbacks.push_back(std::move(pending_timer.callback));
+	}
+	timers.clear();
+}
+
+void io_reactor::arm_timer() {
+	struct itimerspec spec = {};
+	if (!timers.empty()) {
+		auto deadline = timers.front().deadline.time_since_epoch();
+		auto seconds = std::chrono::duration_cast<std::chrono::seconds>(deadline);
+		spec.it_value.tv_sec = (time_t) seconds.count();
+		spec.it_value.tv_nsec = (long) std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - seconds).count();
+		if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+			// A zero value disarms the timer
+			spec.it_value.tv_nsec = 1;
+		}
+	}
+	timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &spec, nullptr);
+}
+
+bool io_reactor::watch(int fd, const fd_waiters& waiters, int operation) {
+	struct epoll_event event = {};
+	event.events = EPOLLONESHOT | (waiters.reader ? (uint32_t) EPOLLIN : 0u) | (waiters.writer ? (uint32_t) EPOLLOUT : 0u);
+	event.data.fd = fd;
+	return epoll_ctl(epoll_fd, operation, fd, &event) == 0;
+}
+
+} // end namespace detail
+
+} // end namespace dispatch_queue
+
+#endif
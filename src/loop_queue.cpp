@@ -0,0 +1,62 @@
+#include "../include/loop_queue.hpp"
+
+namespace dispatch_queue {
+
+namespace detail {
+
+loop_queue::loop_queue(std::string&& name)
+	: loop_name(std::move(name))
+{
+}
+
+const std::string& loop_queue::name() const {
+	return loop_name;
+}
+
+bool loop_queue::empty() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return tasks.empty();
+}
+
+size_t loop_queue::size() {
+	std::lock_guard<std::mutex> lock(mutex);
+	return tasks.size();
+}
+
+void loop_queue::clear() {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!tasks.empty()) {
+		tasks_event.reset();
+		tasks.clear();
+	}
+}
+
+void loop_queue::push(pending_task&& task) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if (tasks.empty()) {
+		tasks_event.notify();
+	}
+	tasks.push_back(std::move(task));
+}
+
+std::deque<pending_task> loop_queue::pop_all() {
+	std::deque<pending_task> result;
+	std::lock_guard<std::mutex> lock(mutex);
+	if (!tasks.empty()) {
+		tasks_event.reset();
+		tasks.swap(result);
+	}
+	return result;
+}
+
+wakeup_event& loop_queue::event() {
+	return tasks_event;
+}
+
+const wakeup_event& loop_queue::event() const {
+	return tasks_event;
+}
+
+} // end namespace detail
+
+} // end namespace dispatch_queue
@@ -1,34 +1,56 @@
 #include "../include/pending_task_queue.hpp"
 
+#include <utility>
+
 namespace dispatch_queue {
 
 namespace detail {
 
 bool pending_task_queue::empty() const {
-	return background_tasks.empty();
+	return count == 0;
 }
 
 size_t pending_task_queue::size() const {
-	return background_tasks.size();
+	return count;
 }
 
 void pending_task_queue::clear() {
-	background_tasks.clear();
+	for (; count > 0; count--) {
+		background_tasks[head] = {};
+		head = (head + 1) & (background_tasks.size() - 1);
+	}
+	head = 0;
 }
 
-void pending_task_queue::push(pending_task&& task, bool run_on_main_loop) {
-	if (run_on_main_loop) {
-		main_loop_tasks.push_back(std::move(task));
+void pending_task_queue::swap(pending_task_queue& other) {
+	background_tasks.swap(other.background_tasks);
+	std::swap(head, other.head);
+	std::swap(count, other.count);
+}
+
+void pending_task_queue::push(pending_task&& task) {
+	if (count == background_tasks.size()) {
+		grow();
 	}
-	else {
-		background_tasks.push_back(std::move(task));
+	background_tasks[(head + count) & (background_tasks.size() - 1)] = std::move(task);
+	count++;
+}
+
+void pending_task_queue::push_front(pending_task&& task) {
+	if (count == background_tasks.size()) {
+		grow();
 	}
+	head = (head - 1) & (background_tasks.size() - 1);
+	background_tasks[head] = std::move(task);
+	count++;
 }
 
 bool pending_task_queue::try_pop(pending_task& task) {
-	if (!background_tasks.empty()) {
-		task = std::move(background_tasks.front());
-		background_tasks.pop_front();
+	if (count > 0) {
+		task = std::move(background_tasks[head]);
+		background_tasks[head] = {};
+		head = (head + 1) & (background_tasks.size() - 1);
+		count--;
 		return true;
 	}
 	else {
@@ -37,10 +59,18 @@ bool pending_task_queue::try_pop(pending_task& task) {
 	}
 }
 
-std::deque<pending_task> pending_task_queue::pop_main_loop_tasks() {
-	std::deque<pending_task> result;
-	main_loop_tasks.swap(result);
-	return result;
+const pending_task *pending_task_queue::front() const {
+	return count > 0 ? &background_tasks[head] : nullptr;
+}
+
+void pending_task_queue::grow() {
+	// capacity is always a power of two, so indices wrap with a mask
+	std::vector<pending_task> new_tasks(background_tasks.empty() ? 16 : background_tasks.size() * 2);
+	for (size_t i = 0; i < count; i++) {
+		new_tasks[i] = std::move(background_tasks[(head + i) & (background_tasks.size() - 1)]);
+	}
+	background_tasks.swap(new_tasks);
+	head = 0;
 }
 
 } // end namespace detail
@@ -0,0 +1,85 @@
+#include "../include/queue_stats.hpp"
+
+namespace dispatch_queue {
+
+constexpr int duration_histogram::sub_bucket_bits;
+constexpr int duration_histogram::sub_bucket_count;
+constexpr int duration_histogram::bucket_count;
+
+static int log2_floor(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+	return 63 - __builtin_clzll(value);
+#else
+	int result = 0;
+	while (value >>= 1) {
+		result++;
+	}
+	return result;
+#endif
+}
+
+uint64_t duration_histogram::count() const {
+	uint64_t total = 0;
+	for (uint64_t bucket : bucket_counts) {
+		total += bucket;
+	}
+	return total;
+}
+
+std::chrono::nanoseconds duration_histogram::percentile(double p) const {
+	uint64_t total = count();
+	if (total == 0) {
+		return std::chrono::nanoseconds::zero();
+	}
+	uint64_t rank = (uint64_t) (total * (p / 100.0));
+	if (rank >= total) {
+		rank = total - 1;
+	}
+	uint64_t seen = 0;
+	for (int i = 0; i < bucket_count; i++) {
+		seen += bucket_counts[i];
+		if (seen > rank) {
+			return bucket_upper_bound(i);
+		}
+	}
+	return bucket_upper_bound(bucket_count - 1);
+}
+
+const std::array<uint64_t, duration_histogram::bucket_count>& duration_histogram::buckets() const {
+	return bucket_counts;
+}
+
+std::chrono::nanoseconds duration_histogram::bucket_lower_bound(int index) {
+	if (index < sub_bucket_count) {
+		return std::chrono::nanoseconds(index);
+	}
+	int exponent = (index - sub_bucket_count) / sub_bucket_count + sub_bucket_bits;
+	uint64_t sub_bucket = (index - sub_bucket_count) % sub_bucket_count;
+	return std::chrono::nanoseconds((sub_bucket_count + sub_bucket) << (exponent - sub_bucket_bits));
+}
+
+std::chrono::nanoseconds duration_histogram::bucket_upper_bound(int index) {
+	if (index + 1 >= bucket_count) {
+		return std::chrono::nanoseconds::max();
+	}
+	return bucket_lower_bound(index + 1) - std::chrono::nanoseconds(1);
+}
+
+int duration_histogram::bucket_index(uint64_t nanoseconds) {
+	if (nanoseconds < (uint64_t) sub_bucket_count) {
+		return (int) nanoseconds;
+	}
+	int exponent = log2_floor(nanoseconds);
+	int sub_bucket = (nanoseconds >> (exponent - sub_bucket_bits)) & (sub_bucket_count - 1);
+	return sub_bucket_count + (exponent - sub_bucket_bits) * sub_bucket_count + sub_bucket;
+}
+
+void duration_histogram::record(std::chrono::nanoseconds duration) {
+	add(bucket_index(duration.count() > 0 ? duration.count() : 0), 1);
+}
+
+void duration_histogram::add(int index, uint64_t count) {
+	bucket_counts[index] += count;
+}
+
+} // end namespace dispatch_queue
@@ -0,0 +1,74 @@
+#include "../include/scratch_arena.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <new>
+
+namespace dispatch_queue {
+
+scratch_arena::scratch_arena(size_t initial_capacity)
+	: initial_capacity(std::max(initial_capacity, (size_t) 64))
+{
+}
+
+scratch_arena::~scratch_arena() {
+	free_chunks();
+}
+
+void *scratch_arena::allocate(size_t size, size_t alignment) {
+	uintptr_t aligned = ((uintptr_t) cursor + alignment - 1) & ~(uintptr_t) (alignment - 1);
+	if (!current_chunk || aligned + size > (uintptr_t) end) {
+		add_chunk(size + alignment);
+		aligned = ((uintptr_t) cursor + alignment - 1) & ~(uintptr_t) (alignment - 1);
+	}
+	cursor = (char *) aligned + size;
+	used_bytes += size;
+	return (void *) aligned;
+}
+
+void scratch_arena::reset() {
+	if (!current_chunk) {
+		return;
+	}
+	if (current_chunk->previous) {
+		// Merge chunks, so that the next cycle fits in a single one
+		size_t merged_size = total_capacity;
+		free_chunks();
+		add_chunk(merged_size);
+	}
+	else {
+		cursor = (char *) (current_chunk + 1);
+	}
+	used_bytes = 0;
+}
+
+size_t scratch_arena::used() const {
+	return used_bytes;
+}
+
+size_t scratch_arena::capacity() const {
+	return total_capacity;
+}
+
+void scratch_arena::add_chunk(size_t min_size) {
+	size_t size = std::max(current_chunk ? current_chunk->size * 2 : initial_capacity, min_size);
+	chunk_header *chunk = static_cast<chunk_header *>(::operator new(sizeof(chunk_header) + size));
+	chunk->previous = current_chunk;
+	chunk->size = size;
+	current_chunk = chunk;
+	cursor = (char *) (chunk + 1);
+	end = cursor + size;
+	total_capacity += size;
+}
+
+void scratch_arena::free_chunks() {
+	while (current_chunk) {
+		chunk_header *previous = current_chunk->previous;
+		::operator delete(current_chunk);
+		current_chunk = previous;
+	}
+	cursor = end = nullptr;
+	total_capacity = 0;
+}
+
+} // end namespace dispatch_queue
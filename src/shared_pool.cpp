@@ -0,0 +1,24 @@
+#include "../include/shared_pool.hpp"
+
+namespace dispatch_queue {
+
+shared_pool::shared_pool(int thread_count)
+	: shared_pool(thread_count, [](int){})
+{
+}
+
+shared_pool::shared_pool(int thread_count, worker_options options)
+	: shared_pool(thread_count, std::move(options), [](int){})
+{
+}
+
+shared_pool& shared_pool::global() {
+	static shared_pool pool;
+	return pool;
+}
+
+int shared_pool::thread_count() const {
+	return pool->thread_count();
+}
+
+} // end namespace dispatch_queue
@@ -0,0 +1,53 @@
+#include "../include/stats_counters.hpp"
+
+namespace dispatch_queue {
+
+namespace detail {
+
+static uint64_t to_nanoseconds(std::chrono::nanoseconds duration) {
+	return duration.count() > 0 ? duration.count() : 0;
+}
+
+void worker_stats_counters::record_idle(std::chrono::nanoseconds idle_time) {
+	add_relaxed(idle_nanoseconds, to_nanoseconds(idle_time));
+}
+
+void worker_stats_counters::record_wait(std::chrono::nanoseconds wait_time) {
+	add_relaxed(wait_time_buckets[duration_histogram::bucket_index(to_nanoseconds(wait_time))], 1);
+}
+
+void worker_stats_counters::record_run(std::chrono::nanoseconds run_time, bool succeeded) {
+	add_relaxed(succeeded ? completed : failed, 1);
+	add_relaxed(busy_nanoseconds, to_nanoseconds(run_time));
+	add_relaxed(run_time_buckets[duration_histogram::bucket_index(to_nanoseconds(run_time))], 1);
+}
+
+void worker_stats_counters::reset() {
+	completed.store(0, std::memory_order_relaxed);
+	failed.store(0, std::memory_order_relaxed);
+	busy_nanoseconds.store(0, std::memory_order_relaxed);
+	idle_nanoseconds.store(0, std::memory_order_relaxed);
+	for (int i = 0; i < duration_histogram::bucket_count; i++) {
+		wait_time_buckets[i].store(0, std::memory_order_relaxed);
+		run_time_buckets[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+void worker_stats_counters::add_to(pool_stats& stats) const {
+	worker_stats worker;
+	worker.completed = completed.load(std::memory_order_relaxed);
+	worker.failed = failed.load(std::memory_order_relaxed);
+	worker.busy_time = std::chrono::nanoseconds(busy_nanoseconds.load(std::memory_order_relaxed));
+	worker.idle_time = std::chrono::nanoseconds(idle_nanoseconds.load(std::memory_order_relaxed));
+	stats.completed += worker.completed;
+	stats.failed += worker.failed;
+	stats.workers.push_back(worker);
+	for (int i = 0; i < duration_histogram::bucket_count; i++) {
+		stats.wait_time.add(i, wait_time_buckets[i].load(std::memory_order_relaxed));
+		stats.run_time.add(i, run_time_buckets[i].load(std::memory_order_relaxed));
+	}
+}
+
+} // end namespace detail
+
+} // end namespace dispatch_queue
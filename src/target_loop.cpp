@@ -0,0 +1,45 @@
+#include "../include/target_loop.hpp"
+
+namespace dispatch_queue {
+
+target_loop::target_loop(std::string&& name)
+	: queue(std::make_shared<detail::loop_queue>(std::move(name)))
+{
+}
+
+bool target_loop::valid() const {
+	return (bool) queue;
+}
+
+const std::string& target_loop::name() const {
+	return queue->name();
+}
+
+size_t target_loop::size() const {
+	return queue->size();
+}
+
+bool target_loop::empty() const {
+	return queue->empty();
+}
+
+void target_loop::clear() {
+	queue->clear();
+}
+
+void target_loop::run() {
+	std::deque<detail::pending_task> tasks = queue->pop_all();
+	for (auto&& it : tasks) {
+		it();
+	}
+}
+
+int target_loop::fd() const {
+	return queue->event().native_handle();
+}
+
+void target_loop::wait() {
+	queue->event().wait();
+}
+
+} // end namespace dispatch_queue
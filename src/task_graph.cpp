@@ -0,0 +1,176 @@
+#include "../include/task_graph.hpp"
+
+#include "../include/dispatch_queue.hpp"
+
+namespace dispatch_queue {
+
+task_graph::node_id task_graph::add_node(std::function<void()> work, const char *label) {
+	nodes.emplace_back();
+	nodes.back().work = std::move(work);
+	nodes.back().label = label;
+	is_validated = false;
+	return nodes.size() - 1;
+}
+
+void task_graph::add_edge(node_id before, node_id after) {
+	nodes[before].successors.push_back(after);
+	nodes[after].predecessor_count++;
+	is_validated = false;
+}
+
+size_t task_graph::node_count() const {
+	return nodes.size();
+}
+
+const char *task_graph::label(node_id node) const {
+	return nodes[node].label;
+}
+
+bool task_graph::run(dispatch_queue& queue) {
+	validate();
+	if (!is_acyclic) {
+		return false;
+	}
+	if (nodes.empty()) {
+		return true;
+	}
+
+	running_queue = &queue;
+	first_exception = nullptr;
+	is_finished = false;
+	for (node& n : nodes) {
+		n.pending_predecessors.store(n.predecessor_count, std::memory_order_relaxed);
+	}
+	remaining_nodes.store(nodes.size(), std::memory_order_relaxed);
+	run_start = std::chrono::steady_clock::now();
+	for (node_id root : roots) {
+		queue.post([this, root]() {
+			execute(root);
+		});
+	}
+
+	std::unique_lock<std::mutex> lock(mutex);
+	finished_condition_variable.wait(lock, [this]() { return is_finished; });
+	running_queue = nullptr;
+#ifdef __cpp_exceptions
+	if (first_exception) {
+		std::rethrow_exception(first_exception);
+	}
+#endif
+	return true;
+}
+
+task_graph::node_timing task_graph::timing(node_id node) const {
+	return nodes[node].last_timing;
+}
+
+std::vector<task_graph::node_id> task_graph::critical_path() const {
+	const node_id no_node = (node_id) -1;
+	std::vector<uint32_t> pending(nodes.size());
+	std::vector<std::chrono::nanoseconds> path_duration(nodes.size());
+	std::vector<node_id> path_parent(nodes.size(), no_node);
+	std::vector<node_id> ready;
+	for (node_id i = 0; i < nodes.size(); i++) {
+		pending[i] = nodes[i].predecessor_count;
+		if (pending[i] == 0) {
+			ready.push_back(i);
+		}
+	}
+
+	node_id path_end = no_node;
+	while (!ready.empty()) {
+		node_id id = ready.back();
+		ready.pop_back();
+		path_duration[id] += nodes[id].last_timing.duration();
+		if (path_end == no_node || path_duration[id] > path_duration[path_end]) {
+			path_end = id;
+		}
+		for (node_id successor : nodes[id].successors) {
+			if (path_parent[successor] == no_node || path_duration[id] > path_duration[successor]) {
+				path_duration[successor] = path_duration[id];
+				path_parent[successor] = id;
+			}
+			if (--pending[successor] == 0) {
+				ready.push_back(successor);
+			}
+		}
+	}
+
+	std::vector<node_id> path;
+	for (node_id id = path_end; id != no_node; id = path_parent[id]) {
+		path.insert(path.begin(), id);
+	}
+	return path;
+}
+
+void task_graph::validate() {
+	if (is_validated) {
+		return;
+	}
+
+	roots.clear();
+	std::vector<uint32_t> pending(nodes.size());
+	std::vector<node_id> ready;
+	for (node_id i = 0; i < nodes.size(); i++) {
+		pending[i] = nodes[i].predecessor_count;
+		if (pending[i] == 0) {
+			roots.push_back(i);
+			ready.push_back(i);
+		}
+	}
+	size_t visited = 0;
+	while (!ready.empty()) {
+		node_id id = ready.back();
+		ready.pop_back();
+		visited++;
+		for (node_id successor : nodes[id].successors) {
+			if (--pending[successor] == 0) {
+				ready.push_back(successor);
+			}
+		}
+	}
+	is_acyclic = visited == nodes.size();
+	is_validated = true;
+}
+
+void task_graph::execute(node_id id) {
+	const node_id no_node = (node_id) -1;
+	while (id != no_node) {
+		node& n = nodes[id];
+		auto start = std::chrono::steady_clock::now();
+		DISPATCH_QUEUE_TRY {
+			n.work();
+		}
+		DISPATCH_QUEUE_CATCH(...) {
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!first_exception) {
+				first_exception = std::current_exception();
+			}
+		}
+		n.last_timing = { start - run_start, std::chrono::steady_clock::now() - run_start };
+
+		// Keep running the first ready successor in this thread, post the others
+		node_id next = no_node;
+		for (node_id successor : n.successors) {
+			if (nodes[successor].pending_predecessors.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+				if (next == no_node) {
+					next = successor;
+				}
+				else {
+					running_queue->post([this, successor]() {
+						execute(successor);
+					});
+				}
+			}
+		}
+
+		if (remaining_nodes.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+			std::lock_guard<std::mutex> lock(mutex);
+			is_finished = true;
+			finished_condition_variable.notify_all();
+		}
+		id = next;
+	}
+}
+
+} // end namespace dispatch_queue
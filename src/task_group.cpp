@@ -0,0 +1,110 @@
+#include "../include/task_group.hpp"
+
+#include "../include/dispatch_queue.hpp"
+
+namespace dispatch_queue {
+
+namespace detail {
+
+///////////////////////////////////////////////////////////
+// task_group_state
+///////////////////////////////////////////////////////////
+void task_group_state::add() {
+	pending_count.fetch_add(1, std::memory_order_relaxed);
+}
+
+void task_group_state::push(pending_task&& child) {
+	std::lock_guard<std::mutex> lock(mutex);
+	children.push(std::move(child));
+	if (sleeping_waiters > 0) {
+		// Children may run more children while the group is being waited
+		condition_variable.notify_one();
+	}
+}
+
+bool task_group_state::run_one() {
+	pending_task child;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (!children.try_pop(child)) {
+			return false;
+		}
+	}
+	DISPATCH_QUEUE_TRY {
+		child();
+	}
+	DISPATCH_QUEUE_CATCH(...) {
+		std::lock_guard<std::mutex> lock(mutex);
+		exceptions.push_back(std::current_exception());
+	}
+	finish_one();
+	return true;
+}
+
+void task_group_state::finish_one() {
+	if (pending_count.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		// Lock so that waiters either see the count reach zero or get notified
+		std::lock_guard<std::mutex> lock(mutex);
+		condition_variable.notify_all();
+	}
+}
+
+std::vector<std::exception_ptr> task_group_state::wait() {
+	while (true) {
+		if (run_one()) {
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(mutex);
+		if (children.empty()) {
+			// Remaining children are running in other threads
+			sleeping_waiters++;
+			condition_variable.wait(lock, [this] {
+				return pending_count.load(std::memory_order_acquire) == 0 || !children.empty();
+			});
+			sleeping_waiters--;
+		}
+		if (pending_count.load(std::memory_order_acquire) == 0) {
+			std::vector<std::exception_ptr> collected;
+			collected.swap(exceptions);
+			return collected;
+		}
+	}
+}
+
+} // end namespace detail
+
+///////////////////////////////////////////////////////////
+// task_group
+///////////////////////////////////////////////////////////
+task_group::task_group(dispatch_queue& queue)
+	: queue(queue)
+	, state(std::make_shared<detail::task_group_state>())
+{
+}
+
+task_group::~task_group() {
+	state->wait();
+}
+
+void task_group::post_runner() {
+	std::shared_ptr<detail::task_group_state> shared_state = state;
+	queue.post([shared_state] {
+		// The child may have been run by `wait` already
+		shared_state->run_one();
+	});
+}
+
+void task_group::wait() {
+	last_exceptions = state->wait();
+#ifdef __cpp_exceptions
+	if (!last_exceptions.empty()) {
+		std::rethrow_exception(last_exceptions.front());
+	}
+#endif
+}
+
+const std::vector<std::exception_ptr>& task_group::exceptions() const {
+	return last_exceptions;
+}
+
+} // end namespace dispatch_queue
@@ -0,0 +1,59 @@
+#include "../include/task_watchdog.hpp"
+
+#include <algorithm>
+
+namespace dispatch_queue {
+
+namespace detail {
+
+task_watchdog::task_watchdog(std::chrono::nanoseconds threshold, std::function<void(const stalled_task&)> callback, std::function<void(std::vector<watchdog_slot *>&)> collect_slots)
+	: threshold(threshold)
+	, callback(std::move(callback))
+	, collect_slots(std::move(collect_slots))
+	, thread(&task_watchdog::run, this)
+{
+}
+
+task_watchdog::~task_watchdog() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		is_shutting_down = true;
+	}
+	condition_variable.notify_one();
+	thread.join();
+}
+
+void task_watchdog::run() {
+	// Checking twice per threshold flags tasks at most half a threshold late
+	std::chrono::nanoseconds period = std::max<std::chrono::nanoseconds>(threshold / 2, std::chrono::milliseconds(1));
+	std::vector<watchdog_slot *> slots;
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!condition_variable.wait_for(lock, period, [this] { return is_shutting_down; })) {
+		lock.unlock();
+		slots.clear();
+		collect_slots(slots);
+		check(slots);
+		lock.lock();
+	}
+}
+
+void task_watchdog::check(const std::vector<watchdog_slot *>& slots) {
+	int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+	for (watchdog_slot *slot : slots) {
+		int64_t start = slot->task_start.load(std::memory_order_acquire);
+		if (start == 0 || start == slot->reported_start || std::chrono::steady_clock::duration(now - start) < threshold) {
+			continue;
+		}
+		const char *label = slot->task_label.load(std::memory_order_acquire);
+		if (slot->task_start.load(std::memory_order_acquire) != start) {
+			// Another task started meanwhile, so the label may not be the stalled task's
+			continue;
+		}
+		slot->reported_start = start;
+		callback(stalled_task { label, slot->worker_index, std::chrono::steady_clock::duration(now - start) });
+	}
+}
+
+} // end namespace detail
+
+} // end namespace dispatch_queue
@@ -0,0 +1,30 @@
+#include "../include/this_worker.hpp"
+
+#include "../include/worker_pool.hpp"
+
+namespace dispatch_queue {
+
+namespace this_worker {
+
+namespace {
+
+thread_local scratch_arena thread_arena;
+
+} // end anonymous namespace
+
+int index() {
+	return detail::worker_pool::current_worker_index();
+}
+
+dispatch_queue *queue() {
+	detail::task_source *source = detail::worker_pool::current_source();
+	return source ? source->owner : nullptr;
+}
+
+scratch_arena& arena() {
+	return thread_arena;
+}
+
+} // end namespace this_worker
+
+} // end namespace dispatch_queue
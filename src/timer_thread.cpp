@@ -0,0 +1,75 @@
+#include "../include/timer_thread.hpp"
+
+#ifndef __linux__
+
+#include <algorithm>
+#include <cerrno>
+
+namespace dispatch_queue {
+
+namespace detail {
+
+timer_thread::timer_thread()
+	: thread(&timer_thread::run, this)
+{
+}
+
+timer_thread::~timer_thread() {
+	std::vector<timer> cancelled_timers;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		is_shutting_down = true;
+		cancelled_timers.swap(timers);
+	}
+	condition_variable.notify_one();
+	thread.join();
+
+	for (timer& cancelled_timer : cancelled_timers) {
+		cancelled_timer.callback(ECANCELED);
+	}
+}
+
+int timer_thread::when_expired(std::chrono::steady_clock::time_point deadline, std::function<void(int)> callback) {
+	bool is_earliest;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (is_shutting_down) {
+			return ECANCELED;
+		}
+		timers.push_back({ deadline, std::move(callback) });
+		std::push_heap(timers.begin(), timers.end(), std::greater<timer>());
+		is_earliest = timers.front().deadline == deadline;
+	}
+	if (is_earliest) {
+		condition_variable.notify_one();
+	}
+	return 0;
+}
+
+void timer_thread::run() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while (!is_shutting_down) {
+		if (timers.empty()) {
+			condition_variable.wait(lock);
+			continue;
+		}
+		auto deadline = timers.front().deadline;
+		if (std::chrono::steady_clock::now() < deadline) {
+			condition_variable.wait_until(lock, deadline);
+			continue;
+		}
+		std::pop_heap(timers.begin(), timers.end(), std::greater<timer>());
+		std::function<void(int)> callback = std::move(timers.back().callback);
+		timers.pop_back();
+
+		lock.unlock();
+		callback(0);
+		lock.lock();
+	}
+}
+
+} // end namespace detail
+
+} // end namespace dispatch_queue
+
+#endif
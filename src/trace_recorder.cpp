@@ -0,0 +1,216 @@
+#include "../include/trace_recorder.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+namespace dispatch_queue {
+
+namespace detail {
+
+constexpr uint64_t trace_buffer::capacity;
+
+namespace {
+
+struct current_traced_task {
+	uint32_t pool_id;
+	uint64_t task_id;
+	const char *label;
+};
+
+thread_local trace_buffer *current_buffer = nullptr;
+thread_local std::string current_thread_name;
+thread_local current_traced_task current_task = {};
+
+const std::chrono::steady_clock::time_point trace_epoch = std::chrono::steady_clock::now();
+
+void write_json_string(std::ostream& os, const char *str) {
+	os << '"';
+	for (; *str; str++) {
+		switch (*str) {
+			case '"': os << "\\\""; break;
+			case '\\': os << "\\\\"; break;
+			case '\n': os << "\\n"; break;
+			case '\t': os << "\\t"; break;
+			default:
+				if ((unsigned char) *str < 0x20) {
+					char escaped[8];
+					snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char) *str);
+					os << escaped;
+				}
+				else {
+					os << *str;
+				}
+				break;
+		}
+	}
+	os << '"';
+}
+
+void write_event_header(std::ostream& os, const char *phase, const char *name, uint32_t pool_id, uint32_t thread_id, uint64_t timestamp) {
+	char ts[32];
+	snprintf(ts, sizeof(ts), "%llu.%03llu", (unsigned long long) (timestamp / 1000), (unsigned long long) (timestamp % 1000));
+	os << "{\"ph\":\"" << phase << "\",\"name\":";
+	write_json_string(os, name);
+	os << ",\"cat\":\"dispatch_queue\",\"pid\":" << pool_id << ",\"tid\":" << thread_id << ",\"ts\":" << ts;
+}
+
+} // end anonymous namespace
+
+trace_recorder& trace_recorder::instance() {
+	static trace_recorder recorder;
+	return recorder;
+}
+
+uint32_t trace_recorder::new_pool_id() {
+	return next_pool_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t trace_recorder::new_task_id() {
+	return next_task_id.fetch_add(1, std::memory_order_relaxed);
+}
+
+void trace_recorder::record(trace_event_type type, uint32_t pool_id, uint64_t task_id, const char *label, uint32_t data) {
+	uint64_t timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - trace_epoch).count();
+	trace_buffer& buffer = thread_buffer();
+	uint64_t head = buffer.head.load(std::memory_order_relaxed);
+	// Readers that see any field of the new event also see the previous head store, so they discard their copy
+	std::atomic_thread_fence(std::memory_order_release);
+	buffer.events[head % trace_buffer::capacity].store({ timestamp, task_id, label, pool_id, data, type });
+	buffer.head.store(head + 1, std::memory_order_release);
+}
+
+void trace_recorder::write_chrome_trace(std::ostream& os, uint32_t pool_id) {
+	std::lock_guard<std::mutex> lock(mutex);
+	os << "{\"traceEvents\":[\n";
+	os << "{\"ph\":\"M\",\"name\":\"process_name\",\"pid\":" << pool_id << ",\"args\":{\"name\":\"dispatch_queue " << pool_id << "\"}}";
+	std::vector<trace_event> events;
+	for (auto& buffer : buffers) {
+		uint64_t head = buffer->head.load(std::memory_order_acquire);
+		uint64_t tail = buffer->tail.load(std::memory_order_relaxed);
+		if (head > trace_buffer::capacity && tail < head - trace_buffer::capacity) {
+			tail = head - trace_buffer::capacity;
+		}
+		events.clear();
+		for (uint64_t i = tail; i < head; i++) {
+			events.push_back(buffer->events[i % trace_buffer::capacity].load());
+		}
+		// The owner may have wrapped around onto the first copied slots meanwhile: drop those, as they may be torn.
+		// The slot of event `i` is only rewritten once `head` reaches `i + capacity`.
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint64_t current_head = buffer->head.load(std::memory_order_relaxed);
+		size_t first_intact = 0;
+		if (current_head >= tail + trace_buffer::capacity) {
+			first_intact = (size_t) std::min(current_head - trace_buffer::capacity + 1 - tail, head - tail);
+		}
+		bool wrote_thread_name = false;
+		for (size_t i = first_intact; i < events.size(); i++) {
+			const trace_event& event = events[i];
+			if (event.pool_id != pool_id) {
+				continue;
+			}
+			if (!wrote_thread_name) {
+				os << ",\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":" << pool_id << ",\"tid\":" << buffer->thread_id << ",\"args\":{\"name\":";
+				write_json_string(os, buffer->thread_name.c_str());
+				os << "}}";
+				wrote_thread_name = true;
+			}
+			const char *label = event.label ? event.label : "task";
+			os << ",\n";
+			switch (event.type) {
+				case trace_event_type::enqueue:
+					write_event_header(os, "i", "enqueue", pool_id, buffer->thread_id, event.timestamp);
+					os << ",\"s\":\"t\",\"args\":{\"id\":" << event.task_id << ",\"label\":";
+					write_json_string(os, label);
+					os << "}},\n";
+					write_event_header(os, "s", label, pool_id, buffer->thread_id, event.timestamp);
+					os << ",\"id\":" << event.task_id << "}";
+					break;
+
+				case trace_event_type::dequeue:
+					write_event_header(os, "i", "dequeue", pool_id, buffer->thread_id, event.timestamp);
+					os << ",\"s\":\"t\",\"args\":{\"id\":" << event.task_id << "}}";
+					break;
+
+				case trace_event_type::start:
+					write_event_header(os, "B", label, pool_id, buffer->thread_id, event.timestamp);
+					os << ",\"args\":{\"id\":" << event.task_id << "}},\n";
+					write_event_header(os, "f", label, pool_id, buffer->thread_id, event.timestamp);
+					os << ",\"bp\":\"e\",\"id\":" << event.task_id << "}";
+					break;
+
+				case trace_event_type::finish:
+					write_event_header(os, "E", label, pool_id, buffer->thread_id, event.timestamp);
+					os << ",\"args\":{\"succeeded\":" << (event.data ? "true" : "false") << "}}";
+					break;
+
+				case trace_event_type::continuation:
+					write_event_header(os, "i", "continuations", pool_id, buffer->thread_id, event.timestamp);
+					os << ",\"s\":\"t\",\"args\":{\"id\":" << event.task_id << ",\"count\":" << event.data << "}}";
+					break;
+			}
+		}
+	}
+	os << "\n],\"displayTimeUnit\":\"ns\"}\n";
+}
+
+void trace_recorder::clear() {
+	std::lock_guard<std::mutex> lock(mutex);
+	for (auto& buffer : buffers) {
+		buffer->tail.store(buffer->head.load(std::memory_order_acquire), std::memory_order_relaxed);
+	}
+}
+
+void trace_recorder::set_thread_name(std::string name) {
+	current_thread_name = std::move(name);
+	if (current_buffer) {
+		std::lock_guard<std::mutex> lock(instance().mutex);
+		current_buffer->thread_name = current_thread_name;
+	}
+}
+
+void trace_recorder::set_current_task(uint32_t pool_id, uint64_t task_id, const char *label) {
+	current_task = { pool_id, task_id, label };
+}
+
+void trace_recorder::record_continuations(size_t count) {
+	if (current_task.pool_id != 0) {
+		instance().record(trace_event_type::continuation, current_task.pool_id, current_task.task_id, current_task.label, (uint32_t) count);
+	}
+}
+
+trace_recorder::thread_buffer_owner::~thread_buffer_owner() {
+	if (buffer) {
+		trace_recorder& recorder = instance();
+		std::lock_guard<std::mutex> lock(recorder.mutex);
+		recorder.free_buffers.push_back(buffer);
+		current_buffer = nullptr;
+	}
+}
+
+trace_buffer& trace_recorder::thread_buffer() {
+	if (!current_buffer) {
+		static thread_local thread_buffer_owner owner;
+		std::lock_guard<std::mutex> lock(mutex);
+		if (free_buffers.empty()) {
+			buffers.emplace_back(new trace_buffer);
+			current_buffer = buffers.back().get();
+		}
+		else {
+			// Events of the exited thread would be attributed to this one
+			current_buffer = free_buffers.back();
+			free_buffers.pop_back();
+			current_buffer->tail.store(current_buffer->head.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		}
+		current_buffer->thread_id = next_thread_id++;
+		current_buffer->thread_name = current_thread_name.empty()
+			? "thread " + std::to_string(current_buffer->thread_id)
+			: current_thread_name;
+		owner.buffer = current_buffer;
+	}
+	return *current_buffer;
+}
+
+} // end namespace detail
+
+} // end namespace dispatch_queue
@@ -0,0 +1,120 @@
+#include "../include/wakeup_event.hpp"
+
+#ifdef __linux__
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <poll.h>
+#include <system_error>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#endif
+
+namespace dispatch_queue {
+
+namespace detail {
+
+#ifdef __linux__
+
+wakeup_event::wakeup_event()
+	: fd(eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+{
+	if (fd < 0) {
+		// Notifications would be lost, so waiters would never wake up
+#ifdef __cpp_exceptions
+		throw std::system_error(errno, std::generic_category(), "eventfd");
+#else
+		std::abort();
+#endif
+	}
+}
+
+wakeup_event::~wakeup_event() {
+	if (fd >= 0) {
+		close(fd);
+	}
+}
+
+void wakeup_event::notify() {
+	uint64_t value = 1;
+	while (write(fd, &value, sizeof(value)) < 0 && errno == EINTR) {}
+}
+
+void wakeup_event::reset() {
+	uint64_t value;
+	while (read(fd, &value, sizeof(value)) < 0 && errno == EINTR) {}
+}
+
+int wakeup_event::native_handle() const {
+	return fd;
+}
+
+void wakeup_event::wait() {
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	while (poll(&pfd, 1, -1) < 0 && errno == EINTR) {}
+}
+
+bool wakeup_event::wait_for(std::chrono::nanoseconds timeout_duration) {
+	using namespace std::chrono;
+	auto deadline = steady_clock::now() + timeout_duration;
+	while (true) {
+		auto remaining = std::max(duration_cast<nanoseconds>(deadline - steady_clock::now()), nanoseconds::zero());
+		auto remaining_seconds = duration_cast<seconds>(remaining);
+		struct timespec timeout = {
+			(time_t) remaining_seconds.count(),
+			(long) (remaining - remaining_seconds).count(),
+		};
+		struct pollfd pfd = { fd, POLLIN, 0 };
+		int result = ppoll(&pfd, 1, &timeout, nullptr);
+		if (result >= 0) {
+			return result > 0;
+		}
+		else if (errno != EINTR) {
+			return false;
+		}
+	}
+}
+
+#else
+
+wakeup_event::wakeup_event()
+{
+}
+
+wakeup_event::~wakeup_event()
+{
+}
+
+void wakeup_event::notify() {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		is_signaled = true;
+	}
+	condition_variable.notify_all();
+}
+
+void wakeup_event::reset() {
+	std::lock_guard<std::mutex> lock(mutex);
+	is_signaled = false;
+}
+
+int wakeup_event::native_handle() const {
+	return -1;
+}
+
+void wakeup_event::wait() {
+	std::unique_lock<std::mutex> lock(mutex);
+	condition_variable.wait(lock, [this]{ return is_signaled; });
+}
+
+bool wakeup_event::wait_for(std::chrono::nanoseconds timeout_duration) {
+	std::unique_lock<std::mutex> lock(mutex);
+	return condition_variable.wait_for(lock, timeout_duration, [this]{ return is_signaled; });
+}
+
+#endif
+
+} // end namespace detail
+
+} // end namespace dispatch_queue
@@ -1,9 +1,33 @@
 #include "../include/worker_pool.hpp"
 
+#include "../include/task_future.hpp"
+#include "../include/this_worker.hpp"
+
+#include <algorithm>
+
 namespace dispatch_queue {
 
 namespace detail {
 
+namespace {
+
+thread_local worker_pool *current_worker_pool = nullptr;
+thread_local int current_worker = -1;
+thread_local task_source *current_task_source = nullptr;
+thread_local std::chrono::steady_clock::time_point time_slice_start;
+thread_local worker_batch *current_batch = nullptr;
+thread_local std::shared_ptr<void> released_after_task;
+
+} // end anonymous namespace
+
+constexpr uint32_t worker_batch::capacity;
+
+void release_worker_batch() {
+	if (current_batch && current_batch->remaining() > 0) {
+		current_worker_pool->release_batch(*current_batch);
+	}
+}
+
 worker_pool::~worker_pool() {
 	shutdown();
 }
@@ -12,30 +36,136 @@ int worker_pool::thread_count() const {
 	return worker_threads.size();
 }
 
-size_t worker_pool::size() {
+void worker_pool::add_source(task_source& source, int weight) {
 	std::lock_guard<std::mutex> lock(mutex);
-	return task_queue.size();
+	source.weight = std::max(weight, 1);
+	source.credits = source.weight;
+	source.affinity_queues.resize(target_thread_count);
+	source.pinned_queues.resize(target_thread_count);
+	sources.push_back(&source);
 }
 
-void worker_pool::enqueue_task(pending_task&& task, bool run_on_main_loop) {
-	{
-		std::lock_guard<std::mutex> lock(mutex);
-		task_queue.push(std::move(task), run_on_main_loop);
+void worker_pool::remove_source(task_source& source) {
+	// Discarded tasks are destroyed outside the lock, since destroying them may release concurrency limiter slots
+	pending_task_queue discarded;
+	// A task removing its own source can't wait for itself
+	int own_running_count = current_task_source == &source ? 1 : 0;
+	std::unique_lock<std::mutex> lock(mutex);
+	while (true) {
+		take_pending_tasks(source, discarded);
+		if (!discarded.empty()) {
+			lock.unlock();
+			discarded.clear();
+			lock.lock();
+		}
+		else if (source.running_count == own_running_count) {
+			break;
+		}
+		else {
+			all_done_condition_variable.wait(lock);
+		}
+	}
+	source.generation++;
+	source.deferred_count = 0;
+	sources.erase(std::find(sources.begin(), sources.end(), &source));
+	next_source = 0;
+	if (!sources.empty()) {
+		sources[0]->credits = sources[0]->weight;
 	}
-	task_condition_variable.notify_one();
 }
 
-std::deque<pending_task> worker_pool::pop_main_loop_tasks() {
+size_t worker_pool::size(const task_source& source) {
 	std::lock_guard<std::mutex> lock(mutex);
-	return task_queue.pop_main_loop_tasks();
+	return source.pending_count();
+}
+
+void worker_pool::enqueue_task(task_source& source, pending_task&& task) {
+	push_task(source, std::move(task), nullptr);
 }
 
-void worker_pool::clear() {
+void worker_pool::enqueue_local_task(task_source& source, int worker_index, bool is_pinned, pending_task&& task) {
+	push_task(source, std::move(task), nullptr, worker_index, is_pinned);
+}
+
+uint64_t worker_pool::defer_task(task_source& source) {
 	std::lock_guard<std::mutex> lock(mutex);
-	task_queue.clear();
+	source.deferred_count++;
+	return source.generation;
+}
+
+bool worker_pool::admit_task(task_source& source, uint64_t generation, pending_task&& task) {
+	return push_task(source, std::move(task), &generation);
+}
+
+bool worker_pool::push_task(task_source& source, pending_task&& task, const uint64_t *deferred_generation, int worker_index, bool is_pinned) {
+	bool collect_stats = is_collecting_stats.load(std::memory_order_relaxed);
+	if (collect_stats || is_watching.load(std::memory_order_relaxed)) {
+		task.enqueue_time = std::chrono::steady_clock::now();
+	}
+	if (is_tracing.load(std::memory_order_relaxed)) {
+		trace_recorder& recorder = trace_recorder::instance();
+		task.id = recorder.new_task_id();
+		recorder.record(trace_event_type::enqueue, pool_id, task.id, task.label);
+	}
+	bool wake_one = true;
+	bool wake_all = false;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (deferred_generation) {
+			if (*deferred_generation != source.generation) {
+				return false;
+			}
+			source.deferred_count--;
+		}
+		if (worker_index >= 0 && worker_index < (int) source.affinity_queues.size()) {
+			(is_pinned ? source.pinned_queues : source.affinity_queues)[worker_index].push(std::move(task));
+			source.local_count++;
+			local_task_count++;
+			// Waking any worker is enough when the owner is busy, since others can take the task.
+			// Otherwise wake everyone, so that the owner is sure to wake up.
+			if (is_worker_idle[worker_index]) {
+				wake_all = true;
+			}
+			else if (is_pinned) {
+				// The busy owner checks its pinned queue after its current task
+				wake_one = false;
+			}
+		}
+		else {
+			source.queue.push(std::move(task));
+		}
+		if (collect_stats) {
+			source.enqueued_count++;
+			source.max_depth = std::max(source.max_depth, source.pending_count());
+		}
+	}
+	if (wake_all) {
+		task_condition_variable.notify_all();
+	}
+	else if (wake_one) {
+		task_condition_variable.notify_one();
+	}
+	return true;
+}
+
+void worker_pool::clear(task_source& source) {
+	bool all_done;
+	// Discarded tasks are destroyed outside the lock, since destroying them may release concurrency limiter slots
+	pending_task_queue discarded;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		take_pending_tasks(source, discarded);
+		source.generation++;
+		source.deferred_count = 0;
+		all_done = source.running_count == 0;
+	}
+	if (all_done) {
+		all_done_condition_variable.notify_all();
+	}
 }
 
 void worker_pool::shutdown() {
+	set_watchdog(std::chrono::nanoseconds(0), nullptr);
 	if (worker_threads.empty()) {
 		return;
 	}
@@ -44,47 +174,528 @@ void worker_pool::shutdown() {
 		std::lock_guard<std::mutex> lock(mutex);
 		is_shutting_down = true;
 	}
-	for (int i = 0; i < thread_count(); i++) {
-		task_condition_variable.notify_one();
-	}
+	task_condition_variable.notify_all();
+	spare_condition_variable.notify_all();
 	for (auto& thread : worker_threads) {
 		if (thread.joinable()) {
 			thread.join();
 		}
 	}
+	// No compensation threads are spawned after `is_shutting_down` is set, retired ones are joined here too
+	for (auto& thread : compensation_threads) {
+		if (thread.joinable()) {
+			thread.join();
+		}
+	}
 	worker_threads.clear();
+	blocked_count = parked_count = unpark_signals = 0;
 	is_shutting_down = false;
 }
 
-void worker_pool::wait() {
+void worker_pool::set_stats_enabled(bool enabled) {
+	is_collecting_stats.store(enabled, std::memory_order_relaxed);
+}
+
+bool worker_pool::is_stats_enabled() const {
+	return is_collecting_stats.load(std::memory_order_relaxed);
+}
+
+queue_stats worker_pool::stats(const task_source& source) {
+	queue_stats stats;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stats.enqueued = source.enqueued_count;
+		stats.max_depth = source.max_depth;
+		stats.pool = retired_stats;
+		stats.pool.compensation_threads = compensation_thread_count;
+		stats.pool.workers.reserve(thread_count() + active_compensation_count);
+		for (int i = 0; i < thread_count(); i++) {
+			worker_counters[i].add_to(stats.pool);
+		}
+		for (size_t i = 0; i < compensation_counters.size(); i++) {
+			if (is_compensation_active[i]) {
+				compensation_counters[i].add_to(stats.pool);
+			}
+		}
+	}
+	return stats;
+}
+
+void worker_pool::reset_stats(task_source& source) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		source.enqueued_count = 0;
+		source.max_depth = 0;
+		compensation_thread_count = 0;
+		retired_stats = pool_stats();
+		for (int i = 0; i < thread_count(); i++) {
+			worker_counters[i].reset();
+		}
+		for (worker_stats_counters& counters : compensation_counters) {
+			counters.reset();
+		}
+	}
+}
+
+void worker_pool::set_tracing_enabled(bool enabled) {
+	is_tracing.store(enabled, std::memory_order_relaxed);
+}
+
+bool worker_pool::is_tracing_enabled() const {
+	return is_tracing.load(std::memory_order_relaxed);
+}
+
+void worker_pool::write_chrome_trace(std::ostream& os) {
+	trace_recorder::instance().write_chrome_trace(os, pool_id);
+}
+
+void worker_pool::set_watchdog(std::chrono::nanoseconds threshold, std::function<void(const stalled_task&)> callback) {
+	std::unique_ptr<task_watchdog> previous_watchdog;
+	{
+		std::lock_guard<std::mutex> lock(watchdog_mutex);
+		previous_watchdog = std::move(watchdog);
+		if (callback) {
+			watchdog.reset(new task_watchdog(threshold, std::move(callback), [this](std::vector<watchdog_slot *>& slots) {
+				std::lock_guard<std::mutex> lock(mutex);
+				for (int i = 0; i < target_thread_count; i++) {
+					slots.push_back(&watchdog_slots[i]);
+				}
+				for (size_t i = 0; i < compensation_watchdog_slots.size(); i++) {
+					if (is_compensation_active[i]) {
+						slots.push_back(&compensation_watchdog_slots[i]);
+					}
+				}
+			}));
+		}
+		is_watching.store((bool) watchdog, std::memory_order_relaxed);
+	}
+	// Joins the previous watchdog thread outside the lock
+	previous_watchdog.reset();
+}
+
+bool worker_pool::is_watchdog_enabled() const {
+	return is_watching.load(std::memory_order_relaxed);
+}
+
+std::chrono::nanoseconds worker_pool::oldest_pending_age(const task_source& source) {
+	std::chrono::steady_clock::time_point oldest;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		auto consider_time = [&oldest](std::chrono::steady_clock::time_point enqueue_time) {
+			if (enqueue_time != std::chrono::steady_clock::time_point() && (oldest == std::chrono::steady_clock::time_point() || enqueue_time < oldest)) {
+				oldest = enqueue_time;
+			}
+		};
+		auto consider = [&consider_time](const pending_task_queue& queue) {
+			if (const pending_task *front = queue.front()) {
+				consider_time(front->enqueue_time);
+			}
+		};
+		consider(source.queue);
+		if (source.batched_count() > 0) {
+			// Batched tasks are only written while refilling a batch under the lock, and the next one is the oldest
+			for (const worker_batch& batch : worker_batches) {
+				uint32_t next = batch.next.load(std::memory_order_acquire);
+				if (batch.source == &source && next < batch.size && (source.batched_state.load(std::memory_order_relaxed) >> 32) == batch.generation) {
+					consider_time(batch.tasks[next].enqueue_time);
+				}
+			}
+		}
+		if (source.local_count > 0) {
+			for (const pending_task_queue& queue : source.affinity_queues) {
+				consider(queue);
+			}
+			for (const pending_task_queue& queue : source.pinned_queues) {
+				consider(queue);
+			}
+		}
+	}
+	if (oldest == std::chrono::steady_clock::time_point()) {
+		return std::chrono::nanoseconds(0);
+	}
+	return std::chrono::steady_clock::now() - oldest;
+}
+
+void worker_pool::wait(const task_source& source) {
 	std::unique_lock<std::mutex> lock(mutex);
-	all_done_condition_variable.wait(lock, wait_predicate());
+	all_done_condition_variable.wait(lock, wait_predicate(source));
+}
+
+void worker_pool::release_batch(worker_batch& batch) {
+	// Stale tasks are destroyed outside the lock, since destroying them may release concurrency limiter slots
+	pending_task_queue discarded;
+	size_t released_count = 0;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		task_source& source = *batch.source;
+		// Idle workers only claim tasks under the lock, so the remaining tasks are all ours
+		uint32_t first = batch.next.load(std::memory_order_relaxed);
+		batch.next.store(batch.size, std::memory_order_relaxed);
+		bool is_current = (source.batched_state.load(std::memory_order_relaxed) >> 32) == batch.generation;
+		if (is_current && first < batch.size) {
+			released_count = batch.size - first;
+			source.batched_state.fetch_sub(released_count, std::memory_order_relaxed);
+		}
+		for (uint32_t i = batch.size; i > first; i--) {
+			if (is_current) {
+				source.queue.push_front(std::move(batch.tasks[i - 1]));
+			}
+			else {
+				discarded.push(std::move(batch.tasks[i - 1]));
+			}
+		}
+	}
+	if (released_count > 1) {
+		task_condition_variable.notify_all();
+	}
+	else if (released_count == 1) {
+		task_condition_variable.notify_one();
+	}
+}
+
+void worker_pool::begin_blocking() {
+	// The tasks this worker is about to wait for may be in its own batch
+	release_worker_batch();
+	std::lock_guard<std::mutex> lock(mutex);
+	blocked_count++;
+	if (is_shutting_down || runnable_count() >= target_thread_count) {
+		return;
+	}
+	if (parked_count > 0) {
+		parked_count--;
+		unpark_signals++;
+		spare_condition_variable.notify_one();
+	}
+	else {
+		spawn_compensation_thread();
+	}
+}
+
+void worker_pool::end_blocking() {
+	bool has_excess_workers;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		blocked_count--;
+		has_excess_workers = runnable_count() > target_thread_count;
+	}
+	if (has_excess_workers) {
+		// Wake idle compensation threads so they park
+		task_condition_variable.notify_all();
+	}
+}
+
+worker_pool *worker_pool::current() {
+	return current_worker_pool;
+}
+
+int worker_pool::current_worker_index() {
+	return current_worker;
+}
+
+task_source *worker_pool::current_source() {
+	return current_task_source;
+}
+
+void worker_pool::release_after_task(std::shared_ptr<void> object) {
+	released_after_task = std::move(object);
+}
+
+bool worker_pool::is_time_slice_expired(std::chrono::nanoseconds budget) {
+	auto now = std::chrono::steady_clock::now();
+	if (time_slice_start == std::chrono::steady_clock::time_point()) {
+		// Slices start lazily, so that workers don't read the clock for every task
+		time_slice_start = now;
+	}
+	return now - time_slice_start >= budget;
+}
+
+bool worker_pool::try_pop(pending_task& task, task_source *& source, int worker_index) {
+	bool has_local_queue = worker_index < target_thread_count;
+	if (local_task_count > 0 && has_local_queue) {
+		if (try_pop_local(&task_source::pinned_queues, worker_index, task, source)
+			|| try_pop_local(&task_source::affinity_queues, worker_index, task, source))
+		{
+			return true;
+		}
+	}
+
+	// Weighted round-robin: take up to `weight` tasks from a source before moving on to the next one
+	for (size_t i = 0; i <= sources.size(); i++) {
+		task_source *current = sources[next_source];
+		if (current->credits > 0 && current->queue.try_pop(task)) {
+			current->credits--;
+			source = current;
+			return true;
+		}
+		next_source = (next_source + 1) % sources.size();
+		sources[next_source]->credits = sources[next_source]->weight;
+	}
+
+	// Nothing else to do: help busy workers with their affinity tasks
+	if (local_task_count > 0) {
+		for (int i = 0; i < target_thread_count; i++) {
+			if (i != worker_index && !is_worker_idle[i] && try_pop_local(&task_source::affinity_queues, i, task, source)) {
+				return true;
+			}
+		}
+	}
+
+	// Or with their batches, so that batched tasks don't wait behind a long running task
+	for (int i = 0; i < target_thread_count; i++) {
+		worker_batch& batch = worker_batches[i];
+		if (i != worker_index && batch.remaining() > 0
+			&& (batch.source->batched_state.load(std::memory_order_relaxed) >> 32) == batch.generation
+			&& take_batched_task(batch, task))
+		{
+			source = batch.source;
+			return true;
+		}
+	}
+	return false;
 }
 
-void worker_pool::run_task_loop() {
+bool worker_pool::try_pop_local(std::vector<pending_task_queue> task_source::*queues, int worker_index, pending_task& task, task_source *& source) {
+	for (task_source *current : sources) {
+		if ((current->*queues)[worker_index].try_pop(task)) {
+			current->local_count--;
+			local_task_count--;
+			source = current;
+			return true;
+		}
+	}
+	return false;
+}
+
+void worker_pool::take_batch(task_source& source, worker_batch& batch) {
+	// Local tasks should not wait behind a batch
+	if (local_task_count > 0) {
+		return;
+	}
+	// Leave a fair share of the queue for idle workers, since they were woken up for these tasks too
+	size_t batch_size = std::min(source.queue.size() / (idle_worker_count + 1), (size_t) worker_batch::capacity);
+	if (sources.size() > 1) {
+		batch_size = std::min(batch_size, (size_t) std::max(source.credits, 0));
+		source.credits -= (int) batch_size;
+	}
+	if (batch_size == 0) {
+		return;
+	}
+	batch.source = &source;
+	batch.generation = (uint32_t) (source.batched_state.load(std::memory_order_relaxed) >> 32);
+	batch.size = (uint32_t) batch_size;
+	for (size_t i = 0; i < batch_size; i++) {
+		source.queue.try_pop(batch.tasks[i]);
+	}
+	source.batched_state.fetch_add(batch_size, std::memory_order_relaxed);
+	batch.next.store(0, std::memory_order_release);
+}
+
+bool worker_pool::take_batched_task(worker_batch& batch, pending_task& task) {
+	uint32_t index = batch.next.load(std::memory_order_acquire);
+	do {
+		if (index >= batch.size) {
+			return false;
+		}
+	} while (!batch.next.compare_exchange_weak(index, index + 1, std::memory_order_acq_rel, std::memory_order_acquire));
+
+	std::atomic<uint64_t>& batched_state = batch.source->batched_state;
+	uint64_t state = batched_state.load(std::memory_order_acquire);
+	do {
+		if ((state >> 32) != batch.generation) {
+			// The source was cleared since the batch was taken.
+			// Idle workers check the generation under the lock before claiming, so only the owner gets here.
+			batch.next.store(batch.size, std::memory_order_relaxed);
+			for (uint32_t i = index; i < batch.size; i++) {
+				batch.tasks[i] = pending_task();
+			}
+			return false;
+		}
+	} while (!batched_state.compare_exchange_weak(state, state - 1, std::memory_order_acq_rel, std::memory_order_acquire));
+	task = std::move(batch.tasks[index]);
+	return true;
+}
+
+void worker_pool::take_pending_tasks(task_source& source, pending_task_queue& discarded) {
+	discarded.swap(source.queue);
+	// Workers discard their batched tasks once they see the new batch generation
+	uint64_t batch_generation = (source.batched_state.load(std::memory_order_relaxed) >> 32) + 1;
+	source.batched_state.store(batch_generation << 32, std::memory_order_release);
+	if (source.local_count == 0) {
+		return;
+	}
+	pending_task task;
+	for (auto queues : { &source.affinity_queues, &source.pinned_queues }) {
+		for (pending_task_queue& queue : *queues) {
+			while (queue.try_pop(task)) {
+				discarded.push(std::move(task));
+			}
+		}
+	}
+	local_task_count -= source.local_count;
+	source.local_count = 0;
+}
+
+int worker_pool::runnable_count() const {
+	return target_thread_count + active_compensation_count - blocked_count - parked_count;
+}
+
+void worker_pool::destroy(worker_pool *pool) {
+	if (current_worker_pool == pool) {
+		// Released by one of its own tasks: shutting down from another thread joins this one once the task returns
+		std::thread([pool] { delete pool; }).detach();
+	}
+	else {
+		delete pool;
+	}
+}
+
+void worker_pool::spawn_compensation_thread() {
+	int index;
+	if (!retired_compensation.empty()) {
+		// Retired threads exit right after releasing the lock, so joining them here is short
+		index = retired_compensation.back();
+		retired_compensation.pop_back();
+		compensation_threads[index].join();
+		compensation_counters[index].reset();
+	}
+	else {
+		index = (int) compensation_threads.size();
+		compensation_counters.emplace_back();
+		compensation_watchdog_slots.emplace_back();
+		compensation_watchdog_slots.back().worker_index = target_thread_count + index;
+		compensation_threads.emplace_back();
+		is_compensation_active.push_back(false);
+	}
+	compensation_threads[index] = worker_thread(options, std::bind(&worker_pool::run_worker, this, target_thread_count + index, std::ref(compensation_counters[index]), std::ref(compensation_watchdog_slots[index]), true));
+	is_compensation_active[index] = true;
+	active_compensation_count++;
+	compensation_thread_count++;
+}
+
+void worker_pool::retire_compensation_thread(int worker_index) {
+	int index = worker_index - target_thread_count;
+	compensation_counters[index].add_to(retired_stats);
+	retired_stats.workers.clear();
+	is_compensation_active[index] = false;
+	active_compensation_count--;
+	retired_compensation.push_back(index);
+}
+
+void worker_pool::run_worker(int worker_index, worker_stats_counters& counters, watchdog_slot& slot, bool is_compensation) {
+	current_worker_pool = this;
+	current_worker = worker_index;
+	trace_recorder::set_thread_name(worker_thread::apply_options(options, worker_index));
+	worker_init(worker_index);
+	run_task_loop(worker_index, counters, slot, is_compensation);
+}
+
+void worker_pool::run_task_loop(int worker_index, worker_stats_counters& counters, watchdog_slot& slot, bool is_compensation) {
+	using clock = std::chrono::steady_clock;
+	clock::time_point idle_start;
+	scratch_arena& arena = this_worker::arena();
+	// Compensation workers don't take batches, but keep an empty one so that releasing it is a no-op
+	worker_batch compensation_batch;
+	worker_batch& batch = is_compensation ? compensation_batch : worker_batches[worker_index];
+	current_batch = &batch;
 	while (true) {
 		// 1. Get a valid task
 		pending_task task;
+		task_source *source = nullptr;
 		{
 			std::unique_lock<std::mutex> lock(mutex);
-			task_condition_variable.wait(lock, [this, &task]() { return is_shutting_down || task_queue.try_pop(task); });
-			if (is_shutting_down) {
-				return;
+			while (true) {
+				bool should_park = false;
+				task_condition_variable.wait(lock, [&]() {
+					should_park = is_compensation && runnable_count() > target_thread_count;
+					return is_shutting_down || should_park || (!sources.empty() && try_pop(task, source, worker_index));
+				});
+				if (is_shutting_down) {
+					return;
+				}
+				if (!should_park) {
+					break;
+				}
+				// Excess compensation thread: park until another worker blocks, passing on the wakeup it may have consumed
+				task_condition_variable.notify_one();
+				parked_count++;
+				bool is_unparked = spare_condition_variable.wait_for(lock, options.compensation_idle_timeout, [this]() { return is_shutting_down || unpark_signals > 0; });
+				if (is_shutting_down) {
+					return;
+				}
+				if (!is_unparked) {
+					// Not needed for a while: exit, leaving the thread to be joined by the next spawn or by `shutdown`
+					parked_count--;
+					retire_compensation_thread(worker_index);
+					return;
+				}
+				unpark_signals--;
+			}
+			source->running_count++;
+			if (!is_compensation) {
+				is_worker_idle[worker_index] = false;
+				idle_worker_count--;
+				take_batch(*source, batch);
 			}
 		}
 
-		// 2. Do some work
-		task();
+		// 2. Do some work, then run the rest of the batch without locking again
+		do {
+			if (task.id) {
+				trace_recorder::instance().record(trace_event_type::dequeue, pool_id, task.id, task.label);
+				trace_recorder::set_current_task(pool_id, task.id, task.label);
+				trace_recorder::instance().record(trace_event_type::start, pool_id, task.id, task.label);
+			}
+			bool succeeded;
+			bool is_watched = is_watching.load(std::memory_order_relaxed);
+			if (is_watched) {
+				slot.begin(task.label);
+			}
+			current_task_source = source;
+			if (is_collecting_stats.load(std::memory_order_relaxed)) {
+				clock::time_point start = clock::now();
+				if (idle_start != clock::time_point()) {
+					counters.record_idle(start - idle_start);
+				}
+				if (task.enqueue_time != clock::time_point()) {
+					counters.record_wait(start - task.enqueue_time);
+				}
+				time_slice_start = start;
+				succeeded = task();
+				idle_start = clock::now();
+				counters.record_run(idle_start - start, succeeded);
+			}
+			else {
+				time_slice_start = clock::time_point();
+				succeeded = task();
+				idle_start = clock::time_point();
+			}
+			current_task_source = nullptr;
+			if (is_watched) {
+				slot.end();
+			}
+			arena.reset();
+			if (task.id) {
+				trace_recorder::instance().record(trace_event_type::finish, pool_id, task.id, task.label, succeeded);
+				trace_recorder::set_current_task(0, 0, nullptr);
+			}
+		} while (take_batched_task(batch, task));
 
 		// 3. If all is done, notify waiters
 		bool all_done;
 		{
 			std::lock_guard<std::mutex> lock(mutex);
-			all_done = task_queue.empty();
+			source->running_count--;
+			if (!is_compensation) {
+				is_worker_idle[worker_index] = true;
+				idle_worker_count++;
+			}
+			// Also wakes `remove_source`, which does not care about tasks enqueued after clearing the source
+			all_done = source->running_count == 0;
 		}
 		if (all_done) {
 			all_done_condition_variable.notify_all();
 		}
+		released_after_task.reset();
 	}
 }
 
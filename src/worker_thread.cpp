@@ -0,0 +1,153 @@
+#include "../include/worker_thread.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <exception>
+#include <memory>
+#include <system_error>
+#include <utility>
+
+#ifdef DISPATCH_QUEUE_PTHREADS
+#include <climits>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+namespace dispatch_queue {
+
+namespace detail {
+
+#ifdef DISPATCH_QUEUE_PTHREADS
+namespace {
+
+void *run_thread_body(void *body) {
+	std::unique_ptr<std::function<void()>> owned_body(static_cast<std::function<void()> *>(body));
+	(*owned_body)();
+	return nullptr;
+}
+
+size_t supported_stack_size(size_t stack_size) {
+#ifdef PTHREAD_STACK_MIN
+	stack_size = std::max(stack_size, (size_t) PTHREAD_STACK_MIN);
+#endif
+	// Some platforms only accept multiples of the page size
+	long page_size = sysconf(_SC_PAGESIZE);
+	if (page_size > 0) {
+		stack_size = (stack_size + page_size - 1) / page_size * page_size;
+	}
+	return stack_size;
+}
+
+} // end anonymous namespace
+
+worker_thread::worker_thread(const worker_options& options, std::function<void()> body) {
+	pthread_attr_t attributes;
+	pthread_attr_init(&attributes);
+	if (options.stack_size > 0) {
+		pthread_attr_setstacksize(&attributes, supported_stack_size(options.stack_size));
+	}
+	auto owned_body = new std::function<void()>(std::move(body));
+	int result = pthread_create(&handle, &attributes, run_thread_body, owned_body);
+	pthread_attr_destroy(&attributes);
+	if (result != 0) {
+		delete owned_body;
+#ifdef __cpp_exceptions
+		throw std::system_error(result, std::generic_category(), "pthread_create");
+#else
+		std::abort();
+#endif
+	}
+	is_joinable = true;
+}
+
+worker_thread::worker_thread(worker_thread&& other) noexcept
+	: handle(other.handle)
+	, is_joinable(other.is_joinable)
+{
+	other.is_joinable = false;
+}
+
+worker_thread& worker_thread::operator=(worker_thread&& other) noexcept {
+	if (is_joinable) {
+		std::terminate();
+	}
+	handle = other.handle;
+	is_joinable = other.is_joinable;
+	other.is_joinable = false;
+	return *this;
+}
+
+worker_thread::~worker_thread() {
+	if (is_joinable) {
+		std::terminate();
+	}
+}
+
+bool worker_thread::joinable() const {
+	return is_joinable;
+}
+
+void worker_thread::join() {
+	pthread_join(handle, nullptr);
+	is_joinable = false;
+}
+#else
+worker_thread::worker_thread(const worker_options&, std::function<void()> body)
+	: thread(std::move(body))
+{
+}
+
+worker_thread::worker_thread(worker_thread&& other) noexcept = default;
+worker_thread& worker_thread::operator=(worker_thread&& other) noexcept = default;
+worker_thread::~worker_thread() = default;
+
+bool worker_thread::joinable() const {
+	return thread.joinable();
+}
+
+void worker_thread::join() {
+	thread.join();
+}
+#endif
+
+std::string worker_thread::apply_options(const worker_options& options, int worker_index) {
+	std::string name = options.name + " " + std::to_string(worker_index);
+#if defined(__linux__)
+	// Linux thread names are limited to 16 bytes, including the null terminator
+	pthread_setname_np(pthread_self(), name.substr(0, 15).c_str());
+#elif defined(__APPLE__)
+	pthread_setname_np(name.c_str());
+#endif
+
+#ifdef __linux__
+	if (options.scheduling != worker_scheduling::inherit) {
+		int policy = SCHED_OTHER;
+		sched_param parameters {};
+		switch (options.scheduling) {
+			case worker_scheduling::batch: policy = SCHED_BATCH; break;
+			case worker_scheduling::idle: policy = SCHED_IDLE; break;
+			case worker_scheduling::fifo: policy = SCHED_FIFO; break;
+			case worker_scheduling::round_robin: policy = SCHED_RR; break;
+			default: break;
+		}
+		if (policy == SCHED_FIFO || policy == SCHED_RR) {
+			parameters.sched_priority = options.priority;
+		}
+		pthread_setschedparam(pthread_self(), policy, &parameters);
+		if (policy == SCHED_OTHER || policy == SCHED_BATCH) {
+			// Nice values are per thread on Linux
+			setpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid), options.priority);
+		}
+	}
+#endif
+	return name;
+}
+
+} // end namespace detail
+
+} // end namespace dispatch_queue
@@ -0,0 +1,818 @@
+/**
+ * Benchmark suite for scheduling latency, throughput and scaling.
+ *
+ * Usage: dispatch_queue_benchmark_suite [--format=csv|json] [--quick] [--max-threads=N]
+ *
+ * Results are written to stdout, one row per measured metric, so that they can be
+ * tracked between releases.
+ */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <dispatch_queue.hpp>
+
+using benchmark_clock = std::chrono::steady_clock;
+
+struct benchmark_result {
+	std::string scenario;
+	std::string implementation;
+	int threads;
+	std::string metric;
+	double value;
+	std::string unit;
+};
+
+struct benchmark_options {
+	bool json = false;
+	bool quick = false;
+	int max_threads = std::max(1, (int) std::thread::hardware_concurrency());
+
+	int iterations(int full) const {
+		return quick ? std::max(1, full / 20) : full;
+	}
+};
+
+static std::vector<benchmark_result> results;
+
+static void report(const std::string& scenario, const std::string& implementation, int threads, const std::string& metric, double value, const std::string& unit) {
+	results.push_back({ scenario, implementation, threads, metric, value, unit });
+}
+
+static double elapsed_nanoseconds(benchmark_clock::time_point start, benchmark_clock::time_point end = benchmark_clock::now()) {
+	return (double) std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
+}
+
+static void report_percentiles(const std::string& scenario, const std::string& implementation, int threads, std::vector<double>& samples) {
+	if (samples.empty()) {
+		return;
+	}
+	std::sort(samples.begin(), samples.end());
+	auto percentile = [&](double p) {
+		size_t index = std::min(samples.size() - 1, (size_t) (samples.size() * p / 100.0));
+		return samples[index];
+	};
+	report(scenario, implementation, threads, "p50", percentile(50), "ns");
+	report(scenario, implementation, threads, "p90", percentile(90), "ns");
+	report(scenario, implementation, threads, "p99", percentile(99), "ns");
+	report(scenario, implementation, threads, "max", samples.back(), "ns");
+}
+
+static std::vector<int> thread_counts(const benchmark_options& options) {
+	std::vector<int> counts;
+	for (int count = 1; count < options.max_threads; count *= 2) {
+		counts.push_back(count);
+	}
+	counts.push_back(options.max_threads);
+	return counts;
+}
+
+static std::uint64_t fibonacci(std::uint64_t number) {
+	return number < 2 ? 1 : fibonacci(number - 1) + fibonacci(number - 2);
+}
+
+///////////////////////////////////////////////////////////
+// Enqueue to start latency
+///////////////////////////////////////////////////////////
+static void benchmark_enqueue_latency(const benchmark_options& options) {
+	const int samples_count = options.iterations(2000);
+	for (int threads : thread_counts(options)) {
+		dispatch_queue::dispatch_queue q(threads);
+		std::vector<double> samples;
+		samples.reserve(samples_count);
+		for (int i = 0; i < samples_count; i++) {
+			auto start = benchmark_clock::now();
+			auto task = q.dispatch([start] {
+				return elapsed_nanoseconds(start);
+			});
+			samples.push_back(task.get());
+		}
+		report_percentiles("enqueue_to_start", "dispatch_queue", threads, samples);
+	}
+
+	std::vector<double> samples;
+	samples.reserve(samples_count);
+	for (int i = 0; i < samples_count; i++) {
+		auto start = benchmark_clock::now();
+		samples.push_back(std::async(std::launch::async, [start] {
+			return elapsed_nanoseconds(start);
+		}).get());
+	}
+	report_percentiles("enqueue_to_start", "std::async", 1, samples);
+}
+
+///////////////////////////////////////////////////////////
+// Ping-pong between two queues
+///////////////////////////////////////////////////////////
+static void benchmark_ping_pong(const benchmark_options& options) {
+	const int round_trips = options.iterations(20000);
+	{
+		dispatch_queue::dispatch_queue ping(1), pong(1);
+		std::promise<void> done;
+		std::function<void(int)> send_ping, send_pong;
+		send_ping = [&](int remaining) {
+			if (remaining == 0) {
+				done.set_value();
+			}
+			else {
+				pong.dispatch(send_pong, remaining);
+			}
+		};
+		send_pong = [&](int remaining) {
+			ping.dispatch(send_ping, remaining - 1);
+		};
+		auto start = benchmark_clock::now();
+		ping.dispatch(send_ping, round_trips);
+		done.get_future().wait();
+		report("ping_pong", "dispatch_queue", 2, "round_trip", elapsed_nanoseconds(start) / round_trips, "ns");
+	}
+
+	{
+		std::mutex mutex;
+		std::condition_variable condition_variable;
+		int turn = 0;
+		auto start = benchmark_clock::now();
+		std::thread pong_thread([&] {
+			for (int i = 0; i < round_trips; i++) {
+				std::unique_lock<std::mutex> lock(mutex);
+				condition_variable.wait(lock, [&] { return turn == 1; });
+				turn = 0;
+				condition_variable.notify_all();
+			}
+		});
+		for (int i = 0; i < round_trips; i++) {
+			std::unique_lock<std::mutex> lock(mutex);
+			turn = 1;
+			condition_variable.notify_all();
+			condition_variable.wait(lock, [&] { return turn == 0; });
+		}
+		pong_thread.join();
+		report("ping_pong", "std::thread", 2, "round_trip", elapsed_nanoseconds(start) / round_trips, "ns");
+	}
+}
+
+///////////////////////////////////////////////////////////
+// Fan-out/fan-in with continuations
+///////////////////////////////////////////////////////////
+static void benchmark_fan_out(const benchmark_options& options) {
+	const int task_count = options.iterations(20000);
+	for (int threads : thread_counts(options)) {
+		dispatch_queue::dispatch_queue q(threads);
+		std::atomic<int> finished { 0 };
+		std::promise<void> done;
+		auto start = benchmark_clock::now();
+		for (int i = 0; i < task_count; i++) {
+			q.dispatch([] { return fibonacci(10); }).then([&](dispatch_queue::task<std::uint64_t> t) {
+				t.get();
+				if (finished.fetch_add(1) + 1 == task_count) {
+					done.set_value();
+				}
+			});
+		}
+		done.get_future().wait();
+		double elapsed = elapsed_nanoseconds(start);
+		report("fan_out_fan_in", "dispatch_queue", threads, "throughput", task_count / (elapsed / 1e9), "tasks/s");
+	}
+
+	// One thread per task: keep at most `max_threads` tasks in flight, so that the thread count matches the largest pool
+	auto start = benchmark_clock::now();
+	std::vector<std::future<std::uint64_t>> futures;
+	futures.reserve(options.max_threads);
+	for (int i = 0; i < task_count; i += options.max_threads) {
+		for (int j = i; j < std::min(i + options.max_threads, task_count); j++) {
+			futures.push_back(std::async(std::launch::async, [] { return fibonacci(10); }));
+		}
+		for (auto& future : futures) {
+			future.get();
+		}
+		futures.clear();
+	}
+	report("fan_out_fan_in", "std::async", options.max_threads, "throughput", task_count / (elapsed_nanoseconds(start) / 1e9), "tasks/s");
+}
+
+///////////////////////////////////////////////////////////
+// Coroutine await chains
+///////////////////////////////////////////////////////////
+#ifdef __cpp_impl_coroutine
+static dispatch_queue::task<int> await_chain(dispatch_queue::dispatch_queue& q, int hops) {
+	int sum = 0;
+	for (int i = 0; i < hops; i++) {
+		co_await q.dispatch();
+		sum++;
+	}
+	co_return sum;
+}
+
+static void benchmark_coroutine_chain(const benchmark_options& options) {
+	const int hops = options.iterations(20000);
+	for (int threads : thread_counts(options)) {
+		dispatch_queue::dispatch_queue q(threads);
+		auto start = benchmark_clock::now();
+		auto task = await_chain(q, hops);
+		task.wait();
+		report("coroutine_await_chain", "dispatch_queue", threads, "hop", elapsed_nanoseconds(start) / hops, "ns");
+	}
+}
+#endif
+
+///////////////////////////////////////////////////////////
+// Contended coroutine locking
+///////////////////////////////////////////////////////////
+#ifdef __cpp_impl_coroutine
+static dispatch_queue::task<void> async_mutex_worker(dispatch_queue::dispatch_queue& q, dispatch_queue::async_mutex& mutex, std::uint64_t& counter, int iterations) {
+	co_await q.dispatch();
+	for (int i = 0; i < iterations; i++) {
+		{
+			auto lock = co_await mutex.scoped_lock(q.dispatch());
+			counter += fibonacci(8);
+		}
+		co_await q.dispatch();
+	}
+}
+
+static dispatch_queue::task<void> blocking_mutex_worker(dispatch_queue::dispatch_queue& q, std::mutex& mutex, std::uint64_t& counter, int iterations) {
+	co_await q.dispatch();
+	for (int i = 0; i < iterations; i++) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			counter += fibonacci(8);
+		}
+		co_await q.dispatch();
+	}
+}
+
+static void benchmark_contended_lock(const benchmark_options& options) {
+	const int coroutine_count = options.quick ? 100 : 1000;
+	const int iterations = options.iterations(100);
+	const double operations = (double) coroutine_count * iterations;
+	for (int threads : thread_counts(options)) {
+		dispatch_queue::dispatch_queue q(threads);
+		dispatch_queue::async_mutex mutex;
+		std::uint64_t counter = 0;
+		std::vector<dispatch_queue::task<void>> coroutines;
+		coroutines.reserve(coroutine_count);
+		auto start = benchmark_clock::now();
+		for (int i = 0; i < coroutine_count; i++) {
+			coroutines.push_back(async_mutex_worker(q, mutex, counter, iterations));
+		}
+		for (auto& coroutine : coroutines) {
+			coroutine.wait();
+		}
+		report("contended_lock", "async_mutex", threads, "throughput", operations / (elapsed_nanoseconds(start) / 1e9), "locks/s");
+	}
+
+	for (int threads : thread_counts(options)) {
+		dispatch_queue::dispatch_queue q(threads);
+		std::mutex mutex;
+		std::uint64_t counter = 0;
+		std::vector<dispatch_queue::task<void>> coroutines;
+		coroutines.reserve(coroutine_count);
+		auto start = benchmark_clock::now();
+		for (int i = 0; i < coroutine_count; i++) {
+			coroutines.push_back(blocking_mutex_worker(q, mutex, counter, iterations));
+		}
+		for (auto& coroutine : coroutines) {
+			coroutine.wait();
+		}
+		report("contended_lock", "std_mutex", threads, "throughput", operations / (elapsed_nanoseconds(start) / 1e9), "locks/s");
+	}
+}
+#endif
+
+///////////////////////////////////////////////////////////
+// Main loop hand-off
+///////////////////////////////////////////////////////////
+static void benchmark_main_loop_handoff(const benchmark_options& options) {
+	const int samples_count = options.iterations(2000);
+	dispatch_queue::dispatch_queue q(1);
+	std::vector<double> samples;
+	samples.reserve(samples_count);
+	for (int i = 0; i < samples_count; i++) {
+		auto task = q.dispatch([&q] {
+			auto start = benchmark_clock::now();
+			return q.dispatch_main([start] {
+				return elapsed_nanoseconds(start);
+			});
+		});
+		q.main_loop_wait();
+		q.main_loop();
+		samples.push_back(task.get().get());
+	}
+	report_percentiles("main_loop_handoff", "dispatch_queue", 1, samples);
+}
+
+///////////////////////////////////////////////////////////
+// Contended multi-producer dispatch
+///////////////////////////////////////////////////////////
+static void benchmark_multi_producer(const benchmark_options& options) {
+	const int tasks_per_producer = options.iterations(20000);
+	for (int producers : thread_counts(options)) {
+		dispatch_queue::dispatch_queue q(options.max_threads);
+		std::atomic<int> counter { 0 };
+		auto start = benchmark_clock::now();
+		std::vector<std::thread> producer_threads;
+		for (int p = 0; p < producers; p++) {
+			producer_threads.emplace_back([&] {
+				for (int i = 0; i < tasks_per_producer; i++) {
+					q.dispatch([&] { counter.fetch_add(1, std::memory_order_relaxed); });
+				}
+			});
+		}
+		for (auto& thread : producer_threads) {
+			thread.join();
+		}
+		double dispatch_elapsed = elapsed_nanoseconds(start);
+		q.wait();
+		double total_elapsed = elapsed_nanoseconds(start);
+		int total_tasks = producers * tasks_per_producer;
+		report("multi_producer", "dispatch_queue", producers, "dispatch_throughput", total_tasks / (dispatch_elapsed / 1e9), "tasks/s");
+		report("multi_producer", "dispatch_queue", producers, "completion_throughput", total_tasks / (total_elapsed / 1e9), "tasks/s");
+	}
+}
+
+///////////////////////////////////////////////////////////
+// Scaling of CPU bound work
+///////////////////////////////////////////////////////////
+static void benchmark_scaling(const benchmark_options& options) {
+	const int task_count = options.iterations(2000);
+	const int work_size = 18;
+	double single_thread_elapsed = 0;
+	for (int threads : thread_counts(options)) {
+		dispatch_queue::dispatch_queue q(threads);
+		std::atomic<std::uint64_t> sum { 0 };
+		auto start = benchmark_clock::now();
+		for (int i = 0; i < task_count; i++) {
+			q.dispatch([&] { sum.fetch_add(fibonacci(work_size), std::memory_order_relaxed); });
+		}
+		q.wait();
+		double elapsed = elapsed_nanoseconds(start);
+		if (threads == 1) {
+			single_thread_elapsed = elapsed;
+		}
+		report("scaling", "dispatch_queue", threads, "throughput", task_count / (elapsed / 1e9), "tasks/s");
+		report("scaling", "dispatch_queue", threads, "speedup", single_thread_elapsed / elapsed, "x");
+	}
+
+	for (int threads : thread_counts(options)) {
+		std::atomic<std::uint64_t> sum { 0 };
+		auto start = benchmark_clock::now();
+		std::vector<std::thread> workers;
+		for (int t = 0; t < threads; t++) {
+			workers.emplace_back([&, t] {
+				for (int i = t; i < task_count; i += threads) {
+					sum.fetch_add(fibonacci(work_size), std::memory_order_relaxed);
+				}
+			});
+		}
+		for (auto& worker : workers) {
+			worker.join();
+		}
+		double elapsed = elapsed_nanoseconds(start);
+		report("scaling", "std::thread", threads, "throughput", task_count / (elapsed / 1e9), "tasks/s");
+	}
+}
+
+///////////////////////////////////////////////////////////
+// Bounded pipeline versus a naive `then` chain
+///////////////////////////////////////////////////////////
+static void benchmark_pipeline(const benchmark_options& options) {
+	const int item_count = options.iterations(4000);
+	const int work_size = 14;
+	const size_t max_tokens = 16;
+	for (int threads : thread_counts(options)) {
+		dispatch_queue::dispatch_queue q(threads);
+		std::atomic<int> in_flight { 0 };
+		int peak_in_flight = 0;
+		std::uint64_t checksum = 0;
+		dispatch_queue::pipeline<std::uint64_t> pipeline;
+		pipeline
+			.add_stage(dispatch_queue::pipeline_stage_mode::parallel, [&](std::uint64_t& item) {
+				item += fibonacci(work_size);
+			})
+			.add_stage(dispatch_queue::pipeline_stage_mode::parallel, [&](std::uint64_t& item) {
+				item ^= fibonacci(work_size);
+			})
+			.add_stage(dispatch_queue::pipeline_stage_mode::serial_in_order, [&](std::uint64_t& item) {
+				checksum += item;
+				in_flight--;
+			});
+		int next_item = 0;
+		auto start = benchmark_clock::now();
+		pipeline.run(q, max_tokens, [&](std::uint64_t& item) {
+			if (next_item == item_count) {
+				return false;
+			}
+			item = next_item++;
+			peak_in_flight = std::max(peak_in_flight, ++in_flight);
+			return true;
+		});
+		double elapsed = elapsed_nanoseconds(start);
+		report("pipeline", "pipeline", threads, "throughput", item_count / (elapsed / 1e9), "items/s");
+		report("pipeline", "pipeline", threads, "peak_in_flight", peak_in_flight, "items");
+	}
+
+	for (int threads : thread_counts(options)) {
+		dispatch_queue::dispatch_queue q(threads);
+		std::atomic<int> in_flight { 0 };
+		std::atomic<int> peak_in_flight { 0 };
+		std::mutex encode_mutex;
+		std::uint64_t checksum = 0;
+		auto start = benchmark_clock::now();
+		for (int i = 0; i < item_count; i++) {
+			int current = ++in_flight;
+			int peak = peak_in_flight.load(std::memory_order_relaxed);
+			while (current > peak && !peak_in_flight.compare_exchange_weak(peak, current)) {}
+			q.dispatch([i] {
+				return (std::uint64_t) i + fibonacci(work_size);
+			}).then([](dispatch_queue::task<std::uint64_t> decoded) {
+				return decoded.get() ^ fibonacci(work_size);
+			}).then([&](dispatch_queue::task<std::uint64_t> transformed) {
+				std::lock_guard<std::mutex> lock(encode_mutex);
+				checksum += transformed.get();
+				in_flight--;
+			});
+		}
+		q.wait();
+		double elapsed = elapsed_nanoseconds(start);
+		report("pipeline", "then_chain", threads, "throughput", item_count / (elapsed / 1e9), "items/s");
+		report("pipeline", "then_chain", threads, "peak_in_flight", peak_in_flight, "items");
+	}
+}
+
+///////////////////////////////////////////////////////////
+// Recursive fork-join: task groups versus dispatch + get
+///////////////////////////////////////////////////////////
+static std::uint64_t fork_join_fibonacci(dispatch_queue::dispatch_queue& q, std::uint64_t number, std::uint64_t cutoff) {
+	if (number < cutoff) {
+		return fibonacci(number);
+	}
+	std::uint64_t a, b;
+	dispatch_queue::task_group group(q);
+	group.run([&] { a = fork_join_fibonacci(q, number - 1, cutoff); });
+	group.run([&] { b = fork_join_fibonacci(q, number - 2, cutoff); });
+	group.wait();
+	return a + b;
+}
+
+static std::uint64_t blocking_fibonacci(dispatch_queue::dispatch_queue& q, std::uint64_t number, std::uint64_t cutoff) {
+	if (number < cutoff) {
+		return fibonacci(number);
+	}
+	auto a = q.dispatch(blocking_fibonacci, std::ref(q), number - 1, cutoff);
+	auto b = q.dispatch(blocking_fibonacci, std::ref(q), number - 2, cutoff);
+	// Without compensation, workers waiting for their children would deadlock the queue
+	dispatch_queue::blocking_scope blocking;
+	return a.get() + b.get();
+}
+
+static void benchmark_fork_join(const benchmark_options& options) {
+	const std::uint64_t number = options.quick ? 26 : 30;
+	const std::uint64_t cutoff = 18;
+	for (int threads : thread_counts(options)) {
+		for (bool use_task_group : { true, false }) {
+			dispatch_queue::dispatch_queue q(threads);
+			auto start = benchmark_clock::now();
+			std::uint64_t result = use_task_group
+				? q.dispatch(fork_join_fibonacci, std::ref(q), number, cutoff).get()
+				: q.dispatch(blocking_fibonacci, std::ref(q), number, cutoff).get();
+			double elapsed = elapsed_nanoseconds(start);
+			if (result != fibonacci(number)) {
+				std::cerr << "fork_join: wrong result " << result << std::endl;
+			}
+			const char *implementation = use_task_group ? "task_group" : "dispatch_get";
+			report("fork_join", implementation, threads, "elapsed", elapsed / 1e6, "ms");
+			report("fork_join", implementation, threads, "compensation_threads", q.stats().pool.compensation_threads, "threads");
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////
+// Parallel algorithms versus serial standard algorithms
+///////////////////////////////////////////////////////////
+static void benchmark_parallel_algorithms(const benchmark_options& options) {
+	const size_t element_count = options.quick ? 500000 : 10000000;
+	std::vector<std::uint32_t> input(element_count);
+	std::uint64_t seed = 88172645463325252u;
+	for (auto& value : input) {
+		seed ^= seed << 13;
+		seed ^= seed >> 7;
+		seed ^= seed << 17;
+		value = (std::uint32_t) seed;
+	}
+	std::vector<std::uint32_t> values;
+	std::vector<std::uint64_t> scanned(element_count);
+
+	values = input;
+	auto start = benchmark_clock::now();
+	std::sort(values.begin(), values.end());
+	report("parallel_sort", "std::sort", 1, "throughput", element_count / (elapsed_nanoseconds(start) / 1e9), "elements/s");
+	start = benchmark_clock::now();
+	std::inclusive_scan(input.begin(), input.end(), scanned.begin(), std::plus<>(), (std::uint64_t) 0);
+	report("parallel_scan", "std::inclusive_scan", 1, "throughput", element_count / (elapsed_nanoseconds(start) / 1e9), "elements/s");
+	start = benchmark_clock::now();
+	volatile std::uint64_t sum = std::accumulate(input.begin(), input.end(), (std::uint64_t) 0);
+	report("parallel_reduce", "std::accumulate", 1, "throughput", element_count / (elapsed_nanoseconds(start) / 1e9), "elements/s");
+
+	for (int threads : thread_counts(options)) {
+		dispatch_queue::dispatch_queue q(threads);
+		values = input;
+		start = benchmark_clock::now();
+		dispatch_queue::parallel_sort(q, values.begin(), values.end());
+		report("parallel_sort", "dispatch_queue", threads, "throughput", element_count / (elapsed_nanoseconds(start) / 1e9), "elements/s");
+
+		std::vector<std::uint64_t> widened(element_count);
+		dispatch_queue::parallel_transform(q, input.begin(), input.end(), widened.begin(), [](std::uint32_t value) { return (std::uint64_t) value; });
+		start = benchmark_clock::now();
+		dispatch_queue::parallel_inclusive_scan(q, widened.begin(), widened.end(), scanned.begin());
+		report("parallel_scan", "dispatch_queue", threads, "throughput", element_count / (elapsed_nanoseconds(start) / 1e9), "elements/s");
+
+		start = benchmark_clock::now();
+		sum = dispatch_queue::parallel_reduce(q, input.begin(), input.end(), (std::uint64_t) 0);
+		report("parallel_reduce", "dispatch_queue", threads, "throughput", element_count / (elapsed_nanoseconds(start) / 1e9), "elements/s");
+	}
+	(void) sum;
+}
+
+///////////////////////////////////////////////////////////
+// Key affinity over per-shard hash tables
+///////////////////////////////////////////////////////////
+static void benchmark_affinity(const benchmark_options& options) {
+	const int task_count = options.iterations(4000);
+	const int lookups_per_task = 2000;
+	const std::uint64_t keys_per_shard = 1 << 15;
+	for (int threads : thread_counts(options)) {
+		// One shard per worker, each big enough to spill out of a core's private caches when shared between workers
+		std::vector<std::unordered_map<std::uint64_t, std::uint64_t>> shards(threads);
+		for (auto& shard : shards) {
+			for (std::uint64_t key = 0; key < keys_per_shard; key++) {
+				shard.emplace(key * 2654435761u, key);
+			}
+		}
+		auto lookup_shard = [&](int shard_index, std::uint64_t seed, std::atomic<std::uint64_t>& checksum) {
+			const auto& shard = shards[shard_index];
+			std::uint64_t key = seed, sum = 0;
+			for (int i = 0; i < lookups_per_task; i++) {
+				key = key * 6364136223846793005u + 1442695040888963407u;
+				auto it = shard.find(((key >> 33) % keys_per_shard) * 2654435761u);
+				sum += it->second;
+			}
+			checksum.fetch_add(sum, std::memory_order_relaxed);
+		};
+
+		for (bool use_affinity : { false, true }) {
+			dispatch_queue::dispatch_queue q(threads);
+			std::atomic<std::uint64_t> checksum { 0 };
+			auto start = benchmark_clock::now();
+			for (int i = 0; i < task_count; i++) {
+				int shard_index = i % threads;
+				if (use_affinity) {
+					q.dispatch_with_affinity(shard_index, lookup_shard, shard_index, (std::uint64_t) i, std::ref(checksum));
+				}
+				else {
+					q.dispatch(lookup_shard, shard_index, (std::uint64_t) i, std::ref(checksum));
+				}
+			}
+			q.wait();
+			double elapsed = elapsed_nanoseconds(start);
+			const char *implementation = use_affinity ? "dispatch_with_affinity" : "dispatch";
+			report("affinity", implementation, threads, "throughput", task_count / (elapsed / 1e9), "tasks/s");
+			report("affinity", implementation, threads, "lookup_time", elapsed * threads / ((double) task_count * lookups_per_task), "ns");
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////
+// Failure paths: exceptions versus error results
+///////////////////////////////////////////////////////////
+static bool validation_fails(int input) {
+	return ((std::uint32_t) input * 2654435761u) & 0x80000000u;
+}
+
+static void benchmark_failure_paths(const benchmark_options& options) {
+	const int task_count = options.iterations(200000);
+	const auto invalid = std::make_error_code(std::errc::invalid_argument);
+	for (int threads : thread_counts(options)) {
+		for (bool use_result : { false, true }) {
+			dispatch_queue::dispatch_queue q(threads);
+			int failures = 0;
+			auto start = benchmark_clock::now();
+			if (use_result) {
+				std::vector<dispatch_queue::task<dispatch_queue::result<int>>> tasks;
+				tasks.reserve(task_count);
+				for (int i = 0; i < task_count; i++) {
+					tasks.push_back(q.dispatch([invalid](int input) -> dispatch_queue::result<int> {
+						if (validation_fails(input)) {
+							return dispatch_queue::failure(invalid);
+						}
+						return input;
+					}, i));
+				}
+				for (auto& validated : tasks) {
+					failures += !validated.get();
+				}
+			}
+			else {
+				std::vector<dispatch_queue::task<int>> tasks;
+				tasks.reserve(task_count);
+				for (int i = 0; i < task_count; i++) {
+					tasks.push_back(q.dispatch([invalid](int input) {
+						if (validation_fails(input)) {
+							throw std::system_error(invalid);
+						}
+						return input;
+					}, i));
+				}
+				for (auto& validated : tasks) {
+					validated.wait();
+					failures += validated.get_state() == dispatch_queue::task_state::failed;
+				}
+			}
+			double elapsed = elapsed_nanoseconds(start);
+			const char *implementation = use_result ? "result" : "exception";
+			report("failure_paths", implementation, threads, "throughput", task_count / (elapsed / 1e9), "tasks/s");
+			report("failure_paths", implementation, threads, "failure_rate", (double) failures / task_count, "ratio");
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////
+// Microsecond-scale tasks, taken by workers in batches, with and without the watchdog
+///////////////////////////////////////////////////////////
+static void spin_for(std::chrono::nanoseconds duration) {
+	auto end = benchmark_clock::now() + duration;
+	while (benchmark_clock::now() < end) {
+	}
+}
+
+static void benchmark_micro_tasks(const benchmark_options& options) {
+	const int task_count = options.iterations(200000);
+	for (int task_nanoseconds : { 0, 1000 }) {
+		const char *scenario = task_nanoseconds == 0 ? "micro_tasks_empty" : "micro_tasks_1us";
+		for (int threads : thread_counts(options)) {
+			for (bool use_watchdog : { false, true }) {
+				dispatch_queue::dispatch_queue q(threads);
+				if (use_watchdog) {
+					q.set_watchdog(std::chrono::milliseconds(100), [](const dispatch_queue::stalled_task&) {});
+				}
+				std::atomic<int> counter { 0 };
+				auto start = benchmark_clock::now();
+				for (int i = 0; i < task_count; i++) {
+					q.post([&counter, task_nanoseconds] {
+						spin_for(std::chrono::nanoseconds(task_nanoseconds));
+						counter.fetch_add(1, std::memory_order_relaxed);
+					});
+				}
+				q.wait();
+				double elapsed = elapsed_nanoseconds(start);
+				if (counter != task_count) {
+					std::cerr << scenario << ": only " << counter << " tasks ran" << std::endl;
+				}
+				report(scenario, use_watchdog ? "post_with_watchdog" : "post", threads, "throughput", task_count / (elapsed / 1e9), "tasks/s");
+			}
+		}
+	}
+}
+
+///////////////////////////////////////////////////////////
+// Memory of many small pools with default and small worker stacks
+///////////////////////////////////////////////////////////
+#ifdef __linux__
+/// Returns a field of /proc/self/status in kilobytes, like VmRSS or VmSize
+static double process_status_kilobytes(const char *field) {
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	size_t field_length = std::strlen(field);
+	while (std::getline(status, line)) {
+		if (line.compare(0, field_length, field) == 0 && line.size() > field_length && line[field_length] == ':') {
+			return std::atof(line.c_str() + field_length + 1);
+		}
+	}
+	return 0;
+}
+
+static void benchmark_worker_stacks(const benchmark_options& options) {
+	const int pool_count = options.quick ? 16 : 64;
+	const int threads_per_pool = 4;
+	for (size_t stack_size : { (size_t) 0, (size_t) 64 * 1024 }) {
+		dispatch_queue::worker_options worker_options;
+		worker_options.stack_size = stack_size;
+		double rss_before = process_status_kilobytes("VmRSS");
+		double virtual_before = process_status_kilobytes("VmSize");
+		auto start = benchmark_clock::now();
+		std::vector<std::unique_ptr<dispatch_queue::dispatch_queue>> pools;
+		for (int i = 0; i < pool_count; i++) {
+			pools.emplace_back(new dispatch_queue::dispatch_queue(threads_per_pool, worker_options));
+		}
+		// Each worker touches some of its stack, like real tasks do
+		for (auto& pool : pools) {
+			for (int i = 0; i < threads_per_pool; i++) {
+				pool->dispatch_to_worker(i, [] {
+					volatile char scratch[16 * 1024];
+					for (size_t offset = 0; offset < sizeof(scratch); offset += 512) {
+						scratch[offset] = (char) offset;
+					}
+				});
+			}
+			pool->wait();
+		}
+		double elapsed = elapsed_nanoseconds(start);
+		const char *implementation = stack_size == 0 ? "default_stack" : "64KiB_stack";
+		int thread_total = pool_count * threads_per_pool;
+		report("worker_stacks", implementation, thread_total, "rss_per_thread", (process_status_kilobytes("VmRSS") - rss_before) / thread_total, "KiB");
+		report("worker_stacks", implementation, thread_total, "virtual_per_thread", (process_status_kilobytes("VmSize") - virtual_before) / thread_total, "KiB");
+		report("worker_stacks", implementation, thread_total, "startup_time", elapsed / 1e6, "ms");
+	}
+}
+#endif
+
+///////////////////////////////////////////////////////////
+// Output
+///////////////////////////////////////////////////////////
+static void write_csv(std::ostream& os) {
+	os << "scenario,implementation,threads,metric,value,unit\n";
+	for (auto& result : results) {
+		os << result.scenario << ',' << result.implementation << ',' << result.threads << ','
+			<< result.metric << ',' << result.value << ',' << result.unit << '\n';
+	}
+}
+
+static void write_json(std::ostream& os) {
+	os << "[\n";
+	for (size_t i = 0; i < results.size(); i++) {
+		auto& result = results[i];
+		os << "  {\"scenario\":\"" << result.scenario
+			<< "\",\"implementation\":\"" << result.implementation
+			<< "\",\"threads\":" << result.threads
+			<< ",\"metric\":\"" << result.metric
+			<< "\",\"value\":" << result.value
+			<< ",\"unit\":\"" << result.unit << "\"}"
+			<< (i + 1 < results.size() ? ",\n" : "\n");
+	}
+	os << "]\n";
+}
+
+int main(int argc, char **argv) {
+	benchmark_options options;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--format=json") == 0) {
+			options.json = true;
+		}
+		else if (strcmp(argv[i], "--format=csv") == 0) {
+			options.json = false;
+		}
+		else if (strcmp(argv[i], "--quick") == 0) {
+			options.quick = true;
+		}
+		else if (strncmp(argv[i], "--max-threads=", 14) == 0) {
+			options.max_threads = std::max(1, atoi(argv[i] + 14));
+		}
+		else {
+			std::cerr << "Usage: " << argv[0] << " [--format=csv|json] [--quick] [--max-threads=N]" << std::endl;
+			return 1;
+		}
+	}
+
+	benchmark_enqueue_latency(options);
+	benchmark_ping_pong(options);
+	benchmark_fan_out(options);
+#ifdef __cpp_impl_coroutine
+	benchmark_coroutine_chain(options);
+	benchmark_contended_lock(options);
+#endif
+	benchmark_main_loop_handoff(options);
+	benchmark_multi_producer(options);
+	benchmark_scaling(options);
+	benchmark_pipeline(options);
+	benchmark_affinity(options);
+	benchmark_fork_join(options);
+	benchmark_parallel_algorithms(options);
+	benchmark_failure_paths(options);
+	benchmark_micro_tasks(options);
+#ifdef __linux__
+	benchmark_worker_stacks(options);
+#endif
+
+	std::cout.precision(10);
+	if (options.json) {
+		write_json(std::cout);
+	}
+	else {
+		write_csv(std::cout);
+	}
+	return 0;
+}
@@ -1,5 +1,21 @@
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <numeric>
+#include <sstream>
 #include <thread>
 
+#ifdef __linux__
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
 #include <catch2/catch_test_macros.hpp>
 #include <dispatch_queue.hpp>
 
@@ -81,6 +97,26 @@ TEST_CASE("Dispatch Queue") {
 		REQUIRE(task.get() == 42);
 	}
 
+	SECTION("Main loop wait") {
+		dispatch_queue::dispatch_queue q(-1);
+		REQUIRE(!q.main_loop_wait_for(std::chrono::milliseconds(1)));
+
+		auto task = q.dispatch([&q]{
+			return q.dispatch_main([]{ return 42; });
+		});
+		q.main_loop_wait();
+#ifdef __linux__
+		struct pollfd pfd = { q.main_loop_fd(), POLLIN, 0 };
+		REQUIRE(poll(&pfd, 1, 0) == 1);
+#endif
+		q.main_loop();
+		REQUIRE(task.get().get() == 42);
+		REQUIRE(!q.main_loop_wait_until(std::chrono::steady_clock::now() + std::chrono::milliseconds(1)));
+#ifdef __linux__
+		REQUIRE(poll(&pfd, 1, 0) == 0);
+#endif
+	}
+
 	SECTION("Main loop dependency") {
 		dispatch_queue::dispatch_queue q(-1);
 
@@ -105,12 +141,1344 @@ TEST_CASE("Dispatch Queue") {
 		REQUIRE(task.get() == 42 + 1 + 2);
 	}
 
+	SECTION("Target loops") {
+		dispatch_queue::dispatch_queue q(-1);
+		auto audio = q.create_loop("audio");
+		auto network = q.create_loop("network");
+		REQUIRE(audio.name() == "audio");
+		REQUIRE(audio != network);
+
+		std::thread::id audio_thread_id;
+		auto task = q.dispatch_to(audio, [&]{
+			audio_thread_id = std::this_thread::get_id();
+			return 42;
+		});
+		REQUIRE(audio.size() == 1);
+		REQUIRE(network.empty());
+		REQUIRE(q.empty());
+
+		std::thread audio_thread([=]() mutable {
+			audio.wait();
+			audio.run();
+		});
+		REQUIRE(task.get() == 42);
+		REQUIRE(audio_thread_id == audio_thread.get_id());
+		audio_thread.join();
+		REQUIRE(audio.empty());
+		REQUIRE(!network.wait_for(std::chrono::milliseconds(1)));
+
+		// Invalid loops fail the task instead of running it in a worker thread
+		dispatch_queue::target_loop invalid;
+		std::atomic<bool> has_run { false };
+		auto invalid_task = q.dispatch_to(invalid, [&has_run] { has_run = true; });
+		REQUIRE(invalid_task.get_state() == dispatch_queue::task_state::failed);
+		REQUIRE(invalid_task.get_error() == std::errc::invalid_argument);
+		q.wait();
+		REQUIRE(!has_run);
+	}
+
+	SECTION("Stats") {
+		dispatch_queue::dispatch_queue q(2);
+		REQUIRE(!q.is_stats_enabled());
+		q.set_stats_enabled(true);
+		REQUIRE(q.is_stats_enabled());
+
+		for (int i = 0; i < 10; i++) {
+			q.dispatch([]{ std::this_thread::sleep_for(std::chrono::milliseconds(1)); });
+		}
+#ifdef __cpp_exceptions
+		q.dispatch([]{ throw 1; }).wait();
+#endif
+		q.dispatch([]{});
+		q.wait();
+
+		dispatch_queue::queue_stats stats = q.stats();
+		REQUIRE(stats.enqueued == 12);
+		REQUIRE(stats.max_depth >= 1);
+		REQUIRE(stats.pool.workers.size() == 2);
+#ifdef __cpp_exceptions
+		REQUIRE(stats.pool.failed == 1);
+		REQUIRE(stats.pool.completed == 11);
+#endif
+		REQUIRE(stats.pool.run_time.count() == 12);
+		REQUIRE(stats.pool.wait_time.count() == 12);
+		REQUIRE(stats.pool.run_time.percentile(50) >= std::chrono::milliseconds(1));
+		REQUIRE(stats.pool.workers[0].busy_time + stats.pool.workers[1].busy_time >= std::chrono::milliseconds(10));
+
+		q.reset_stats();
+		REQUIRE(q.stats().enqueued == 0);
+		REQUIRE(q.stats().pool.run_time.count() == 0);
+
+		// Queue fields are per queue, pool fields count the tasks of every queue sharing the pool
+		dispatch_queue::shared_pool pool(1);
+		dispatch_queue::dispatch_queue first(pool);
+		dispatch_queue::dispatch_queue second(pool);
+		first.set_stats_enabled(true);
+		REQUIRE(second.is_stats_enabled());
+		first.dispatch([]{});
+		second.dispatch([]{});
+		second.dispatch([]{});
+		first.wait();
+		second.wait();
+		REQUIRE(first.stats().enqueued == 1);
+		REQUIRE(second.stats().enqueued == 2);
+		REQUIRE(first.stats().pool.run_time.count() == 3);
+		REQUIRE(second.stats().pool.run_time.count() == 3);
+	}
+
+	SECTION("Duration histogram") {
+		using dispatch_queue::duration_histogram;
+		for (uint64_t value : { 0, 1, 7, 8, 9, 100, 1000, 123456789 }) {
+			int index = duration_histogram::bucket_index(value);
+			REQUIRE(duration_histogram::bucket_lower_bound(index).count() <= (int64_t) value);
+			REQUIRE(duration_histogram::bucket_upper_bound(index).count() >= (int64_t) value);
+		}
+		REQUIRE(duration_histogram::bucket_index(UINT64_MAX) == duration_histogram::bucket_count - 1);
+
+		duration_histogram histogram;
+		for (int i = 1; i <= 100; i++) {
+			histogram.record(std::chrono::microseconds(i));
+		}
+		REQUIRE(histogram.count() == 100);
+		auto p50 = histogram.percentile(50);
+		REQUIRE(p50 >= std::chrono::microseconds(50));
+		REQUIRE(p50 <= std::chrono::microseconds(57));
+	}
+
+	SECTION("Tracing") {
+		dispatch_queue::dispatch_queue q(2);
+		q.set_tracing_enabled(true);
+		REQUIRE(q.is_tracing_enabled());
+
+		auto task = q.dispatch(dispatch_queue::task_label("decode \"frame\""), [](int value) {
+			return value;
+		}, 42);
+		task.then([](auto t) { return t.get() + 1; });
+		q.dispatch([]{});
+		q.wait();
+		q.set_tracing_enabled(false);
+		q.dispatch(dispatch_queue::task_label("untraced"), []{});
+		q.wait();
+
+		std::ostringstream trace;
+		q.write_chrome_trace(trace);
+		std::string json = trace.str();
+		REQUIRE(json.find("\"traceEvents\"") != std::string::npos);
+		REQUIRE(json.find("decode \\\"frame\\\"") != std::string::npos);
+		REQUIRE(json.find("\"name\":\"enqueue\"") != std::string::npos);
+		REQUIRE(json.find("\"name\":\"dequeue\"") != std::string::npos);
+		REQUIRE(json.find("\"ph\":\"B\"") != std::string::npos);
+		REQUIRE(json.find("\"ph\":\"E\"") != std::string::npos);
+		REQUIRE(json.find("worker ") != std::string::npos);
+		REQUIRE(json.find("untraced") == std::string::npos);
+
+		dispatch_queue::dispatch_queue::clear_trace();
+		std::ostringstream cleared_trace;
+		q.write_chrome_trace(cleared_trace);
+		REQUIRE(cleared_trace.str().find("\"ph\":\"B\"") == std::string::npos);
+	}
+
+	SECTION("Worker options") {
+		dispatch_queue::worker_options options;
+		options.name = "options";
+		options.stack_size = 256 * 1024;
+		options.scheduling = dispatch_queue::worker_scheduling::normal;
+		options.priority = 5;
+		std::mutex names_mutex;
+		std::vector<std::string> names;
+		std::vector<size_t> stack_sizes;
+		std::vector<int> nice_values;
+		{
+			dispatch_queue::dispatch_queue q(2, options, [&](int) {
+#ifdef __linux__
+				// Attributes are applied before worker_init runs
+				char name[16] = {};
+				pthread_getname_np(pthread_self(), name, sizeof(name));
+				pthread_attr_t attributes;
+				size_t stack_size = 0;
+				pthread_getattr_np(pthread_self(), &attributes);
+				pthread_attr_getstacksize(&attributes, &stack_size);
+				pthread_attr_destroy(&attributes);
+				int nice_value = getpriority(PRIO_PROCESS, (id_t) syscall(SYS_gettid));
+				std::lock_guard<std::mutex> lock(names_mutex);
+				names.push_back(name);
+				stack_sizes.push_back(stack_size);
+				nice_values.push_back(nice_value);
+#endif
+			});
+			REQUIRE(q.dispatch([] { return 1; }).get() == 1);
+		}
+#ifdef __linux__
+		std::sort(names.begin(), names.end());
+		REQUIRE(names == std::vector<std::string> { "options 0", "options 1" });
+		// Sanitizers may enlarge stacks, but they are still far from the 8MB default
+		REQUIRE(stack_sizes.size() == 2);
+		for (size_t stack_size : stack_sizes) {
+			REQUIRE(stack_size >= 256 * 1024);
+			REQUIRE(stack_size < 2 * 1024 * 1024);
+		}
+		REQUIRE(nice_values == std::vector<int> { 5, 5 });
+#endif
+
+		// Real-time scheduling is ignored without privileges, while workers still run tasks
+		options.scheduling = dispatch_queue::worker_scheduling::fifo;
+		options.priority = 10;
+		dispatch_queue::shared_pool pool(1, options);
+		dispatch_queue::dispatch_queue q(pool);
+		REQUIRE(q.dispatch([] { return 2; }).get() == 2);
+	}
+
+	SECTION("Watchdog") {
+		dispatch_queue::dispatch_queue q(1);
+		std::mutex stalled_mutex;
+		std::vector<dispatch_queue::stalled_task> stalled;
+		q.set_watchdog(std::chrono::milliseconds(20), [&](const dispatch_queue::stalled_task& task) {
+			std::lock_guard<std::mutex> lock(stalled_mutex);
+			stalled.push_back(task);
+		});
+		REQUIRE(q.is_watchdog_enabled());
+
+		std::promise<void> gate;
+		auto gate_future = gate.get_future().share();
+		std::atomic<bool> slow_started { false };
+		q.dispatch(dispatch_queue::task_label("slow"), [gate_future, &slow_started] {
+			slow_started = true;
+			gate_future.wait();
+		});
+		q.dispatch([] {});
+		while (!slow_started) {
+			std::this_thread::yield();
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		// Queue age is measured from when the task was queued, whether it is still in the queue or in the worker's batch
+		REQUIRE(q.size() == 1);
+		REQUIRE(q.oldest_pending_age() >= std::chrono::milliseconds(100));
+		gate.set_value();
+		q.wait();
+		REQUIRE(q.oldest_pending_age() == std::chrono::nanoseconds(0));
+		// Quick tasks are not reported
+		for (int i = 0; i < 100; i++) {
+			q.dispatch([] {});
+		}
+		q.wait();
+		{
+			std::lock_guard<std::mutex> lock(stalled_mutex);
+			// The slow task is reported once, even though it stalled for several periods
+			REQUIRE(stalled.size() == 1);
+			REQUIRE(std::string(stalled[0].label) == "slow");
+			REQUIRE(stalled[0].worker_index == 0);
+			REQUIRE(stalled[0].running_time >= std::chrono::milliseconds(20));
+		}
+
+		q.set_watchdog(std::chrono::milliseconds(20), nullptr);
+		REQUIRE(!q.is_watchdog_enabled());
+		q.dispatch([] { std::this_thread::sleep_for(std::chrono::milliseconds(60)); });
+		q.wait();
+		std::lock_guard<std::mutex> lock(stalled_mutex);
+		REQUIRE(stalled.size() == 1);
+	}
+
+	SECTION("Blocking scope") {
+		dispatch_queue::dispatch_queue q(1);
+		for (int round = 0; round < 3; round++) {
+			// With a single worker, the second task only runs if the blocked worker is compensated
+			std::promise<void> unblock;
+			std::shared_future<void> unblocked = unblock.get_future().share();
+			auto blocked = q.dispatch_blocking([unblocked] {
+				unblocked.wait();
+				return 1;
+			});
+			auto unblocker = q.dispatch([&unblock] {
+				unblock.set_value();
+				return 2;
+			});
+			REQUIRE(unblocker.get() == 2);
+			REQUIRE(blocked.get() == 1);
+			q.wait();
+		}
+		// Parked compensation threads are reused
+		auto stats = q.stats();
+		REQUIRE(stats.pool.compensation_threads == 1);
+		REQUIRE(stats.pool.workers.size() == 2);
+
+		// Idle compensation threads exit, keeping the counts of their tasks
+		{
+			dispatch_queue::worker_options options;
+			options.compensation_idle_timeout = std::chrono::milliseconds(20);
+			dispatch_queue::dispatch_queue retiring(1, options);
+			retiring.set_stats_enabled(true);
+			for (int round = 0; round < 2; round++) {
+				std::promise<void> unblock;
+				std::shared_future<void> unblocked = unblock.get_future().share();
+				auto blocked = retiring.dispatch_blocking([unblocked] { unblocked.wait(); });
+				retiring.dispatch([&unblock] { unblock.set_value(); }).get();
+				blocked.get();
+				retiring.wait();
+				auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+				while (retiring.stats().pool.workers.size() > 1 && std::chrono::steady_clock::now() < deadline) {
+					std::this_thread::sleep_for(std::chrono::milliseconds(5));
+				}
+				auto retired_stats = retiring.stats();
+				REQUIRE(retired_stats.pool.workers.size() == 1);
+				REQUIRE(retired_stats.pool.compensation_threads == (uint64_t) round + 1);
+				REQUIRE(retired_stats.pool.completed == (uint64_t) (round + 1) * 2);
+			}
+		}
+
+		// No effect outside worker threads or in immediate mode
+		{
+			dispatch_queue::blocking_scope blocking;
+		}
+		dispatch_queue::dispatch_queue immediate(0);
+		REQUIRE(immediate.dispatch_blocking([] { return 3; }).get() == 3);
+
+		// Move-only functors and arguments
+		auto value = std::make_unique<int>(4);
+		REQUIRE(q.dispatch_blocking([value = std::move(value)] { return *value; }).get() == 4);
+		REQUIRE(q.dispatch_blocking([](const std::unique_ptr<int>& value) { return *value; }, std::make_unique<int>(5)).get() == 5);
+		REQUIRE(q.dispatch([](const std::unique_ptr<int>& value) { return *value; }, std::make_unique<int>(6)).get() == 6);
+		REQUIRE(immediate.dispatch_blocking([](const std::unique_ptr<int>& value) { return *value; }, std::make_unique<int>(7)).get() == 7);
+	}
+
+	SECTION("Batched dequeue") {
+		// Workers take several tasks per lock acquisition, counted by size and dropped by clear
+		{
+			dispatch_queue::dispatch_queue q(1);
+			std::promise<void> first_gate, second_gate;
+			auto first_future = first_gate.get_future().share();
+			auto second_future = second_gate.get_future().share();
+			std::atomic<bool> first_started { false }, second_started { false };
+			std::atomic<int> run_count { 0 };
+			q.dispatch([&, first_future] {
+				first_started = true;
+				first_future.wait();
+			});
+			q.dispatch([&, second_future] {
+				second_started = true;
+				second_future.wait();
+			});
+			for (int i = 0; i < 19; i++) {
+				q.dispatch([&] { run_count++; });
+			}
+			while (!first_started) {
+				std::this_thread::yield();
+			}
+			REQUIRE(q.size() == 20);
+			first_gate.set_value();
+			while (!second_started) {
+				std::this_thread::yield();
+			}
+			REQUIRE(q.size() == 19);
+			q.clear();
+			REQUIRE(q.size() == 0);
+			second_gate.set_value();
+			q.wait();
+			REQUIRE(run_count == 0);
+
+			for (int i = 0; i < 100; i++) {
+				q.dispatch([&] { run_count++; });
+			}
+			q.wait();
+			REQUIRE(run_count == 100);
+		}
+
+		// Waiting for a task in the worker's own batch hands the batch to other workers
+		{
+			dispatch_queue::dispatch_queue q(2);
+			std::promise<void> first_gate, second_gate;
+			auto first_future = first_gate.get_future().share();
+			auto second_future = second_gate.get_future().share();
+			std::atomic<int> started { 0 };
+			q.dispatch([&, first_future] { started++; first_future.wait(); });
+			q.dispatch([&, second_future] { started++; second_future.wait(); });
+			while (started < 2) {
+				std::this_thread::yield();
+			}
+			std::vector<dispatch_queue::task<int>> values;
+			std::promise<void> values_ready;
+			auto values_future = values_ready.get_future().share();
+			auto waiter = q.dispatch([&, values_future] {
+				values_future.wait();
+				return values[0].get() + values[8].get();
+			});
+			for (int i = 0; i < 9; i++) {
+				values.push_back(q.dispatch([i] { return i; }));
+			}
+			values_ready.set_value();
+			first_gate.set_value();
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			second_gate.set_value();
+			REQUIRE(waiter.get() == 8);
+		}
+
+		// Idle workers run tasks batched behind a long running task
+		{
+			dispatch_queue::dispatch_queue q(2);
+			std::promise<void> first_gate, second_gate, long_gate;
+			auto first_future = first_gate.get_future().share();
+			auto second_future = second_gate.get_future().share();
+			auto long_future = long_gate.get_future().share();
+			std::atomic<int> started { 0 };
+			std::atomic<int> run_count { 0 };
+			q.dispatch([&, first_future] { started++; first_future.wait(); });
+			q.dispatch([&, second_future] { started++; second_future.wait(); });
+			while (started < 2) {
+				std::this_thread::yield();
+			}
+			q.dispatch([long_future] { long_future.wait(); });
+			for (int i = 0; i < 10; i++) {
+				q.dispatch([&] { run_count++; });
+			}
+			// The first free worker takes the long task and batches the others, since no worker is idle
+			first_gate.set_value();
+			while (q.size() > 10) {
+				std::this_thread::yield();
+			}
+			second_gate.set_value();
+			auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+			while (run_count < 10 && std::chrono::steady_clock::now() < deadline) {
+				std::this_thread::yield();
+			}
+			REQUIRE(run_count == 10);
+			REQUIRE(q.size() == 0);
+			long_gate.set_value();
+			q.wait();
+		}
+	}
+
+	SECTION("Worker affinity") {
+		std::mutex ids_mutex;
+		std::vector<std::thread::id> worker_ids(3);
+		dispatch_queue::dispatch_queue q(3, [&](int index) {
+			std::lock_guard<std::mutex> lock(ids_mutex);
+			worker_ids[index] = std::this_thread::get_id();
+		});
+		auto current_id = [] { return std::this_thread::get_id(); };
+
+		// Pinned tasks always run on their worker
+		std::vector<dispatch_queue::task<std::thread::id>> pinned;
+		for (int i = 0; i < 30; i++) {
+			pinned.push_back(q.dispatch_to_worker(i, current_id));
+		}
+		for (int i = 0; i < 30; i++) {
+			std::thread::id id = pinned[i].get();
+			std::lock_guard<std::mutex> lock(ids_mutex);
+			REQUIRE(id == worker_ids[i % 3]);
+		}
+
+		// Affinity tasks run on the worker their key hashes to while it is available
+		for (int key = 0; key < 6; key++) {
+			q.wait();
+			std::thread::id id = q.dispatch_with_affinity(key, current_id).get();
+			std::lock_guard<std::mutex> lock(ids_mutex);
+			REQUIRE(id == worker_ids[std::hash<int>()(key) % 3]);
+		}
+
+		// ...and are taken by other workers while it is busy
+		int busy_key = 0;
+		int busy_worker = (int) (std::hash<int>()(busy_key) % 3);
+		std::promise<void> gate;
+		auto gate_future = gate.get_future().share();
+		q.dispatch_to_worker(busy_worker, [gate_future] { gate_future.wait(); });
+		std::vector<dispatch_queue::task<std::thread::id>> stolen;
+		for (int i = 0; i < 10; i++) {
+			stolen.push_back(q.dispatch_with_affinity(busy_key, current_id));
+		}
+		for (auto& t : stolen) {
+			std::thread::id id = t.get();
+			std::lock_guard<std::mutex> lock(ids_mutex);
+			REQUIRE(id != worker_ids[busy_worker]);
+		}
+
+		// Local tasks are counted by size and dropped by clear
+		auto dropped = q.dispatch_to_worker(busy_worker, current_id);
+		REQUIRE(q.size() == 1);
+		q.clear();
+		REQUIRE(q.size() == 0);
+		gate.set_value();
+		q.wait();
+		REQUIRE(dropped.get_state() == dispatch_queue::task_state::pending);
+
+		// Immediate mode runs tasks right away
+		dispatch_queue::dispatch_queue immediate;
+		REQUIRE(immediate.dispatch_to_worker(5, current_id).get() == std::this_thread::get_id());
+		REQUIRE(immediate.dispatch_with_affinity(std::string("key"), current_id).get() == std::this_thread::get_id());
+	}
+
+	SECTION("This worker") {
+		dispatch_queue::dispatch_queue q(2);
+		REQUIRE(dispatch_queue::this_worker::index() == -1);
+		REQUIRE(dispatch_queue::this_worker::queue() == nullptr);
+		for (int i = 0; i < 2; i++) {
+			REQUIRE(q.dispatch_to_worker(i, dispatch_queue::this_worker::index).get() == i);
+		}
+		REQUIRE(q.dispatch(dispatch_queue::this_worker::queue).get() == &q);
+
+		// Queues sharing a pool see themselves
+		dispatch_queue::shared_pool pool(1);
+		dispatch_queue::dispatch_queue a(pool), b(pool);
+		REQUIRE(a.dispatch(dispatch_queue::this_worker::queue).get() == &a);
+		REQUIRE(b.dispatch(dispatch_queue::this_worker::queue).get() == &b);
+
+		// Arenas are reset between tasks
+		dispatch_queue::dispatch_queue serial(1);
+		auto used = serial.dispatch([] {
+			dispatch_queue::scratch_arena& arena = dispatch_queue::this_worker::arena();
+			size_t used_before = arena.used();
+			double *values = arena.allocate_array<double>(1000);
+			for (int i = 0; i < 1000; i++) {
+				values[i] = i;
+			}
+			return std::make_pair(used_before, arena.used());
+		}).get();
+		REQUIRE(used.first == 0);
+		REQUIRE(used.second == 1000 * sizeof(double));
+		REQUIRE(serial.dispatch([] { return dispatch_queue::this_worker::arena().used(); }).get() == 0);
+
+		// Allocations are aligned, and arenas grow past their initial capacity
+		dispatch_queue::scratch_arena arena(128);
+		char *small = (char *) arena.allocate(3, 1);
+		void *aligned = arena.allocate(8, 64);
+		REQUIRE((uintptr_t) aligned % 64 == 0);
+		REQUIRE(small != aligned);
+		void *large = arena.allocate(1000);
+		REQUIRE(large != nullptr);
+		REQUIRE(arena.capacity() >= 1000);
+		size_t capacity = arena.capacity();
+		arena.reset();
+		REQUIRE(arena.used() == 0);
+		REQUIRE(arena.capacity() == capacity);
+		// The merged chunk fits the whole previous cycle without growing
+		arena.allocate(3, 1);
+		arena.allocate(8, 64);
+		arena.allocate(1000);
+		REQUIRE(arena.capacity() == capacity);
+
+#ifdef __cpp_lib_memory_resource
+		auto sum = q.dispatch([] {
+			std::pmr::vector<int> values(dispatch_queue::this_worker::memory_resource());
+			for (int i = 1; i <= 100; i++) {
+				values.push_back(i);
+			}
+			REQUIRE(dispatch_queue::this_worker::arena().used() > 0);
+			int sum = 0;
+			for (int value : values) {
+				sum += value;
+			}
+			return sum;
+		}).get();
+		REQUIRE(sum == 5050);
+#endif
+	}
+
+	SECTION("Shared pool") {
+		dispatch_queue::shared_pool pool(2);
+		REQUIRE(pool.thread_count() == 2);
+		{
+			dispatch_queue::dispatch_queue a(pool);
+			dispatch_queue::dispatch_queue b(pool, 3);
+			REQUIRE(a.is_threaded());
+			REQUIRE(a.thread_count() == 2);
+
+			// Each view has its own queue, size and wait
+			std::promise<void> unblock;
+			std::shared_future<void> unblocked = unblock.get_future().share();
+			std::atomic<int> a_count { 0 }, b_count { 0 };
+			a.dispatch([unblocked, &a_count] { unblocked.wait(); a_count++; });
+			for (int i = 0; i < 10; i++) {
+				b.dispatch([&b_count] { b_count++; });
+			}
+			b.wait();
+			REQUIRE(b_count == 10);
+			REQUIRE(b.empty());
+			REQUIRE(!a.wait_for(std::chrono::milliseconds(0)));
+			unblock.set_value();
+			a.wait();
+			REQUIRE(a_count == 1);
+
+			// Clearing one view does not affect the other
+			std::promise<void> unblock_again;
+			std::shared_future<void> unblocked_again = unblock_again.get_future().share();
+			for (int i = 0; i < 2; i++) {
+				a.dispatch([unblocked_again] { unblocked_again.wait(); });
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			a.dispatch([] {});
+			b.dispatch([] {});
+			a.clear();
+			REQUIRE(a.size() == 0);
+			REQUIRE(b.size() == 1);
+			unblock_again.set_value();
+			b.wait();
+			a.wait();
+		}
+
+		// Views may be destroyed while the pool is still used
+		dispatch_queue::dispatch_queue c(pool);
+		REQUIRE(c.dispatch([] { return 7; }).get() == 7);
+		REQUIRE(dispatch_queue::dispatch_queue(dispatch_queue::shared_pool::global()).dispatch([] { return 8; }).get() == 8);
+
+		// Queues may be destroyed by their own tasks, even when releasing the pool.
+		// Tasks wait for `dispatch` to return, since it still uses the queue.
+		std::promise<void> dispatched;
+		auto dispatched_future = dispatched.get_future().share();
+		auto view = std::make_unique<dispatch_queue::dispatch_queue>(pool);
+		auto view_task = view->dispatch([&view, dispatched_future] {
+			dispatched_future.wait();
+			view.reset();
+			return 9;
+		});
+		auto owner = std::make_unique<dispatch_queue::dispatch_queue>(2);
+		auto owner_task = owner->dispatch([&owner, dispatched_future] {
+			dispatched_future.wait();
+			owner.reset();
+			return 10;
+		});
+		dispatched.set_value();
+		REQUIRE(view_task.get() == 9);
+		REQUIRE(owner_task.get() == 10);
+		REQUIRE(c.dispatch([] { return 11; }).get() == 11);
+	}
+
+	SECTION("Shared pool weights") {
+		dispatch_queue::shared_pool pool(1);
+		dispatch_queue::dispatch_queue light(pool, 1);
+		dispatch_queue::dispatch_queue heavy(pool, 3);
+		std::promise<void> unblock;
+		std::shared_future<void> unblocked = unblock.get_future().share();
+		light.dispatch([unblocked] { unblocked.wait(); });
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+		std::mutex order_mutex;
+		std::string order;
+		for (int i = 0; i < 4; i++) {
+			light.dispatch([&] { std::lock_guard<std::mutex> lock(order_mutex); order += 'l'; });
+			heavy.dispatch([&] { std::lock_guard<std::mutex> lock(order_mutex); order += 'h'; });
+		}
+		unblock.set_value();
+		light.wait();
+		heavy.wait();
+		REQUIRE(order.size() == 8);
+		// In the first 4 tasks, heavy got 3 times as many turns as light
+		REQUIRE(std::count(order.begin(), order.begin() + 4, 'h') == 3);
+	}
+
+	SECTION("Coalesced dispatch") {
+		dispatch_queue::dispatch_queue q(1);
+		int mesh = 0, other_mesh = 0;
+		std::atomic<int> recompute_count { 0 };
+		auto recompute = [&recompute_count](int *target) {
+			recompute_count++;
+			return *target;
+		};
+
+		std::promise<void> unblock;
+		std::shared_future<void> unblocked = unblock.get_future().share();
+		q.dispatch([unblocked] { unblocked.wait(); });
+		auto first = q.dispatch_coalesced(&mesh, recompute, &mesh);
+		for (int i = 0; i < 5; i++) {
+			auto merged = q.dispatch_coalesced(&mesh, recompute, &mesh);
+			REQUIRE(merged == first);
+		}
+		auto other = q.dispatch_coalesced(&other_mesh, recompute, &other_mesh);
+		REQUIRE(other != first);
+		// Different result type is never merged
+		auto other_type = q.dispatch_coalesced(&mesh, [] { return std::string("other"); });
+		unblock.set_value();
+		q.wait();
+		REQUIRE(recompute_count == 2);
+		REQUIRE(first.get() == 0);
+		REQUIRE(other_type.get() == "other");
+
+		// Once started, new requests run again
+		mesh = 1;
+		auto second = q.dispatch_coalesced(&mesh, recompute, &mesh);
+		REQUIRE(second != first);
+		REQUIRE(second.get() == 1);
+		REQUIRE(recompute_count == 3);
+
+		dispatch_queue::dispatch_queue immediate;
+		REQUIRE(immediate.dispatch_coalesced(&mesh, recompute, &mesh).get() == 1);
+	}
+
+	SECTION("Debounced dispatch") {
+		dispatch_queue::dispatch_queue q(1);
+		int key = 0;
+		std::atomic<int> run_count { 0 };
+		auto start = std::chrono::steady_clock::now();
+		auto last_request = start;
+		std::vector<dispatch_queue::task<int>> tasks;
+		// Requests are a millisecond apart, well within the delay even on a loaded machine
+		const auto delay = std::chrono::milliseconds(300);
+		for (int i = 0; i < 3; i++) {
+			last_request = std::chrono::steady_clock::now();
+			tasks.push_back(q.dispatch_debounced(&key, delay, [&run_count](int value) {
+				run_count++;
+				return value;
+			}, i));
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		REQUIRE(tasks[1] == tasks[0]);
+		REQUIRE(tasks[2] == tasks[0]);
+		// The latest request wins, and postpones the task
+		REQUIRE(tasks[0].get() == 2);
+		REQUIRE(run_count == 1);
+		REQUIRE(std::chrono::steady_clock::now() - last_request >= delay);
+		REQUIRE(last_request > start);
+
+		// Cleared debounced tasks never run
+		auto cleared = q.dispatch_debounced(&key, std::chrono::milliseconds(10), [&run_count] { run_count++; return 0; });
+		q.clear();
+		std::this_thread::sleep_for(std::chrono::milliseconds(30));
+		REQUIRE(run_count == 1);
+	}
+
+	SECTION("Task cache") {
+		for (int thread_count : { 0, 2 }) {
+			dispatch_queue::dispatch_queue q(thread_count);
+			dispatch_queue::task_cache<std::string, int> cache(2);
+			std::atomic<int> load_count { 0 };
+			auto load = [&load_count](const std::string& name) {
+				load_count++;
+				return (int) name.size();
+			};
+
+			auto a = cache.get_or_dispatch(q, "a", load, "a");
+			auto a2 = cache.get_or_dispatch(q, "a", load, "a");
+			REQUIRE(a == a2);
+			REQUIRE(a.get() == 1);
+			REQUIRE(cache.get_or_dispatch(q, "a", load, "a") == a);
+			REQUIRE(load_count == 1);
+
+			// LRU eviction: "a" was used last, so "bb" is evicted
+			cache.get_or_dispatch(q, "bb", load, "bb").get();
+			cache.find("a");
+			cache.get_or_dispatch(q, "ccc", load, "ccc").get();
+			REQUIRE(cache.size() == 2);
+			REQUIRE(cache.find("a") == a);
+			REQUIRE(!cache.find("bb").valid());
+			REQUIRE(load_count == 3);
+
+			// Invalidation
+			REQUIRE(cache.invalidate("a"));
+			REQUIRE(!cache.invalidate("a"));
+			auto reloaded = cache.get_or_dispatch(q, "a", load, "a");
+			REQUIRE(reloaded != a);
+			REQUIRE(reloaded.get() == 1);
+			REQUIRE(load_count == 4);
+
+			cache.set_capacity(1);
+			REQUIRE(cache.size() == 1);
+			cache.clear();
+			REQUIRE(cache.size() == 0);
+		}
+
+		// Concurrent requests share a single in-flight task
+		dispatch_queue::dispatch_queue q(4);
+		dispatch_queue::task_cache<int, int> cache;
+		std::atomic<int> load_count { 0 };
+		std::vector<dispatch_queue::task<dispatch_queue::task<int>>> requests;
+		for (int i = 0; i < 16; i++) {
+			requests.push_back(q.dispatch([&] {
+				return cache.get_or_dispatch(q, 7, [&load_count] {
+					load_count++;
+					std::this_thread::sleep_for(std::chrono::milliseconds(5));
+					return 49;
+				});
+			}));
+		}
+		for (auto& request : requests) {
+			REQUIRE(request.get().get() == 49);
+		}
+		REQUIRE(load_count == 1);
+
+		// Move-only functors and arguments
+		auto value = std::make_unique<int>(10);
+		REQUIRE(cache.get_or_dispatch(q, 10, [value = std::move(value)] { return *value; }).get() == 10);
+		REQUIRE(cache.get_or_dispatch(q, 11, [](const std::unique_ptr<int>& value) { return *value; }, std::make_unique<int>(11)).get() == 11);
+
+		// Tasks dropped by clear fail instead of staying pending in the cache
+		{
+			dispatch_queue::dispatch_queue single(1);
+			dispatch_queue::task_cache<int, int> dropped_cache;
+			std::promise<void> gate;
+			auto gate_future = gate.get_future().share();
+			std::atomic<bool> gate_started { false };
+			single.dispatch([&gate_started, gate_future] {
+				gate_started = true;
+				gate_future.wait();
+			});
+			while (!gate_started) {
+				std::this_thread::yield();
+			}
+			auto dropped = dropped_cache.get_or_dispatch(single, 1, [] { return 1; });
+			single.clear();
+			REQUIRE(dropped.get_state() == dispatch_queue::task_state::failed);
+			REQUIRE(dropped.get_error() == std::errc::operation_canceled);
+			gate.set_value();
+			REQUIRE(dropped_cache.get_or_dispatch(single, 1, [] { return 2; }).get() == 2);
+		}
+
+#ifdef __cpp_exceptions
+		// Failed tasks are not cached
+		auto failed = cache.get_or_dispatch(q, 8, []() -> int { throw 1; });
+		failed.wait();
+		REQUIRE(failed.get_state() == dispatch_queue::task_state::failed);
+		REQUIRE(cache.get_or_dispatch(q, 8, [] { return 64; }).get() == 64);
+#endif
+	}
+
+	SECTION("Concurrency limiter") {
+		dispatch_queue::dispatch_queue q(4);
+		dispatch_queue::concurrency_limiter limiter(2);
+		REQUIRE(limiter.max_concurrency() == 2);
+		std::atomic<int> running { 0 };
+		std::atomic<int> max_running { 0 };
+		std::atomic<int> finished { 0 };
+		auto limited_work = [&](int value) {
+			int now_running = ++running;
+			int previous_max = max_running;
+			while (now_running > previous_max && !max_running.compare_exchange_weak(previous_max, now_running)) {}
+			std::this_thread::sleep_for(std::chrono::milliseconds(2));
+			running--;
+			finished++;
+			return value;
+		};
+		std::vector<dispatch_queue::task<int>> tasks;
+		for (int i = 0; i < 10; i++) {
+			tasks.push_back(q.dispatch(limiter, limited_work, i));
+		}
+		// Tasks over the limit don't occupy workers
+		REQUIRE(q.dispatch([]{ return 1; }).get() == 1);
+		q.wait();
+		REQUIRE(finished == 10);
+		REQUIRE(max_running <= 2);
+		for (int i = 0; i < 10; i++) {
+			REQUIRE(tasks[i].get() == i);
+		}
+		REQUIRE(limiter.running() == 0);
+		REQUIRE(limiter.deferred() == 0);
+
+		// Clearing drops deferred tasks and releases their slots
+		std::promise<void> gate;
+		std::shared_future<void> gate_future = gate.get_future().share();
+		q.dispatch(limiter, [gate_future]{ gate_future.wait(); });
+		q.dispatch(limiter, [gate_future]{ gate_future.wait(); });
+		auto dropped = q.dispatch(limiter, limited_work, 0);
+		REQUIRE(limiter.deferred() == 1);
+		q.clear();
+		gate.set_value();
+		q.wait();
+		REQUIRE(dropped.get_state() == dispatch_queue::task_state::pending);
+		REQUIRE(limiter.running() == 0);
+		REQUIRE(q.dispatch(limiter, limited_work, 3).get() == 3);
+
+		// Immediate mode ignores the limit
+		dispatch_queue::dispatch_queue immediate;
+		REQUIRE(immediate.dispatch(limiter, limited_work, 5).get() == 5);
+
+#ifdef __cpp_impl_coroutine
+		dispatch_queue::concurrency_limiter coroutine_limiter(1);
+		std::atomic<int> inside { 0 };
+		bool overlapped = false;
+		auto coro = [&]() -> dispatch_queue::task<void> {
+			co_await q.dispatch();
+			auto slot = co_await coroutine_limiter.acquire();
+			if (++inside > 1) {
+				overlapped = true;
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+			inside--;
+		};
+		std::vector<dispatch_queue::task<void>> coroutines;
+		for (int i = 0; i < 6; i++) {
+			coroutines.push_back(coro());
+		}
+		for (auto& c : coroutines) {
+			c.wait();
+		}
+		REQUIRE(!overlapped);
+		REQUIRE(coroutine_limiter.running() == 0);
+#endif
+	}
+
+	SECTION("Channel") {
+		// Bounded
+		dispatch_queue::channel<std::string> bounded(2);
+		REQUIRE(bounded.capacity() == 2);
+		REQUIRE(bounded.try_send("a"));
+		REQUIRE(bounded.try_send("b"));
+		std::string rejected = "c";
+		REQUIRE(!bounded.try_send(std::move(rejected)));
+		REQUIRE(rejected == "c");
+		REQUIRE(bounded.size() == 2);
+		std::string value;
+		REQUIRE(bounded.try_receive(value));
+		REQUIRE(value == "a");
+
+		// Closed channels reject sends, but buffered values are still received
+		bounded.close();
+		REQUIRE(bounded.is_closed());
+		REQUIRE(!bounded.try_send("d"));
+		REQUIRE(bounded.try_receive(value));
+		REQUIRE(value == "b");
+		REQUIRE(!bounded.try_receive(value));
+
+		// Unbounded channels grow as needed and keep FIFO order
+		dispatch_queue::channel<int> unbounded;
+		for (int i = 0; i < 100; i++) {
+			REQUIRE(unbounded.try_send(i));
+		}
+		int received;
+		for (int i = 0; i < 100; i++) {
+			REQUIRE(unbounded.try_receive(received));
+			REQUIRE(received == i);
+		}
+
+#ifdef __cpp_impl_coroutine
+		// Multiple coroutine producers and consumers
+		dispatch_queue::dispatch_queue q(4);
+		dispatch_queue::channel<int> ch(4);
+		auto producer = [](dispatch_queue::dispatch_queue& q, dispatch_queue::channel<int>& ch, int first) -> dispatch_queue::task<int> {
+			co_await q.dispatch();
+			int sent = 0;
+			for (int i = first; i < first + 250; i++) {
+				if (co_await ch.send(i, q.dispatch())) {
+					sent++;
+				}
+			}
+			co_return sent;
+		};
+		auto consumer = [](dispatch_queue::dispatch_queue& q, dispatch_queue::channel<int>& ch) -> dispatch_queue::task<int64_t> {
+			co_await q.dispatch();
+			int64_t sum = 0;
+			while (auto value = co_await ch.receive(q.dispatch())) {
+				sum += *value;
+			}
+			co_return sum;
+		};
+		std::vector<dispatch_queue::task<int64_t>> consumers;
+		for (int i = 0; i < 3; i++) {
+			consumers.push_back(consumer(q, ch));
+		}
+		std::vector<dispatch_queue::task<int>> producers;
+		for (int i = 0; i < 4; i++) {
+			producers.push_back(producer(q, ch, i * 250));
+		}
+		for (auto& p : producers) {
+			REQUIRE(p.get() == 250);
+		}
+		ch.close();
+		int64_t total = 0;
+		for (auto& c : consumers) {
+			total += c.get();
+		}
+		REQUIRE(total == 999 * 1000 / 2);
+
+		// Waiting senders fail when the channel is closed
+		dispatch_queue::channel<int> full(1);
+		REQUIRE(full.try_send(1));
+		auto blocked_send = [](dispatch_queue::channel<int>& ch) -> dispatch_queue::task<bool> {
+			co_return co_await ch.send(2);
+		}(full);
+		REQUIRE(blocked_send.get_state() == dispatch_queue::task_state::pending);
+		full.close();
+		REQUIRE(!blocked_send.get());
+#endif
+	}
+
+	SECTION("Post") {
+		dispatch_queue::dispatch_queue q(2);
+		std::atomic<int> counter { 0 };
+		for (int i = 0; i < 10; i++) {
+			q.post([&counter](int value) { counter += value; }, 2);
+		}
+#ifdef __cpp_exceptions
+		q.post([]{ throw 1; });
+#endif
+		q.wait();
+		REQUIRE(counter == 20);
+	}
+
+	SECTION("Task group") {
+		for (int thread_count : { 0, 1, 3 }) {
+			dispatch_queue::dispatch_queue q(thread_count);
+
+			// Recursive fork-join does not deadlock, even with a single worker
+			std::function<std::uint64_t(int)> fibonacci = [&](int n) -> std::uint64_t {
+				if (n < 2) {
+					return n;
+				}
+				std::uint64_t a, b;
+				dispatch_queue::task_group group(q);
+				group.run([&] { a = fibonacci(n - 1); });
+				group.run([&] { b = fibonacci(n - 2); });
+				group.wait();
+				return a + b;
+			};
+			REQUIRE(q.dispatch(fibonacci, 18).get() == 2584);
+			REQUIRE(fibonacci(15) == 610);
+
+			// Children may run more children in the same group
+			std::atomic<int> counter { 0 };
+			dispatch_queue::task_group group(q);
+			for (int i = 0; i < 10; i++) {
+				group.run([&] {
+					group.run([&] { counter++; });
+					counter++;
+				});
+			}
+			group.wait();
+			REQUIRE(counter == 20);
+			REQUIRE(group.exceptions().empty());
+
+#ifdef __cpp_exceptions
+			// Exceptions are collected and the first one is rethrown after all children finish
+			for (int i = 0; i < 5; i++) {
+				group.run([i, &counter] {
+					counter++;
+					if (i % 2 == 0) {
+						throw i;
+					}
+				});
+			}
+			REQUIRE_THROWS_AS(group.wait(), int);
+			REQUIRE(counter == 25);
+			REQUIRE(group.exceptions().size() == 3);
+
+			// The group is reusable after failures
+			group.run([&] { counter++; });
+			group.wait();
+			REQUIRE(counter == 26);
+			REQUIRE(group.exceptions().empty());
+#endif
+		}
+	}
+
+	SECTION("Parallel algorithms") {
+		for (int thread_count : { 0, 1, 4 }) {
+			dispatch_queue::dispatch_queue q(thread_count);
+			for (size_t size : { 0, 1, 1000, 100003 }) {
+				std::vector<int> values(size);
+				for (size_t i = 0; i < size; i++) {
+					values[i] = (int) ((i * 2654435761u) % 1000);
+				}
+
+				std::vector<int> squares(size);
+				dispatch_queue::parallel_for(q, (size_t) 0, size, [&](size_t i) { squares[i] = values[i] * values[i]; });
+				std::vector<int> transformed(size);
+				REQUIRE(dispatch_queue::parallel_transform(q, values.begin(), values.end(), transformed.begin(), [](int v) { return v * v; }) == transformed.end());
+				REQUIRE(transformed == squares);
+
+				int64_t expected_sum = 0;
+				for (int v : values) {
+					expected_sum += v;
+				}
+				REQUIRE(dispatch_queue::parallel_reduce(q, values.begin(), values.end(), (int64_t) 0) == expected_sum);
+				int expected_max = std::accumulate(values.begin(), values.end(), 7, [](int a, int b) { return std::max(a, b); });
+				REQUIRE(dispatch_queue::parallel_reduce(q, values.begin(), values.end(), 7, [](int a, int b) { return std::max(a, b); }) == expected_max);
+
+				std::vector<int64_t> inclusive(size), exclusive(size);
+				dispatch_queue::parallel_inclusive_scan(q, values.begin(), values.end(), inclusive.begin());
+				dispatch_queue::parallel_exclusive_scan(q, values.begin(), values.end(), exclusive.begin(), (int64_t) 10);
+				int64_t running = 0;
+				bool scans_match = true;
+				for (size_t i = 0; i < size; i++) {
+					scans_match = scans_match && exclusive[i] == running + 10;
+					running += values[i];
+					scans_match = scans_match && inclusive[i] == running;
+				}
+				REQUIRE(scans_match);
+				// In place
+				std::vector<int> in_place = values;
+				dispatch_queue::parallel_inclusive_scan(q, in_place.begin(), in_place.end(), in_place.begin());
+				REQUIRE((size == 0 || in_place.back() == (int) expected_sum));
+
+				std::vector<int> selected(size), expected_selected;
+				std::copy_if(values.begin(), values.end(), std::back_inserter(expected_selected), [](int v) { return v % 3 == 0; });
+				auto selected_end = dispatch_queue::parallel_copy_if(q, values.begin(), values.end(), selected.begin(), [](int v) { return v % 3 == 0; });
+				selected.erase(selected_end, selected.end());
+				REQUIRE(selected == expected_selected);
+
+				REQUIRE(dispatch_queue::parallel_find(q, values.begin(), values.end(), 1000) == values.end());
+				if (size > 0) {
+					int last_value = values.back();
+					REQUIRE(dispatch_queue::parallel_find(q, values.begin(), values.end(), last_value) == std::find(values.begin(), values.end(), last_value));
+					REQUIRE(dispatch_queue::parallel_find_if(q, values.begin(), values.end(), [](int v) { return v > 990; }) == std::find_if(values.begin(), values.end(), [](int v) { return v > 990; }));
+				}
+
+				std::vector<int> sorted = values;
+				dispatch_queue::parallel_sort(q, sorted.begin(), sorted.end());
+				std::vector<int> expected_sorted = values;
+				std::sort(expected_sorted.begin(), expected_sorted.end());
+				REQUIRE(sorted == expected_sorted);
+				dispatch_queue::parallel_sort(q, sorted.begin(), sorted.end(), std::greater<int>());
+				REQUIRE(std::is_sorted(sorted.begin(), sorted.end(), std::greater<int>()));
+			}
+
+			// Move-only elements are sorted without copies
+			std::vector<std::unique_ptr<int>> pointers;
+			for (int i = 0; i < 50000; i++) {
+				pointers.emplace_back(new int((i * 7919) % 50000));
+			}
+			dispatch_queue::parallel_sort(q, pointers.begin(), pointers.end(), [](const std::unique_ptr<int>& a, const std::unique_ptr<int>& b) noexcept { return *a < *b; });
+			bool pointers_sorted = true;
+			for (int i = 0; i < 50000; i++) {
+				pointers_sorted = pointers_sorted && *pointers[i] == i;
+			}
+			REQUIRE(pointers_sorted);
+			// A comparator that may throw makes elements move to the buffer before merging
+			std::vector<std::string> strings;
+			for (int i = 0; i < 50000; i++) {
+				strings.push_back(std::to_string((i * 7919) % 50000));
+			}
+			std::vector<std::string> expected_strings = strings;
+			std::sort(expected_strings.begin(), expected_strings.end());
+			dispatch_queue::parallel_sort(q, strings.begin(), strings.end(), [](const std::string& a, const std::string& b) { return a < b; });
+			REQUIRE(strings == expected_strings);
+
+#ifdef __cpp_exceptions
+			REQUIRE_THROWS_AS(dispatch_queue::parallel_for(q, 0, 100000, [&](int i) {
+				if (i == 99999) {
+					throw i;
+				}
+			}), int);
+#endif
+		}
+	}
+
+	SECTION("Result") {
+		using int_result = dispatch_queue::result<int>;
+		auto invalid = std::make_error_code(std::errc::invalid_argument);
+		auto parse = [invalid](int input) -> int_result {
+			if (input < 0) {
+				return dispatch_queue::failure(invalid);
+			}
+			return input * 2;
+		};
+
+		int_result ok = parse(21);
+		REQUIRE(ok.has_value());
+		REQUIRE(*ok == 42);
+		int_result failed = parse(-1);
+		REQUIRE(!failed);
+		REQUIRE(failed.error() == invalid);
+		REQUIRE(failed.value_or(7) == 7);
+		REQUIRE(ok.map([](int v) { return v + 1; }).value() == 43);
+		REQUIRE(failed.and_then([](int v) { return int_result(v); }).error() == invalid);
+
+		// Assignment between values and errors
+		static_assert(std::is_nothrow_move_constructible<int_result>::value, "result<int> should be nothrow movable");
+		int_result assigned = failed;
+		assigned = ok;
+		REQUIRE(*assigned == 42);
+		assigned = parse(-2);
+		REQUIRE(assigned.error() == invalid);
+		assigned = assigned;
+		REQUIRE(assigned.error() == invalid);
+#ifdef __cpp_exceptions
+		// A throwing copy keeps the previous error
+		struct throwing_copy {
+			throwing_copy() = default;
+			throwing_copy(const throwing_copy&) { throw std::runtime_error("copy"); }
+			throwing_copy(throwing_copy&&) noexcept = default;
+			throwing_copy& operator=(const throwing_copy&) = default;
+		};
+		dispatch_queue::result<throwing_copy> throwing_value = throwing_copy();
+		dispatch_queue::result<throwing_copy> throwing_target = dispatch_queue::failure(invalid);
+		REQUIRE_THROWS_AS(throwing_target = throwing_value, std::runtime_error);
+		REQUIRE(throwing_target.error() == invalid);
+#endif
+
+		for (int thread_count : { 0, 1, 4 }) {
+			dispatch_queue::dispatch_queue q(thread_count);
+
+			// Errors skip `and_then` and `map` continuations without throwing
+			std::atomic<int> continuation_calls { 0 };
+			auto doubled = q.dispatch(parse, 5)
+				.and_then([&](int v) { continuation_calls++; return int_result(v * 2); })
+				.map([&](int v) { continuation_calls++; return v + 1; });
+			REQUIRE(doubled.get().value() == 21);
+			REQUIRE(continuation_calls == 2);
+			auto skipped = q.dispatch(parse, -5)
+				.and_then([&](int v) { continuation_calls++; return int_result(v); })
+				.map([&](int v) { continuation_calls++; return v; });
+			REQUIRE(skipped.get().error() == invalid);
+			REQUIRE(continuation_calls == 2);
+
+			// when_all propagates the first error by value
+			std::vector<dispatch_queue::task<int_result>> parses;
+			for (int i = 0; i < 10; i++) {
+				parses.push_back(q.dispatch(parse, i));
+			}
+			auto all_parsed = dispatch_queue::when_all(parses).get();
+			REQUIRE(all_parsed.has_value());
+			REQUIRE(all_parsed->size() == 10);
+			REQUIRE((*all_parsed)[9] == 18);
+			parses.push_back(q.dispatch(parse, -1));
+			REQUIRE(dispatch_queue::when_all(parses).get().error() == invalid);
+
+			std::vector<dispatch_queue::task<int>> values;
+			for (int i = 0; i < 10; i++) {
+				values.push_back(q.dispatch([i] { return i; }));
+			}
+			REQUIRE(dispatch_queue::when_all(values).get() == std::vector<int> { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9 });
+			REQUIRE(dispatch_queue::when_all(std::vector<dispatch_queue::task<int>>()).get().empty());
+			std::vector<dispatch_queue::task<void>> voids { q.dispatch([] {}), q.dispatch([] {}) };
+			dispatch_queue::when_all(voids).wait();
+		}
+
+		// Tasks failed with an error code
+		auto failed_task = dispatch_queue::task<int>(dispatch_queue::detail::task_future<int>::create_failed(invalid));
+		REQUIRE(failed_task.get_state() == dispatch_queue::task_state::failed);
+		REQUIRE(failed_task.get_error() == invalid);
+		REQUIRE(!failed_task.get_exception());
+		auto joined = dispatch_queue::when_all(std::vector<dispatch_queue::task<int>> { dispatch_queue::task<int>(dispatch_queue::detail::task_future<int>::create_ready(1)), failed_task });
+		REQUIRE(joined.get_state() == dispatch_queue::task_state::failed);
+		REQUIRE(joined.get_error() == invalid);
+#ifdef __cpp_exceptions
+		REQUIRE_THROWS_AS(failed_task.get(), std::system_error);
+#endif
+
+#ifdef __cpp_impl_coroutine
+		dispatch_queue::dispatch_queue q(1);
+		auto coro = [](dispatch_queue::dispatch_queue& q, std::function<int_result(int)> parse) -> dispatch_queue::task<int_result> {
+			int_result first = co_await q.dispatch(parse, 1);
+			int_result second = co_await q.dispatch(parse, -1);
+			if (!second) {
+				co_return dispatch_queue::failure(second.error());
+			}
+			co_return *first + *second;
+		}(q, parse);
+		REQUIRE(coro.get().error() == invalid);
+		auto failing = [](dispatch_queue::dispatch_queue& q, std::error_code error) -> dispatch_queue::task<int> {
+			co_await q.dispatch();
+			co_return dispatch_queue::failure(error);
+		}(q, invalid);
+		failing.wait();
+		REQUIRE(failing.get_error() == invalid);
+		// void coroutines fail with co_await, skipping the rest of their body
+		bool resumed = false;
+		auto failing_void = [](dispatch_queue::dispatch_queue& q, std::error_code error, bool& resumed) -> dispatch_queue::task<void> {
+			co_await q.dispatch();
+			co_await dispatch_queue::fail(error);
+			resumed = true;
+		}(q, invalid, resumed);
+		failing_void.wait();
+		REQUIRE(failing_void.get_state() == dispatch_queue::task_state::failed);
+		REQUIRE(failing_void.get_error() == invalid);
+		REQUIRE(!resumed);
+#endif
+	}
+
+	SECTION("Task graph") {
+		for (int thread_count : { 0, 1, 4 }) {
+			dispatch_queue::dispatch_queue q(thread_count);
+			dispatch_queue::task_graph graph;
+			std::atomic<int> order { 0 };
+			int a_order, b_order, c_order, d_order;
+			// a -> (b, c) -> d
+			auto a = graph.add_node([&]{ a_order = order++; }, "a");
+			auto b = graph.add_node([&]{ b_order = order++; });
+			auto c = graph.add_node([&]{
+				std::this_thread::sleep_for(std::chrono::milliseconds(2));
+				c_order = order++;
+			});
+			auto d = graph.add_node([&]{ d_order = order++; });
+			graph.add_edge(a, b);
+			graph.add_edge(a, c);
+			graph.add_edge(b, d);
+			graph.add_edge(c, d);
+			REQUIRE(graph.node_count() == 4);
+			REQUIRE(std::string(graph.label(a)) == "a");
+
+			for (int run = 0; run < 3; run++) {
+				order = 0;
+				REQUIRE(graph.run(q));
+				REQUIRE(order == 4);
+				REQUIRE(a_order == 0);
+				REQUIRE(d_order == 3);
+				REQUIRE(b_order != c_order);
+			}
+
+			REQUIRE(graph.timing(c).duration() >= std::chrono::milliseconds(2));
+			REQUIRE(graph.timing(d).start >= graph.timing(c).finish);
+			REQUIRE(graph.critical_path() == std::vector<dispatch_queue::task_graph::node_id> { a, c, d });
+
+			graph.add_edge(d, a);
+			REQUIRE(!graph.run(q));
+		}
+	}
+
+	SECTION("Pipeline") {
+		for (int thread_count : { 0, 1, 4 }) {
+			dispatch_queue::dispatch_queue q(thread_count);
+			dispatch_queue::pipeline<std::pair<int, int>> pipeline;
+			std::atomic<int> in_flight { 0 };
+			std::atomic<int> max_in_flight { 0 };
+			std::vector<int> ordered_output;
+			int out_of_order_count = 0;
+			pipeline
+				.add_stage(dispatch_queue::pipeline_stage_mode::parallel, [&](std::pair<int, int>& item) {
+					int current = ++in_flight;
+					int max = max_in_flight;
+					while (current > max && !max_in_flight.compare_exchange_weak(max, current)) {}
+					if (item.first % 3 == 0) {
+						std::this_thread::sleep_for(std::chrono::microseconds(200));
+					}
+					item.second = item.first * 2;
+				})
+				.add_stage(dispatch_queue::pipeline_stage_mode::serial_out_of_order, [&](std::pair<int, int>&) {
+					out_of_order_count++;
+				})
+				.add_stage(dispatch_queue::pipeline_stage_mode::serial_in_order, [&](std::pair<int, int>& item) {
+					ordered_output.push_back(item.second);
+					in_flight--;
+				});
+			REQUIRE(pipeline.stage_count() == 3);
+
+			int next_input = 0;
+			pipeline.run(q, 4, [&](std::pair<int, int>& item) {
+				if (next_input == 100) {
+					return false;
+				}
+				item.first = next_input++;
+				return true;
+			});
+
+			REQUIRE(out_of_order_count == 100);
+			REQUIRE(ordered_output.size() == 100);
+			for (int i = 0; i < 100; i++) {
+				REQUIRE(ordered_output[i] == i * 2);
+			}
+			REQUIRE(max_in_flight <= 4);
+		}
+	}
+
+#ifdef __cpp_exceptions
+	SECTION("Pipeline exception") {
+		dispatch_queue::dispatch_queue q(2);
+		dispatch_queue::pipeline<int> pipeline;
+		pipeline.add_stage(dispatch_queue::pipeline_stage_mode::parallel, [](int& item) {
+			if (item == 10) {
+				throw item;
+			}
+		});
+		int next_input = 0;
+		REQUIRE_THROWS_AS(pipeline.run(q, 3, [&](int& item) {
+			item = next_input++;
+			return true;
+		}), int);
+		REQUIRE(next_input >= 11);
+	}
+#endif
+
 #ifdef __cpp_impl_coroutine
 	SECTION("Dispatch awaiters") {
 		dispatch_queue::dispatch_queue q(-1);
 
 		auto thread_id = std::this_thread::get_id();
-		auto coro = [&, thread_id]() -> dispatch_queue::task<int> {
+		auto coro = [](dispatch_queue::dispatch_queue& q, std::thread::id thread_id) -> dispatch_queue::task<int> {
 			REQUIRE(std::this_thread::get_id() == thread_id);
 			co_await q.dispatch();
 			REQUIRE(std::this_thread::get_id() != thread_id);
@@ -119,11 +1487,415 @@ TEST_CASE("Dispatch Queue") {
 			int value = co_await q.dispatch([]{ return 3; });
 			REQUIRE(value == 3);
 			co_return value;
-		}();
+		}(q, thread_id);
 		while (coro.get_state() != dispatch_queue::task_state::ready) {
 			q.main_loop();
 		}
 		REQUIRE(coro.get() == 3);
 	}
+
+	SECTION("Target loop awaiter") {
+		dispatch_queue::dispatch_queue q(-1);
+		auto loop = q.create_loop("render");
+
+		auto thread_id = std::this_thread::get_id();
+		auto coro = [](dispatch_queue::dispatch_queue& q, dispatch_queue::target_loop loop, std::thread::id thread_id) -> dispatch_queue::task<int> {
+			co_await q.dispatch();
+			REQUIRE(std::this_thread::get_id() != thread_id);
+			co_await q.dispatch_to(loop);
+			REQUIRE(std::this_thread::get_id() == thread_id);
+			co_return 5;
+		}(q, loop, thread_id);
+		while (coro.get_state() != dispatch_queue::task_state::ready) {
+			loop.wait_for(std::chrono::milliseconds(10));
+			loop.run();
+		}
+		REQUIRE(coro.get() == 5);
+	}
+
+	SECTION("Yield") {
+		dispatch_queue::dispatch_queue q(1);
+		std::mutex order_mutex;
+		std::vector<int> order;
+		auto record = [&order_mutex, &order](int value) {
+			std::lock_guard<std::mutex> lock(order_mutex);
+			order.push_back(value);
+		};
+
+		// Block the only worker, so that the coroutine and the short task are queued in a known order
+		std::promise<void> gate;
+		auto gate_future = gate.get_future().share();
+		q.dispatch([gate_future] { gate_future.wait(); });
+		auto coro = [](dispatch_queue::dispatch_queue& q, std::function<void(int)> record) -> dispatch_queue::task<void> {
+			co_await q.yield();
+			for (int i = 0; i < 3; i++) {
+				record(i);
+				co_await q.yield();
+			}
+		}(q, record);
+		q.dispatch(record, 100);
+		gate.set_value();
+		coro.wait();
+		REQUIRE(order == std::vector<int> { 0, 100, 1, 2 });
+
+		// Only yield once the time slice is used up
+		auto busy = [](dispatch_queue::dispatch_queue& q, std::chrono::milliseconds budget, std::atomic<bool>& short_task_done) -> dispatch_queue::task<bool> {
+			co_await q.yield();
+			auto start = std::chrono::steady_clock::now();
+			while (std::chrono::steady_clock::now() - start < std::chrono::milliseconds(30)) {
+				co_await q.yield_if_expired(budget);
+			}
+			co_return short_task_done.load();
+		};
+		for (auto budget : { std::chrono::milliseconds(5), std::chrono::milliseconds(10000) }) {
+			std::atomic<bool> short_task_done { false };
+			std::promise<void> busy_gate;
+			auto busy_gate_future = busy_gate.get_future().share();
+			q.dispatch([busy_gate_future] { busy_gate_future.wait(); });
+			auto busy_task = busy(q, budget, short_task_done);
+			q.dispatch([&short_task_done] { short_task_done = true; });
+			busy_gate.set_value();
+			REQUIRE(busy_task.get() == (budget < std::chrono::seconds(1)));
+			q.wait();
+		}
+
+		// Immediate mode continues right away
+		dispatch_queue::dispatch_queue immediate;
+		auto immediate_coro = [](dispatch_queue::dispatch_queue& q) -> dispatch_queue::task<int> {
+			co_await q.yield();
+			co_await q.yield_if_expired(std::chrono::nanoseconds(0));
+			co_return 1;
+		}(immediate);
+		REQUIRE(immediate_coro.get_state() == dispatch_queue::task_state::ready);
+	}
+
+	SECTION("Async primitives") {
+		dispatch_queue::dispatch_queue q(4);
+
+		// Mutex: contended coroutines suspend instead of blocking workers
+		dispatch_queue::async_mutex mutex;
+		int counter = 0;
+		std::atomic<int> inside { 0 };
+		bool overlapped = false;
+		auto increment = [](dispatch_queue::dispatch_queue& q, dispatch_queue::async_mutex& mutex, int& counter, std::atomic<int>& inside, bool& overlapped) -> dispatch_queue::task<void> {
+			co_await q.dispatch();
+			for (int i = 0; i < 50; i++) {
+				auto lock = co_await mutex.scoped_lock(q.dispatch());
+				if (++inside > 1) {
+					overlapped = true;
+				}
+				counter++;
+				inside--;
+			}
+		};
+		std::vector<dispatch_queue::task<void>> coroutines;
+		for (int i = 0; i < 20; i++) {
+			coroutines.push_back(increment(q, mutex, counter, inside, overlapped));
+		}
+		for (auto& c : coroutines) {
+			c.wait();
+		}
+		REQUIRE(counter == 1000);
+		REQUIRE(!overlapped);
+		REQUIRE(mutex.try_lock());
+		REQUIRE(!mutex.try_lock());
+		mutex.unlock();
+
+		// Semaphore
+		dispatch_queue::async_semaphore semaphore(2);
+		std::atomic<int> max_inside { 0 };
+		auto limited = [](dispatch_queue::dispatch_queue& q, dispatch_queue::async_semaphore& semaphore, std::atomic<int>& inside, std::atomic<int>& max_inside) -> dispatch_queue::task<void> {
+			co_await q.dispatch();
+			co_await semaphore.acquire(q.dispatch());
+			int now_inside = ++inside;
+			int previous_max = max_inside;
+			while (now_inside > previous_max && !max_inside.compare_exchange_weak(previous_max, now_inside)) {}
+			co_await q.dispatch();
+			inside--;
+			semaphore.release();
+		};
+		coroutines.clear();
+		for (int i = 0; i < 10; i++) {
+			coroutines.push_back(limited(q, semaphore, inside, max_inside));
+		}
+		for (auto& c : coroutines) {
+			c.wait();
+		}
+		REQUIRE(max_inside <= 2);
+		REQUIRE(semaphore.available() == 2);
+
+		// Event resumes waiters with their scheduler, here the main loop
+		dispatch_queue::async_manual_reset_event event;
+		REQUIRE(!event.is_set());
+		auto thread_id = std::this_thread::get_id();
+		auto waiter = [](dispatch_queue::dispatch_queue& q, dispatch_queue::async_manual_reset_event& event, std::thread::id thread_id) -> dispatch_queue::task<void> {
+			co_await q.dispatch();
+			co_await event.wait(q.dispatch_main());
+			REQUIRE(std::this_thread::get_id() == thread_id);
+		}(q, event, thread_id);
+		q.dispatch([&event] {
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+			event.set();
+		});
+		while (waiter.get_state() != dispatch_queue::task_state::ready) {
+			q.main_loop_wait();
+			q.main_loop();
+		}
+		REQUIRE(event.is_set());
+		auto already_set = [](dispatch_queue::async_manual_reset_event& event) -> dispatch_queue::task<int> {
+			co_await event;
+			co_return 1;
+		}(event);
+		REQUIRE(already_set.get_state() == dispatch_queue::task_state::ready);
+		event.reset();
+		REQUIRE(!event.is_set());
+
+		// Latch
+		dispatch_queue::async_latch latch(3);
+		auto latch_waiter = [](dispatch_queue::async_latch& latch) -> dispatch_queue::task<int> {
+			co_await latch;
+			co_return 3;
+		}(latch);
+		REQUIRE(!latch.try_wait());
+		for (int i = 0; i < 3; i++) {
+			q.dispatch([&latch] { latch.count_down(); });
+		}
+		REQUIRE(latch_waiter.get() == 3);
+		REQUIRE(latch.try_wait());
+	}
+
+	SECTION("Async generator") {
+		struct counted {
+			int value;
+			int *copies;
+			counted(int value, int *copies) : value(value), copies(copies) {}
+			counted(const counted& other) : value(other.value), copies(other.copies) { (*copies)++; }
+		};
+		dispatch_queue::dispatch_queue q(2);
+		auto thread_id = std::this_thread::get_id();
+		auto produce = [](dispatch_queue::dispatch_queue& q, int count, int *copies, std::thread::id thread_id, bool *producer_threaded) -> dispatch_queue::async_generator<counted> {
+			for (int i = 0; i < count; i++) {
+				co_await q.dispatch();
+				*producer_threaded = std::this_thread::get_id() != thread_id;
+				counted item(i, copies);
+				co_yield item;
+			}
+		};
+		auto consume = [](dispatch_queue::async_generator<counted> items) -> dispatch_queue::task<int> {
+			int sum = 0;
+			while (counted *item = co_await items.next()) {
+				sum += item->value;
+			}
+			co_return sum;
+		};
+		int copies = 0;
+		bool producer_threaded = false;
+		REQUIRE(consume(produce(q, 100, &copies, thread_id, &producer_threaded)).get() == 4950);
+		REQUIRE(copies == 0);
+		REQUIRE(producer_threaded);
+
+		// Lazy start and early destruction
+		bool started = false;
+		bool destroyed = false;
+		{
+			struct guard {
+				bool *destroyed;
+				~guard() { *destroyed = true; }
+			};
+			auto gen = [](bool *started, bool *destroyed) -> dispatch_queue::async_generator<int> {
+				*started = true;
+				guard g { destroyed };
+				for (int i = 0; ; i++) {
+					co_yield i;
+				}
+			}(&started, &destroyed);
+			REQUIRE(!started);
+			auto take_two = [](dispatch_queue::async_generator<int>& gen) -> dispatch_queue::task<int> {
+				int first = *co_await gen.next();
+				int second = *co_await gen.next();
+				co_return first + second;
+			}(gen);
+			REQUIRE(take_two.get() == 1);
+			REQUIRE(!gen.done());
+		}
+		REQUIRE(destroyed);
+
+#ifdef __cpp_exceptions
+		auto failing = []() -> dispatch_queue::async_generator<int> {
+			co_yield 1;
+			throw 2;
+		};
+		auto consume_failing = [](dispatch_queue::async_generator<int> gen) -> dispatch_queue::task<int> {
+			int sum = 0;
+			while (int *value = co_await gen.next()) {
+				sum += *value;
+			}
+			co_return sum;
+		}(failing());
+		REQUIRE_THROWS_AS(consume_failing.get(), int);
+#endif
+	}
+
+	SECTION("Async scope") {
+		dispatch_queue::dispatch_queue q(3);
+		std::atomic<int> counter { 0 };
+		auto child = [](dispatch_queue::dispatch_queue& q, std::atomic<int>& counter, int i) -> dispatch_queue::task<void> {
+			co_await q.dispatch();
+			std::this_thread::sleep_for(std::chrono::milliseconds(i % 3));
+			counter++;
+		};
+		auto parent = [](dispatch_queue::dispatch_queue& q, std::atomic<int>& counter, decltype(child) child) -> dispatch_queue::task<int> {
+			dispatch_queue::async_scope scope;
+			for (int i = 0; i < 20; i++) {
+				scope.spawn(child(q, counter, i));
+			}
+			co_await scope.join(q.dispatch());
+			co_return counter.load();
+		};
+		REQUIRE(parent(q, counter, child).get() == 20);
+
+		// Joining an empty scope does not suspend
+		auto empty = []() -> dispatch_queue::task<bool> {
+			dispatch_queue::async_scope scope;
+			co_await scope.join();
+			co_return scope.exceptions().empty();
+		};
+		REQUIRE(empty().get());
+
+#ifdef __cpp_exceptions
+		auto failing_parent = [](dispatch_queue::dispatch_queue& q) -> dispatch_queue::task<size_t> {
+			dispatch_queue::async_scope scope;
+			for (int i = 0; i < 4; i++) {
+				scope.spawn(q.dispatch([i] {
+					if (i % 2) {
+						throw i;
+					}
+					return i;
+				}));
+			}
+			try {
+				co_await scope.join();
+			}
+			catch (int) {
+				co_return scope.exceptions().size();
+			}
+			co_return 0;
+		};
+		REQUIRE(failing_parent(q).get() == 2);
+#endif
+	}
+
+#ifdef __linux__
+	SECTION("I/O awaiters") {
+		for (int thread_count : { 0, 2 }) {
+			dispatch_queue::dispatch_queue q(thread_count);
+
+			// pipe
+			int pipe_fds[2];
+			REQUIRE(pipe(pipe_fds) == 0);
+			auto read_pipe = [](dispatch_queue::dispatch_queue& q, int fd) -> dispatch_queue::task<std::string> {
+				char buffer[16];
+				ssize_t bytes_read = co_await q.read(fd, buffer, sizeof(buffer));
+				co_return std::string(buffer, bytes_read > 0 ? bytes_read : 0);
+			};
+			auto write_pipe = [](dispatch_queue::dispatch_queue& q, int fd) -> dispatch_queue::task<ssize_t> {
+				co_return co_await q.write(fd, "hello", 5);
+			};
+			if (thread_count > 0) {
+				// reader suspends until data is written, without blocking a worker
+				auto reader = read_pipe(q, pipe_fds[0]);
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				REQUIRE(reader.get_state() == dispatch_queue::task_state::pending);
+				REQUIRE(write_pipe(q, pipe_fds[1]).get() == 5);
+				REQUIRE(reader.get() == "hello");
+			}
+			else {
+				// immediate mode performs I/O synchronously
+				REQUIRE(write_pipe(q, pipe_fds[1]).get() == 5);
+				REQUIRE(read_pipe(q, pipe_fds[0]).get() == "hello");
+			}
+			close(pipe_fds[0]);
+			close(pipe_fds[1]);
+
+			// temporary file
+			FILE *file = tmpfile();
+			REQUIRE(file != nullptr);
+			auto file_roundtrip = [](dispatch_queue::dispatch_queue& q, int fd) -> dispatch_queue::task<std::string> {
+				co_await q.write(fd, "file contents", 13);
+				lseek(fd, 0, SEEK_SET);
+				char buffer[32];
+				ssize_t bytes_read = co_await q.read(fd, buffer, sizeof(buffer));
+				co_return std::string(buffer, bytes_read > 0 ? bytes_read : 0);
+			}(q, fileno(file));
+			REQUIRE(file_roundtrip.get() == "file contents");
+			fclose(file);
+
+			// sleep
+			auto start = std::chrono::steady_clock::now();
+			auto sleeper = [](dispatch_queue::dispatch_queue& q) -> dispatch_queue::task<void> {
+				co_await q.sleep(std::chrono::milliseconds(20));
+			}(q);
+			sleeper.wait();
+			REQUIRE(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
+		}
+
+		// a second read on the same descriptor fails, and destroying the queue cancels pending reads
+		{
+			int pipe_fds[2];
+			REQUIRE(pipe(pipe_fds) == 0);
+			auto read_error = [](dispatch_queue::dispatch_queue& q, int fd) -> dispatch_queue::task<int> {
+				char buffer;
+				ssize_t bytes_read = co_await q.read(fd, &buffer, 1);
+				co_return bytes_read < 0 ? errno : 0;
+			};
+			dispatch_queue::task<int> pending_read;
+			{
+				dispatch_queue::dispatch_queue cancelled_queue(1);
+				pending_read = read_error(cancelled_queue, pipe_fds[0]);
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+				REQUIRE(pending_read.get_state() == dispatch_queue::task_state::pending);
+				REQUIRE(read_error(cancelled_queue, pipe_fds[0]).get() == EBUSY);
+			}
+			REQUIRE(pending_read.get() == ECANCELED);
+			close(pipe_fds[0]);
+			close(pipe_fds[1]);
+		}
+
+		// loopback socket
+		dispatch_queue::dispatch_queue q(2);
+		int listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+		REQUIRE(listen_fd >= 0);
+		sockaddr_in address = {};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		address.sin_port = 0;
+		REQUIRE(bind(listen_fd, (sockaddr *) &address, sizeof(address)) == 0);
+		REQUIRE(listen(listen_fd, 1) == 0);
+		socklen_t address_length = sizeof(address);
+		REQUIRE(getsockname(listen_fd, (sockaddr *) &address, &address_length) == 0);
+
+		auto server = [](dispatch_queue::dispatch_queue& q, int listen_fd) -> dispatch_queue::task<std::string> {
+			int client_fd = (int) co_await q.accept(listen_fd);
+			REQUIRE(client_fd >= 0);
+			char buffer[16];
+			ssize_t bytes_read = co_await q.read(client_fd, buffer, sizeof(buffer));
+			co_await q.write(client_fd, "pong", 4);
+			close(client_fd);
+			co_return std::string(buffer, bytes_read > 0 ? bytes_read : 0);
+		}(q, listen_fd);
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+		REQUIRE(server.get_state() == dispatch_queue::task_state::pending);
+
+		int connect_fd = socket(AF_INET, SOCK_STREAM, 0);
+		REQUIRE(connect(connect_fd, (sockaddr *) &address, sizeof(address)) == 0);
+		REQUIRE(::write(connect_fd, "ping", 4) == 4);
+		char response[4];
+		REQUIRE(::read(connect_fd, response, sizeof(response)) == 4);
+		REQUIRE(std::string(response, 4) == "pong");
+		REQUIRE(server.get() == "ping");
+		close(connect_fd);
+		close(listen_fd);
+	}
+#endif
 #endif
 }